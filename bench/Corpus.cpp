@@ -0,0 +1,438 @@
+#include "Corpus.hpp"
+
+#include "qoi_decoder.hpp"
+#include "qoi_encoder.hpp"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+namespace
+{
+/**
+ * Small deterministic random number generator (SplitMix64), so that the
+ * synthetic corpus is identical on every platform and standard library.
+ */
+class Random
+{
+public:
+    /**
+     * @brief Constructor
+     * @param[in] seed Seed
+     */
+    explicit Random(uint64_t seed) : m_state(seed)
+    {
+    }
+
+    /**
+     * @brief Gets the next random 32-bit value.
+     * @return Random value
+     */
+    uint32_t Next()
+    {
+        uint64_t z = (m_state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return static_cast<uint32_t>((z ^ (z >> 31)) >> 32);
+    }
+
+    /**
+     * @brief Gets a random value in the range [0, bound).
+     * @param[in] bound Exclusive upper bound
+     * @return Random value
+     */
+    uint32_t Next(uint32_t bound)
+    {
+        return static_cast<uint32_t>((static_cast<uint64_t>(Next()) * bound) >> 32);
+    }
+
+private:
+    /**
+     * Generator state
+     */
+    uint64_t m_state;
+};
+
+/**
+ * @brief Clamps the specified value to the range of a byte.
+ * @param[in] value Value
+ * @return Clamped value
+ */
+uint8_t ClampToByte(int32_t value)
+{
+    return static_cast<uint8_t>(std::min(255, std::max(0, value)));
+}
+
+/**
+ * @brief Creates an empty image with the specified properties.
+ * @param[in] name Name of the image
+ * @param[in] width Image width
+ * @param[in] height Image height
+ * @param[in] numChannels Number of channels in the image
+ * @return Image with all pixels set to zero
+ */
+CorpusImage CreateImage(const std::string &name, uint32_t width, uint32_t height, uint8_t numChannels)
+{
+    CorpusImage image;
+    image.name = name + ((numChannels == 4) ? "-rgba" : "-rgb");
+    image.width = width;
+    image.height = height;
+    image.numChannels = numChannels;
+    image.pixels.resize(static_cast<size_t>(width) * height * numChannels);
+    return image;
+}
+
+/**
+ * @brief Fills the image with a single color, which the encoder turns into nothing but QOI_OP_RUN.
+ * @param[in] random Random number generator
+ * @param[in] image Image to fill
+ */
+void FillFlat(Random &random, CorpusImage &image)
+{
+    uint8_t color[4] = { static_cast<uint8_t>(random.Next(256)), static_cast<uint8_t>(random.Next(256)), static_cast<uint8_t>(random.Next(256)), static_cast<uint8_t>(random.Next(256)) };
+    for (size_t i = 0; i < image.pixels.size(); i += image.numChannels)
+    {
+        std::memcpy(&image.pixels[i], color, image.numChannels);
+    }
+}
+
+/**
+ * @brief Fills the image with smooth gradients plus a little jitter, which mostly gives QOI_OP_DIFF and QOI_OP_LUMA.
+ * @param[in] random Random number generator
+ * @param[in] image Image to fill
+ */
+void FillGradient(Random &random, CorpusImage &image)
+{
+    uint8_t *pixel = image.pixels.data();
+    for (uint32_t y = 0; y < image.height; ++y)
+    {
+        for (uint32_t x = 0; x < image.width; ++x)
+        {
+            // Shift all channels together every now and then, so some pixels need QOI_OP_LUMA
+            int32_t jitter = (random.Next(2) == 0) ? static_cast<int32_t>(random.Next(9)) - 4 : 0;
+            pixel[0] = static_cast<uint8_t>((x + y) / 2 + jitter);
+            pixel[1] = static_cast<uint8_t>(x / 3 + y + jitter);
+            pixel[2] = static_cast<uint8_t>((2 * x + 3 * y) / 3 + jitter);
+            if (image.numChannels == 4)
+            {
+                pixel[3] = 255;
+            }
+            pixel += image.numChannels;
+        }
+    }
+}
+
+/**
+ * @brief Fills the image with uniform noise, which gives nothing but QOI_OP_RGB or QOI_OP_RGBA.
+ * @param[in] random Random number generator
+ * @param[in] image Image to fill
+ */
+void FillNoise(Random &random, CorpusImage &image)
+{
+    for (uint8_t &channel : image.pixels)
+    {
+        channel = static_cast<uint8_t>(random.Next(256));
+    }
+}
+
+/**
+ * @brief Fills the image with short spans of a few palette colors, which mostly gives QOI_OP_INDEX.
+ * @param[in] random Random number generator
+ * @param[in] image Image to fill
+ */
+void FillPalette(Random &random, CorpusImage &image)
+{
+    uint8_t palette[16][4];
+    for (uint8_t (&color)[4] : palette)
+    {
+        for (uint8_t &channel : color)
+        {
+            channel = static_cast<uint8_t>(random.Next(256));
+        }
+    }
+
+    size_t pixelCount = static_cast<size_t>(image.width) * image.height;
+    size_t i = 0;
+    while (i < pixelCount)
+    {
+        const uint8_t *color = palette[random.Next(16)];
+        size_t spanLength = 1 + ((random.Next(4) == 0) ? random.Next(4) : 0);
+        size_t spanEnd = std::min(pixelCount, i + spanLength);
+        for (; i < spanEnd; ++i)
+        {
+            std::memcpy(&image.pixels[i * image.numChannels], color, image.numChannels);
+        }
+    }
+}
+
+/**
+ * @brief Fills the image with a smooth low-frequency field plus sensor-like noise, and a noisy
+ *        vignette in the alpha channel. This gives a mix of QOI_OP_LUMA, QOI_OP_RGB and QOI_OP_RGBA.
+ * @param[in] random Random number generator
+ * @param[in] image Image to fill
+ */
+void FillPhoto(Random &random, CorpusImage &image)
+{
+    // Random values on a coarse grid, interpolated bilinearly in between
+    const uint32_t CELL_SIZE = 32;
+    uint32_t gridWidth = image.width / CELL_SIZE + 2;
+    uint32_t gridHeight = image.height / CELL_SIZE + 2;
+    std::vector<int32_t> grid(static_cast<size_t>(gridWidth) * gridHeight * 3);
+    for (int32_t &value : grid)
+    {
+        value = static_cast<int32_t>(random.Next(256));
+    }
+
+    float centerX = image.width * 0.5f;
+    float centerY = image.height * 0.5f;
+    float maxDistanceSquared = centerX * centerX + centerY * centerY;
+
+    uint8_t *pixel = image.pixels.data();
+    for (uint32_t y = 0; y < image.height; ++y)
+    {
+        uint32_t cellY = y / CELL_SIZE;
+        float fy = static_cast<float>(y % CELL_SIZE) / CELL_SIZE;
+        for (uint32_t x = 0; x < image.width; ++x)
+        {
+            uint32_t cellX = x / CELL_SIZE;
+            float fx = static_cast<float>(x % CELL_SIZE) / CELL_SIZE;
+            for (uint32_t c = 0; c < 3; ++c)
+            {
+                const int32_t *topLeft = &grid[(static_cast<size_t>(cellY) * gridWidth + cellX) * 3 + c];
+                const int32_t *bottomLeft = topLeft + static_cast<size_t>(gridWidth) * 3;
+                float top = topLeft[0] + (topLeft[3] - topLeft[0]) * fx;
+                float bottom = bottomLeft[0] + (bottomLeft[3] - bottomLeft[0]) * fx;
+                int32_t noise = static_cast<int32_t>(random.Next(9)) - 4;
+                pixel[c] = ClampToByte(static_cast<int32_t>(top + (bottom - top) * fy) + noise);
+            }
+
+            if (image.numChannels == 4)
+            {
+                float dx = x - centerX;
+                float dy = y - centerY;
+                float falloff = 1.0f - (dx * dx + dy * dy) / maxDistanceSquared;
+                int32_t noise = static_cast<int32_t>(random.Next(5)) - 2;
+                pixel[3] = ClampToByte(static_cast<int32_t>(falloff * 255.0f) + noise);
+            }
+            pixel += image.numChannels;
+        }
+    }
+}
+
+/**
+ * @brief Fills the image like a screenshot of a user interface: flat panels and buttons on a flat background,
+ *        with short lines of text-like detail. This mostly gives long QOI_OP_RUN chunks.
+ * @param[in] random Random number generator
+ * @param[in] image Image to fill
+ */
+void FillUi(Random &random, CorpusImage &image)
+{
+    uint8_t background[4] = { static_cast<uint8_t>(random.Next(256)), static_cast<uint8_t>(random.Next(256)), static_cast<uint8_t>(random.Next(256)), 255 };
+    for (size_t i = 0; i < image.pixels.size(); i += image.numChannels)
+    {
+        std::memcpy(&image.pixels[i], background, image.numChannels);
+    }
+
+    const uint32_t NUM_PANELS = 24;
+    for (uint32_t panel = 0; panel < NUM_PANELS; ++panel)
+    {
+        uint32_t left = random.Next(image.width);
+        uint32_t top = random.Next(image.height);
+        uint32_t right = std::min(image.width, left + 1 + random.Next(image.width / 2 + 1));
+        uint32_t bottom = std::min(image.height, top + 1 + random.Next(image.height / 2 + 1));
+        uint8_t color[4] = { static_cast<uint8_t>(random.Next(256)), static_cast<uint8_t>(random.Next(256)), static_cast<uint8_t>(random.Next(256)), static_cast<uint8_t>(192 + random.Next(64)) };
+        for (uint32_t y = top; y < bottom; ++y)
+        {
+            uint8_t *row = &image.pixels[(static_cast<size_t>(y) * image.width) * image.numChannels];
+            for (uint32_t x = left; x < right; ++x)
+            {
+                std::memcpy(row + x * image.numChannels, color, image.numChannels);
+            }
+
+            // A line of "text" every 16 rows, in short dark strokes
+            if ((y - top) % 16 == 8)
+            {
+                for (uint32_t x = left + 4; x + 4 < right; x += 2 + random.Next(6))
+                {
+                    uint8_t ink = static_cast<uint8_t>(random.Next(64));
+                    uint8_t stroke[4] = { ink, ink, ink, color[3] };
+                    std::memcpy(row + x * image.numChannels, stroke, image.numChannels);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Loads the image at the specified path, either through the QOI decoder or through stb_image.
+ * @param[in] filePath Path to the image file
+ * @param[out] outImage Loaded image
+ * @return Flag indicating whether the image was loaded or not.
+ */
+bool LoadImage(const std::string &filePath, CorpusImage &outImage)
+{
+    outImage.name = filePath;
+
+    qoi::ColorSpace colorSpace;
+    if (qoi::Decode(filePath, outImage.pixels, outImage.width, outImage.height, outImage.numChannels, colorSpace))
+    {
+        return true;
+    }
+
+    int width = 0, height = 0, numChannels = 0;
+    unsigned char *pixels = stbi_load(filePath.c_str(), &width, &height, &numChannels, 0);
+    if (pixels == nullptr)
+    {
+        return false;
+    }
+
+    // QOI only has RGB and RGBA, so let stb_image expand grayscale images
+    if ((numChannels != 3) && (numChannels != 4))
+    {
+        stbi_image_free(pixels);
+        int desiredChannels = (numChannels == 2) ? 4 : 3;
+        pixels = stbi_load(filePath.c_str(), &width, &height, &numChannels, desiredChannels);
+        if (pixels == nullptr)
+        {
+            return false;
+        }
+        numChannels = desiredChannels;
+    }
+
+    outImage.width = static_cast<uint32_t>(width);
+    outImage.height = static_cast<uint32_t>(height);
+    outImage.numChannels = static_cast<uint8_t>(numChannels);
+    outImage.pixels.assign(pixels, pixels + static_cast<size_t>(width) * height * numChannels);
+    stbi_image_free(pixels);
+    return true;
+}
+
+/**
+ * @brief Collects the paths of all regular files under the specified directory, recursively.
+ * @param[in] directoryPath Path to the directory
+ * @param[out] outFilePaths Vector where the file paths will be appended
+ */
+void ListFiles(const std::string &directoryPath, std::vector<std::string> &outFilePaths)
+{
+    DIR *directory = opendir(directoryPath.c_str());
+    if (directory == nullptr)
+    {
+        return;
+    }
+
+    while (dirent *entry = readdir(directory))
+    {
+        if ((strcmp(entry->d_name, ".") == 0) || (strcmp(entry->d_name, "..") == 0))
+        {
+            continue;
+        }
+
+        std::string path = directoryPath + "/" + entry->d_name;
+        struct stat fileStat;
+        if (stat(path.c_str(), &fileStat) != 0)
+        {
+            continue;
+        }
+
+        if (S_ISDIR(fileStat.st_mode))
+        {
+            ListFiles(path, outFilePaths);
+        }
+        else if (S_ISREG(fileStat.st_mode))
+        {
+            outFilePaths.push_back(path);
+        }
+    }
+
+    closedir(directory);
+}
+}
+
+/**
+ * @brief Loads every readable image under the specified directory, recursively.
+ * @param[in] directoryPath Path to the corpus directory
+ * @param[out] outCorpus Vector where the loaded images will be appended, sorted by path
+ */
+void LoadCorpus(const std::string &directoryPath, std::vector<CorpusImage> &outCorpus)
+{
+    std::vector<std::string> filePaths;
+    ListFiles(directoryPath, filePaths);
+    std::sort(filePaths.begin(), filePaths.end());
+
+    for (const std::string &filePath : filePaths)
+    {
+        CorpusImage image;
+        if (LoadImage(filePath, image))
+        {
+            outCorpus.push_back(std::move(image));
+        }
+        else
+        {
+            std::cerr << "Skipping " << filePath << ": not a readable image" << std::endl;
+        }
+    }
+}
+
+/**
+ * @brief Generates a deterministic set of synthetic images that exercise each QOI op in its best and worst case.
+ * @param[in] seed Seed for the random number generator
+ * @param[in] width Width of every image
+ * @param[in] height Height of every image
+ * @param[out] outCorpus Vector where the generated images will be appended
+ */
+void GenerateSyntheticCorpus(uint64_t seed, uint32_t width, uint32_t height, std::vector<CorpusImage> &outCorpus)
+{
+    struct Pattern
+    {
+        const char *name;
+        void (*fill)(Random &, CorpusImage &);
+    };
+    const Pattern PATTERNS[] = {
+        { "flat", FillFlat },
+        { "gradient", FillGradient },
+        { "noise", FillNoise },
+        { "palette", FillPalette },
+        { "photo", FillPhoto },
+        { "ui", FillUi },
+    };
+
+    uint64_t imageIndex = 0;
+    for (const Pattern &pattern : PATTERNS)
+    {
+        for (uint8_t numChannels = 3; numChannels <= 4; ++numChannels)
+        {
+            // Every image gets its own generator, so adding a pattern doesn't change the others
+            Random random(seed ^ (++imageIndex * 0x9E3779B97F4A7C15ull));
+            CorpusImage image = CreateImage(pattern.name, width, height, numChannels);
+            pattern.fill(random, image);
+            outCorpus.push_back(std::move(image));
+        }
+    }
+}
+
+/**
+ * @brief Writes every image of the corpus as a QOI file in the specified directory.
+ * @param[in] corpus Images to write
+ * @param[in] directoryPath Path to an existing directory
+ * @return Flag indicating whether all images were written or not.
+ */
+bool WriteCorpus(const std::vector<CorpusImage> &corpus, const std::string &directoryPath)
+{
+    bool isSuccess = true;
+    for (const CorpusImage &image : corpus)
+    {
+        std::string filePath = directoryPath + "/" + image.name + ".qoi";
+        if (!qoi::Encode(image.pixels, image.width, image.height, image.numChannels, 0, filePath))
+        {
+            std::cerr << "Failed to write " << filePath << std::endl;
+            isSuccess = false;
+        }
+    }
+    return isSuccess;
+}
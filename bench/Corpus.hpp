@@ -0,0 +1,69 @@
+#ifndef QOI_BENCH_CORPUS_HEADER
+#define QOI_BENCH_CORPUS_HEADER
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Image in the benchmark corpus
+ */
+struct CorpusImage
+{
+    /**
+     * Name of the image, shown in the report
+     */
+    std::string name;
+
+    /**
+     * Pixel colors
+     */
+    std::vector<uint8_t> pixels;
+
+    /**
+     * Image width
+     */
+    uint32_t width;
+
+    /**
+     * Image height
+     */
+    uint32_t height;
+
+    /**
+     * Number of channels in the image
+     */
+    uint8_t numChannels;
+};
+
+/**
+ * @brief Loads every readable image under the specified directory, recursively.
+ * @param[in] directoryPath Path to the corpus directory
+ * @param[out] outCorpus Vector where the loaded images will be appended, sorted by path
+ */
+void LoadCorpus(const std::string &directoryPath, std::vector<CorpusImage> &outCorpus);
+
+/**
+ * @brief Generates a deterministic set of synthetic images that exercise each QOI op in its best and worst case.
+ *
+ * For both RGB and RGBA, the set contains a flat fill (all QOI_OP_RUN), a gradient (QOI_OP_DIFF
+ * and QOI_OP_LUMA), uniform noise (QOI_OP_RGB or QOI_OP_RGBA), palette art (QOI_OP_INDEX),
+ * photo-like noise with a varying alpha channel, and a user interface screenshot (long runs with
+ * a little detail). The same seed always gives the same pixels.
+ *
+ * @param[in] seed Seed for the random number generator
+ * @param[in] width Width of every image
+ * @param[in] height Height of every image
+ * @param[out] outCorpus Vector where the generated images will be appended
+ */
+void GenerateSyntheticCorpus(uint64_t seed, uint32_t width, uint32_t height, std::vector<CorpusImage> &outCorpus);
+
+/**
+ * @brief Writes every image of the corpus as a QOI file in the specified directory.
+ * @param[in] corpus Images to write
+ * @param[in] directoryPath Path to an existing directory
+ * @return Flag indicating whether all images were written or not.
+ */
+bool WriteCorpus(const std::vector<CorpusImage> &corpus, const std::string &directoryPath);
+
+#endif // QOI_BENCH_CORPUS_HEADER
@@ -0,0 +1,674 @@
+#include "Corpus.hpp"
+#include "PerfCounters.hpp"
+
+#include "qoi_decoder.hpp"
+#include "qoi_encoder.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace
+{
+/**
+ * Names of the QOI ops, in the order used by OpHistogram
+ */
+const char *OP_NAMES[] = { "rgb", "rgba", "index", "diff", "luma", "run" };
+
+/**
+ * Number of pixels produced by each QOI op, in the order of OP_NAMES
+ */
+typedef std::array<uint64_t, 6> OpHistogram;
+
+/**
+ * Timings of one operation (encode or decode) over the whole corpus
+ */
+struct OperationStats
+{
+    /**
+     * Time taken by every single run on every image, in seconds
+     */
+    std::vector<double> latencies;
+
+    /**
+     * Total time taken by all runs, in seconds
+     */
+    double totalSeconds = 0.0;
+
+    /**
+     * Total number of mispredicted branches in all runs, if the counters are on
+     */
+    uint64_t branchMisses = 0;
+
+    /**
+     * Total number of retired instructions in all runs, if the counters are on
+     */
+    uint64_t instructions = 0;
+};
+
+/**
+ * Results of running the benchmark on a single image
+ */
+struct ImageResults
+{
+    /**
+     * Name of the image
+     */
+    std::string name;
+
+    /**
+     * Size of the raw pixel data, in bytes
+     */
+    uint64_t rawBytes = 0;
+
+    /**
+     * Size of the encoded image, in bytes
+     */
+    uint64_t encodedBytes = 0;
+
+    /**
+     * Total time taken by all encoder runs, in seconds
+     */
+    double encodeSeconds = 0.0;
+
+    /**
+     * Total time taken by all decoder runs, in seconds
+     */
+    double decodeSeconds = 0.0;
+
+    /**
+     * Number of pixels produced by each QOI op in the encoded image
+     */
+    OpHistogram opPixels = {};
+};
+
+/**
+ * Results of running the benchmark over the whole corpus
+ */
+struct BenchmarkResults
+{
+    /**
+     * Encoder timings
+     */
+    OperationStats encode;
+
+    /**
+     * Decoder timings
+     */
+    OperationStats decode;
+
+    /**
+     * Per-image results, in corpus order
+     */
+    std::vector<ImageResults> images;
+
+    /**
+     * Total number of pixels processed per operation
+     */
+    uint64_t totalPixels = 0;
+
+    /**
+     * Total size of the raw pixel data processed per operation, in bytes
+     */
+    uint64_t totalRawBytes = 0;
+
+    /**
+     * Total size of the encoded data produced per operation, in bytes
+     */
+    uint64_t totalEncodedBytes = 0;
+
+    /**
+     * Number of images that did not decode back to the original pixels
+     */
+    size_t numMismatches = 0;
+
+    /**
+     * Flag indicating whether hardware counters were asked for, so that the report has columns for them
+     */
+    bool isCounting = false;
+
+    /**
+     * Flag indicating whether the hardware counters could be read, so that branchMisses and instructions mean something
+     */
+    bool hasCounters = false;
+};
+
+/**
+ * @brief Counts how many pixels each QOI op produces in the specified encoded image.
+ * @param[in] encoded Encoded image
+ * @return Number of pixels per op
+ */
+OpHistogram CountOps(const std::vector<uint8_t> &encoded)
+{
+    OpHistogram histogram = {};
+    size_t offset = 14;
+    size_t end = encoded.size() - 8;
+
+    // Striped images carry a table of stripe offsets after the end marker
+    std::vector<uint64_t> stripeOffsets;
+    uint32_t stripeRows = 0;
+    uint32_t height = qoi::BytesToUint32(encoded[8], encoded[9], encoded[10], encoded[11]);
+    if (qoi::ReadStripeTable(encoded.data(), encoded.size(), height, stripeOffsets, stripeRows))
+    {
+        end -= stripeOffsets.size() * 8 + QOI_STRIPE_TABLE_FOOTER_SIZE;
+    }
+    while (offset < end)
+    {
+        uint8_t chunkTag = encoded[offset];
+        if (chunkTag == QOI_OP_RGB)
+        {
+            ++histogram[0];
+            offset += 4;
+        }
+        else if (chunkTag == QOI_OP_RGBA)
+        {
+            ++histogram[1];
+            offset += 5;
+        }
+        else if ((chunkTag & 0b11000000) == QOI_OP_INDEX)
+        {
+            ++histogram[2];
+            offset += 1;
+        }
+        else if ((chunkTag & 0b11000000) == QOI_OP_DIFF)
+        {
+            ++histogram[3];
+            offset += 1;
+        }
+        else if ((chunkTag & 0b11000000) == QOI_OP_LUMA)
+        {
+            ++histogram[4];
+            offset += 2;
+        }
+        else
+        {
+            histogram[5] += (chunkTag & 0b00111111) + 1;
+            offset += 1;
+        }
+    }
+    return histogram;
+}
+
+/**
+ * @brief Gets the number of seconds elapsed since the specified time point.
+ * @param[in] start Time point
+ * @return Seconds elapsed
+ */
+double SecondsSince(const std::chrono::steady_clock::time_point &start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * @brief Encodes an image of the corpus, either as a plain QOI image or in stripes.
+ * @param[in] image Image to encode
+ * @param[in] stripeRows Number of rows per stripe, or 0 for a plain QOI image
+ * @param[in] numThreads Number of threads for striped encoding, or 0 to use one per hardware thread
+ * @param[out] outEncoded Vector where the encoded image will be placed
+ */
+void EncodeImage(const CorpusImage &image, uint32_t stripeRows, size_t numThreads, std::vector<uint8_t> &outEncoded)
+{
+    outEncoded.clear();
+    if (stripeRows > 0)
+    {
+        qoi::EncodeStriped(image.pixels, image.width, image.height, image.numChannels, 0, stripeRows, numThreads, outEncoded);
+    }
+    else
+    {
+        qoi::Encode(image.pixels, image.width, image.height, image.numChannels, 0, outEncoded);
+    }
+}
+
+/**
+ * @brief Adds what the counters counted since they were started to the totals of an operation.
+ * @param[in,out] counters Counters to stop, or nullptr if they are off
+ * @param[in,out] stats Totals of the operation
+ */
+void AddCounts(PerfCounters *counters, OperationStats &stats)
+{
+    if (counters != nullptr)
+    {
+        counters->Stop();
+        stats.branchMisses += counters->GetCount(PerfCounters::BRANCH_MISSES);
+        stats.instructions += counters->GetCount(PerfCounters::INSTRUCTIONS);
+    }
+}
+
+/**
+ * @brief Encodes and decodes every image in the corpus the specified number of times.
+ * @param[in] corpus Images to run the benchmark on
+ * @param[in] iterations Number of timed runs per image
+ * @param[in] stripeRows Number of rows per stripe, or 0 to benchmark plain QOI images
+ * @param[in] numThreads Number of threads for striped encoding and parallel decoding, or 0 to use one per hardware thread
+ * @param[in] isParallelDecode Flag indicating whether to time the parallel decoder on plain QOI images too
+ * @param[in] counters Hardware counters to read around every run, or nullptr to only measure time
+ * @return Benchmark results
+ */
+BenchmarkResults RunBenchmark(const std::vector<CorpusImage> &corpus, uint32_t iterations, uint32_t stripeRows, size_t numThreads, bool isParallelDecode,
+    PerfCounters *counters)
+{
+    BenchmarkResults results;
+    results.isCounting = (counters != nullptr);
+    results.hasCounters = (counters != nullptr) && counters->IsAvailable();
+
+    std::vector<uint8_t> encoded;
+    std::vector<uint8_t> decoded;
+    std::vector<uint8_t> decodedParallel;
+    for (const CorpusImage &image : corpus)
+    {
+        ImageResults imageResults;
+        imageResults.name = image.name;
+        imageResults.rawBytes = image.pixels.size();
+
+        // Warm up the caches and check the round trip before timing anything.
+        // The parallel decoder has to match the sequential one, and striped images have to decode with both.
+        EncodeImage(image, stripeRows, numThreads, encoded);
+        imageResults.encodedBytes = encoded.size();
+        imageResults.opPixels = CountOps(encoded);
+
+        uint32_t width = 0, height = 0;
+        uint8_t numChannels = 0;
+        qoi::ColorSpace colorSpace;
+        if (!qoi::Decode(encoded, decoded, width, height, numChannels, colorSpace) || (decoded != image.pixels) ||
+            !qoi::DecodeParallel(encoded, decodedParallel, width, height, numChannels, colorSpace, numThreads) || (decodedParallel != decoded))
+        {
+            std::cerr << "Round trip mismatch: " << image.name << std::endl;
+            ++results.numMismatches;
+        }
+
+        for (uint32_t i = 0; i < iterations; ++i)
+        {
+            // The counters are started outside of the timed span, so reading them does not skew the timings
+            if (counters != nullptr)
+            {
+                counters->Start();
+            }
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            EncodeImage(image, stripeRows, numThreads, encoded);
+            double seconds = SecondsSince(start);
+            AddCounts(counters, results.encode);
+            results.encode.latencies.push_back(seconds);
+            imageResults.encodeSeconds += seconds;
+
+            if (counters != nullptr)
+            {
+                counters->Start();
+            }
+            start = std::chrono::steady_clock::now();
+            if ((stripeRows > 0) || isParallelDecode)
+            {
+                qoi::DecodeParallel(encoded, decoded, width, height, numChannels, colorSpace, numThreads);
+            }
+            else
+            {
+                qoi::Decode(encoded, decoded, width, height, numChannels, colorSpace);
+            }
+            seconds = SecondsSince(start);
+            AddCounts(counters, results.decode);
+            results.decode.latencies.push_back(seconds);
+            imageResults.decodeSeconds += seconds;
+        }
+
+        results.encode.totalSeconds += imageResults.encodeSeconds;
+        results.decode.totalSeconds += imageResults.decodeSeconds;
+        results.totalPixels += static_cast<uint64_t>(image.width) * image.height * iterations;
+        results.totalRawBytes += imageResults.rawBytes * iterations;
+        results.totalEncodedBytes += imageResults.encodedBytes * iterations;
+        results.images.push_back(imageResults);
+    }
+
+    return results;
+}
+
+/**
+ * @brief Gets the specified percentile of a set of latencies.
+ * @param[in] latencies Latencies, in seconds
+ * @param[in] percentile Percentile, from 0 to 100
+ * @return Latency at the percentile, in seconds
+ */
+double Percentile(std::vector<double> latencies, double percentile)
+{
+    if (latencies.empty())
+    {
+        return 0.0;
+    }
+
+    size_t index = static_cast<size_t>(percentile / 100.0 * (latencies.size() - 1) + 0.5);
+    std::nth_element(latencies.begin(), latencies.begin() + index, latencies.end());
+    return latencies[index];
+}
+
+/**
+ * @brief Gets the share of the pixels of an image that each QOI op produced, in percent.
+ * @param[in] histogram Number of pixels per op
+ * @param[in] op Index of the op in OP_NAMES
+ * @return Share of the pixels, from 0 to 100
+ */
+double OpShare(const OpHistogram &histogram, size_t op)
+{
+    uint64_t total = 0;
+    for (uint64_t count : histogram)
+    {
+        total += count;
+    }
+    return (total > 0) ? 100.0 * histogram[op] / total : 0.0;
+}
+
+/**
+ * @brief Prints the results of one operation as a row of the text report.
+ * @param[in] name Name of the operation
+ * @param[in] stats Timings of the operation
+ * @param[in] results Results of the whole benchmark
+ */
+void PrintTextRow(const char *name, const OperationStats &stats, const BenchmarkResults &results)
+{
+    printf("%-8s %12.1f %14.2f %12.3f %12.3f",
+        name,
+        results.totalRawBytes / 1e6 / stats.totalSeconds,
+        results.totalPixels / 1e6 / stats.totalSeconds,
+        Percentile(stats.latencies, 50.0) * 1e3,
+        Percentile(stats.latencies, 99.0) * 1e3);
+    if (results.hasCounters)
+    {
+        printf(" %14.4f %12.2f",
+            static_cast<double>(stats.branchMisses) / results.totalPixels,
+            static_cast<double>(stats.instructions) / results.totalPixels);
+    }
+    else if (results.isCounting)
+    {
+        printf(" %14s %12s", "n/a", "n/a");
+    }
+    printf("\n");
+}
+
+/**
+ * @brief Prints the benchmark results as a human-readable table.
+ * @param[in] results Benchmark results
+ * @param[in] isPerImage Flag indicating whether to also print a row for every image
+ * @param[in] iterations Number of timed runs per image
+ */
+void PrintText(const BenchmarkResults &results, bool isPerImage, uint32_t iterations)
+{
+    if (isPerImage)
+    {
+        printf("%-24s %10s %10s %7s", "image", "enc MB/s", "dec MB/s", "ratio");
+        for (const char *opName : OP_NAMES)
+        {
+            printf(" %6s", opName);
+        }
+        printf("\n");
+
+        for (const ImageResults &image : results.images)
+        {
+            printf("%-24s %10.1f %10.1f %7.3f",
+                image.name.c_str(),
+                image.rawBytes * iterations / 1e6 / image.encodeSeconds,
+                image.rawBytes * iterations / 1e6 / image.decodeSeconds,
+                static_cast<double>(image.rawBytes) / image.encodedBytes);
+            for (size_t op = 0; op < image.opPixels.size(); ++op)
+            {
+                printf(" %5.1f%%", OpShare(image.opPixels, op));
+            }
+            printf("\n");
+        }
+        printf("\n");
+    }
+
+    printf("images: %zu, pixels processed: %llu, compression ratio: %.3f, simd: %s\n",
+        results.images.size(),
+        static_cast<unsigned long long>(results.totalPixels),
+        static_cast<double>(results.totalRawBytes) / results.totalEncodedBytes,
+        qoi::GetSimdLevelName(qoi::ActiveSimdLevel()));
+    printf("%-8s %12s %14s %12s %12s", "", "MB/s", "Mpixels/s", "p50 (ms)", "p99 (ms)");
+    if (results.isCounting)
+    {
+        printf(" %14s %12s", "br-miss/pixel", "instr/pixel");
+    }
+    printf("\n");
+    PrintTextRow("encode", results.encode, results);
+    PrintTextRow("decode", results.decode, results);
+}
+
+/**
+ * @brief Prints the results of one operation as a JSON object.
+ * @param[in] name Name of the operation
+ * @param[in] stats Timings of the operation
+ * @param[in] results Results of the whole benchmark
+ */
+void PrintJsonOperation(const char *name, const OperationStats &stats, const BenchmarkResults &results)
+{
+    printf("  \"%s\": {\"mb_per_second\": %.3f, \"pixels_per_second\": %.1f, \"p50_ms\": %.4f, \"p99_ms\": %.4f, \"total_seconds\": %.6f",
+        name,
+        results.totalRawBytes / 1e6 / stats.totalSeconds,
+        results.totalPixels / stats.totalSeconds,
+        Percentile(stats.latencies, 50.0) * 1e3,
+        Percentile(stats.latencies, 99.0) * 1e3,
+        stats.totalSeconds);
+    if (results.hasCounters)
+    {
+        printf(", \"branch_misses_per_pixel\": %.6f, \"instructions_per_pixel\": %.4f",
+            static_cast<double>(stats.branchMisses) / results.totalPixels,
+            static_cast<double>(stats.instructions) / results.totalPixels);
+    }
+    else if (results.isCounting)
+    {
+        printf(", \"branch_misses_per_pixel\": null, \"instructions_per_pixel\": null");
+    }
+    printf("}");
+}
+
+/**
+ * @brief Prints the benchmark results as a JSON document, for tracking regressions over time.
+ * @param[in] results Benchmark results
+ * @param[in] iterations Number of timed runs per image
+ */
+void PrintJson(const BenchmarkResults &results, uint32_t iterations)
+{
+    printf("{\n");
+    printf("  \"images\": %zu,\n", results.images.size());
+    printf("  \"pixels\": %llu,\n", static_cast<unsigned long long>(results.totalPixels));
+    printf("  \"raw_bytes\": %llu,\n", static_cast<unsigned long long>(results.totalRawBytes));
+    printf("  \"encoded_bytes\": %llu,\n", static_cast<unsigned long long>(results.totalEncodedBytes));
+    printf("  \"compression_ratio\": %.4f,\n", static_cast<double>(results.totalRawBytes) / results.totalEncodedBytes);
+    printf("  \"mismatches\": %zu,\n", results.numMismatches);
+    printf("  \"simd\": \"%s\",\n", qoi::GetSimdLevelName(qoi::ActiveSimdLevel()));
+    PrintJsonOperation("encode", results.encode, results);
+    printf(",\n");
+    PrintJsonOperation("decode", results.decode, results);
+    printf(",\n");
+
+    printf("  \"per_image\": [\n");
+    for (size_t i = 0; i < results.images.size(); ++i)
+    {
+        const ImageResults &image = results.images[i];
+        printf("    {\"name\": \"%s\", \"encode_mb_per_second\": %.3f, \"decode_mb_per_second\": %.3f, \"compression_ratio\": %.4f, \"op_pixels\": {",
+            image.name.c_str(),
+            image.rawBytes * iterations / 1e6 / image.encodeSeconds,
+            image.rawBytes * iterations / 1e6 / image.decodeSeconds,
+            static_cast<double>(image.rawBytes) / image.encodedBytes);
+        for (size_t op = 0; op < image.opPixels.size(); ++op)
+        {
+            printf("%s\"%s\": %llu", (op > 0) ? ", " : "", OP_NAMES[op], static_cast<unsigned long long>(image.opPixels[op]));
+        }
+        printf("}}%s\n", (i + 1 < results.images.size()) ? "," : "");
+    }
+    printf("  ]\n");
+    printf("}\n");
+}
+}
+
+int main(int argc, char *argv[])
+{
+    const char* ITERATIONS_OPTION = "-n";
+    const char* SYNTHETIC_FLAG = "--synthetic";
+    const char* SEED_OPTION = "--seed";
+    const char* SIZE_OPTION = "--size";
+    const char* WRITE_CORPUS_OPTION = "--write-corpus";
+    const char* STRIPE_ROWS_OPTION = "--stripe-rows";
+    const char* THREADS_OPTION = "--threads";
+    const char* PARALLEL_DECODE_FLAG = "--parallel-decode";
+    const char* SIMD_OPTION = "--simd";
+    const char* PER_IMAGE_FLAG = "--per-image";
+    const char* JSON_FLAG = "--json";
+    const char* PERF_COUNTERS_FLAG = "--perf-counters";
+
+    std::string corpusPath = {};
+    std::string writeCorpusPath = {};
+    uint32_t iterations = 5;
+    uint64_t seed = 1;
+    uint32_t syntheticWidth = 1920;
+    uint32_t syntheticHeight = 1080;
+    uint32_t stripeRows = 0;
+    size_t numThreads = 0;
+    bool isSynthetic = false;
+    bool isParallelDecode = false;
+    bool isPerImage = false;
+    bool isJson = false;
+    bool isPerfCounters = false;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], ITERATIONS_OPTION) == 0)
+        {
+            if (i + 1 < argc)
+            {
+                iterations = static_cast<uint32_t>(std::max(1, atoi(argv[++i])));
+            }
+        }
+        else if (strcmp(argv[i], SYNTHETIC_FLAG) == 0)
+        {
+            isSynthetic = true;
+        }
+        else if (strcmp(argv[i], SEED_OPTION) == 0)
+        {
+            if (i + 1 < argc)
+            {
+                seed = strtoull(argv[++i], nullptr, 10);
+            }
+        }
+        else if (strcmp(argv[i], SIZE_OPTION) == 0)
+        {
+            if ((i + 1 < argc) && (sscanf(argv[++i], "%ux%u", &syntheticWidth, &syntheticHeight) != 2))
+            {
+                std::cerr << "Invalid size " << argv[i] << ", expected WIDTHxHEIGHT" << std::endl;
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], WRITE_CORPUS_OPTION) == 0)
+        {
+            isSynthetic = true;
+            if (i + 1 < argc)
+            {
+                writeCorpusPath = argv[++i];
+            }
+        }
+        else if (strcmp(argv[i], STRIPE_ROWS_OPTION) == 0)
+        {
+            if (i + 1 < argc)
+            {
+                stripeRows = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+            }
+        }
+        else if (strcmp(argv[i], THREADS_OPTION) == 0)
+        {
+            if (i + 1 < argc)
+            {
+                numThreads = strtoul(argv[++i], nullptr, 10);
+            }
+        }
+        else if (strcmp(argv[i], PARALLEL_DECODE_FLAG) == 0)
+        {
+            isParallelDecode = true;
+        }
+        else if (strcmp(argv[i], SIMD_OPTION) == 0)
+        {
+            // Only lowers the instruction set, so that the scalar and vector code can be compared on one machine
+            const char *level = (i + 1 < argc) ? argv[++i] : "";
+            if (strcmp(level, "scalar") == 0)
+            {
+                qoi::SetSimdLevel(qoi::SimdLevel::Scalar);
+            }
+            else if (strcmp(level, "sse2") == 0)
+            {
+                qoi::SetSimdLevel(qoi::SimdLevel::SSE2);
+            }
+            else if (strcmp(level, "avx2") != 0)
+            {
+                std::cerr << "Invalid instruction set " << level << ", expected scalar, sse2 or avx2" << std::endl;
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], PER_IMAGE_FLAG) == 0)
+        {
+            isPerImage = true;
+        }
+        else if (strcmp(argv[i], JSON_FLAG) == 0)
+        {
+            isJson = true;
+        }
+        else if (strcmp(argv[i], PERF_COUNTERS_FLAG) == 0)
+        {
+            isPerfCounters = true;
+        }
+        else
+        {
+            corpusPath = argv[i];
+        }
+    }
+
+    if (corpusPath.empty() && !isSynthetic)
+    {
+        std::cout << "Usage: " << argv[0] << " [corpus directory] [-n iterations] [--stripe-rows rows] [--threads threads] [--parallel-decode] [--simd level] [--per-image] [--json] [--perf-counters]" << std::endl;
+        std::cout << "       " << argv[0] << " --synthetic [--seed seed] [--size WIDTHxHEIGHT] [-n iterations] [--stripe-rows rows] [--threads threads] [--parallel-decode] [--simd level] [--per-image] [--json] [--perf-counters]" << std::endl;
+        std::cout << "       " << argv[0] << " --write-corpus [directory] [--seed seed] [--size WIDTHxHEIGHT]" << std::endl;
+        return 1;
+    }
+
+    std::vector<CorpusImage> corpus;
+    if (isSynthetic)
+    {
+        GenerateSyntheticCorpus(seed, syntheticWidth, syntheticHeight, corpus);
+
+        // The synthetic images exist to compare op mixes, so always show them one by one
+        isPerImage = true;
+    }
+    else
+    {
+        LoadCorpus(corpusPath, corpus);
+    }
+
+    if (!writeCorpusPath.empty())
+    {
+        return WriteCorpus(corpus, writeCorpusPath) ? 0 : 1;
+    }
+
+    if (corpus.empty())
+    {
+        std::cerr << "No images found in " << corpusPath << std::endl;
+        return 1;
+    }
+
+    PerfCounters counters;
+    if (isPerfCounters && !counters.IsAvailable())
+    {
+        std::cerr << "Hardware performance counters are not available, reporting n/a" << std::endl;
+    }
+
+    BenchmarkResults results = RunBenchmark(corpus, iterations, stripeRows, numThreads, isParallelDecode, isPerfCounters ? &counters : nullptr);
+    if (isJson)
+    {
+        PrintJson(results, iterations);
+    }
+    else
+    {
+        PrintText(results, isPerImage, iterations);
+    }
+
+    return (results.numMismatches == 0) ? 0 : 1;
+}
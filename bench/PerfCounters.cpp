@@ -0,0 +1,105 @@
+#include "PerfCounters.hpp"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstring>
+
+namespace
+{
+/**
+ * @brief Opens a counter of a hardware event for the calling thread and its future children, on any CPU.
+ * @param[in] config Event to count, as one of the PERF_COUNT_HW_* values
+ * @return File descriptor of the counter, or -1 if the kernel does not let us count the event
+ */
+int OpenCounter(uint64_t config)
+{
+    perf_event_attr attributes;
+    memset(&attributes, 0, sizeof(attributes));
+    attributes.size = sizeof(attributes);
+    attributes.type = PERF_TYPE_HARDWARE;
+    attributes.config = config;
+    attributes.disabled = 1;
+    attributes.inherit = 1;
+    attributes.exclude_kernel = 1;
+    attributes.exclude_hv = 1;
+    return static_cast<int>(syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0));
+}
+}
+#endif
+
+PerfCounters::PerfCounters()
+{
+    for (int i = 0; i < NUM_EVENTS; ++i)
+    {
+        m_fds[i] = -1;
+        m_counts[i] = 0;
+    }
+
+#ifdef __linux__
+    m_fds[BRANCH_MISSES] = OpenCounter(PERF_COUNT_HW_BRANCH_MISSES);
+    m_fds[INSTRUCTIONS] = OpenCounter(PERF_COUNT_HW_INSTRUCTIONS);
+#endif
+}
+
+PerfCounters::~PerfCounters()
+{
+#ifdef __linux__
+    for (int fd : m_fds)
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+    }
+#endif
+}
+
+bool PerfCounters::IsAvailable() const
+{
+    for (int fd : m_fds)
+    {
+        if (fd < 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void PerfCounters::Start()
+{
+#ifdef __linux__
+    if (IsAvailable())
+    {
+        for (int fd : m_fds)
+        {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#endif
+}
+
+void PerfCounters::Stop()
+{
+#ifdef __linux__
+    if (IsAvailable())
+    {
+        for (int i = 0; i < NUM_EVENTS; ++i)
+        {
+            ioctl(m_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+            uint64_t count = 0;
+            m_counts[i] = (read(m_fds[i], &count, sizeof(count)) == sizeof(count)) ? count : 0;
+        }
+    }
+#endif
+}
+
+uint64_t PerfCounters::GetCount(Event event) const
+{
+    return m_counts[event];
+}
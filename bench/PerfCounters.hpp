@@ -0,0 +1,73 @@
+#ifndef QOI_BENCH_PERF_COUNTERS_HEADER
+#define QOI_BENCH_PERF_COUNTERS_HEADER
+
+#include <cstdint>
+
+/**
+ * Hardware performance counters of the calling thread and the threads it starts, read through perf_event_open()
+ *
+ * Counting needs Linux and a kernel that exposes the counters to the user (see perf_event_paranoid),
+ * which virtual machines often do not. Everywhere else IsAvailable() returns false and every count stays zero.
+ */
+class PerfCounters
+{
+public:
+    /**
+     * Hardware events that get counted
+     */
+    enum Event
+    {
+        BRANCH_MISSES,
+        INSTRUCTIONS,
+        NUM_EVENTS
+    };
+
+    /**
+     * @brief Opens the counters, stopped and at zero.
+     */
+    PerfCounters();
+
+    /**
+     * @brief Closes the counters.
+     */
+    ~PerfCounters();
+
+    PerfCounters(const PerfCounters &) = delete;
+    PerfCounters &operator=(const PerfCounters &) = delete;
+
+    /**
+     * @brief Checks whether the counters could be opened.
+     * @return true if the counts mean something, false otherwise
+     */
+    bool IsAvailable() const;
+
+    /**
+     * @brief Resets the counters to zero and starts counting.
+     */
+    void Start();
+
+    /**
+     * @brief Stops counting, keeping the counts until the next Start().
+     */
+    void Stop();
+
+    /**
+     * @brief Gets the number of events counted between the last Start() and Stop().
+     * @param[in] event Event to get the count of
+     * @return Number of events
+     */
+    uint64_t GetCount(Event event) const;
+
+private:
+    /**
+     * File descriptor of the counter of each event, or -1 if it could not be opened
+     */
+    int m_fds[NUM_EVENTS];
+
+    /**
+     * Counts read by the last Stop()
+     */
+    uint64_t m_counts[NUM_EVENTS];
+};
+
+#endif
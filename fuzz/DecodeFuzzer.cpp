@@ -0,0 +1,107 @@
+#include "qoi_decoder.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+namespace
+{
+/**
+ * Largest image the fuzzer decodes, in pixels, so that a header with huge dimensions does not just run out of memory
+ */
+const uint64_t MAX_PIXELS = 1 << 22;
+
+/**
+ * @brief Stops the fuzzer when two decoders disagree, which is as much of a bug as a crash.
+ * @param[in] isOk Condition that has to hold
+ * @param[in] message What went wrong
+ */
+void Check(bool isOk, const char *message)
+{
+    if (!isOk)
+    {
+        fprintf(stderr, "%s\n", message);
+        abort();
+    }
+}
+}
+
+/**
+ * @brief Decodes one input generated by libFuzzer with every decoder, which all have to agree with each other.
+ *        The input is in a buffer of exactly its size, so AddressSanitizer catches any read past its end.
+ * @param[in] data Pointer to the input
+ * @param[in] size Size of the input in bytes
+ * @return Always 0
+ */
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    size_t errorOffset = 0;
+    qoi::DecodeError validateError = qoi::Validate(data, size, errorOffset);
+    Check(errorOffset <= size, "Validate() reported an error past the end of the data");
+
+    uint32_t imageWidth = 0, imageHeight = 0;
+    uint8_t numChannels = 0;
+    qoi::ColorSpace colorSpace;
+    if ((qoi::ReadHeader(data, size, imageWidth, imageHeight, numChannels, colorSpace) != qoi::DecodeError::None) ||
+        (imageWidth > MAX_PIXELS) || (static_cast<uint64_t>(imageWidth) * imageHeight > MAX_PIXELS))
+    {
+        return 0;
+    }
+
+    // Destination buffers of exactly the image size, so that AddressSanitizer catches any write past them too
+    const size_t pixelsSize = static_cast<size_t>(imageWidth) * imageHeight * numChannels;
+    std::vector<uint8_t> pixels(pixelsSize);
+    qoi::DecodeError error = qoi::DecodeInto(data, size, pixels.data(), pixels.size(), 0, imageWidth, imageHeight, numChannels, colorSpace);
+    Check((validateError != qoi::DecodeError::None) || (error == qoi::DecodeError::None), "Validate() accepted an image that does not decode");
+
+    std::vector<uint8_t> parallelPixels(pixelsSize);
+    qoi::DecodeError parallelError = qoi::DecodeIntoParallel(data, size, parallelPixels.data(), parallelPixels.size(), 0, imageWidth, imageHeight, numChannels, colorSpace, 2);
+    Check((parallelError == qoi::DecodeError::None) == (error == qoi::DecodeError::None), "DecodeIntoParallel() and DecodeInto() disagree on whether the image decodes");
+    Check((error != qoi::DecodeError::None) || (parallelPixels == pixels), "DecodeIntoParallel() and DecodeInto() decode different pixels");
+
+    // Decode() allocates for itself, within the same limit
+    std::vector<uint8_t> allocatedPixels;
+    bool isDecoded = qoi::Decode(data, size, allocatedPixels, imageWidth, imageHeight, numChannels, colorSpace, qoi::DecodeLimits(MAX_PIXELS));
+    Check(isDecoded == (error == qoi::DecodeError::None), "Decode() and DecodeInto() disagree on whether the image decodes");
+    Check(!isDecoded || (allocatedPixels == pixels), "Decode() and DecodeInto() decode different pixels");
+
+    // Push the input in small pieces, so that chunks get split between them
+    std::vector<uint8_t> streamPixels;
+    qoi::StreamDecoder streamDecoder([&](const uint8_t *row, uint32_t)
+    {
+        streamPixels.insert(streamPixels.end(), row, row + static_cast<size_t>(imageWidth) * numChannels);
+    });
+    for (size_t offset = 0; offset < size; offset += 7)
+    {
+        streamDecoder.Push(data + offset, std::min<size_t>(7, size - offset));
+    }
+    Check((error != qoi::DecodeError::None) || (streamDecoder.Finish() == qoi::DecodeError::None), "StreamDecoder failed on an image that DecodeInto() decodes");
+    Check((error != qoi::DecodeError::None) || (streamPixels == pixels), "StreamDecoder and DecodeInto() decode different pixels");
+
+    return 0;
+}
+
+#ifdef QOI_FUZZ_STANDALONE
+/**
+ * @brief Runs the fuzz target once on each of the files named on the command line, for compilers without libFuzzer
+ *        and for replaying the inputs that libFuzzer saved.
+ */
+int main(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::ifstream file(argv[i], std::ios::binary);
+        std::vector<uint8_t> input((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+        // A copy of exactly the input size, so that reads past its end are caught like under libFuzzer
+        uint8_t *data = new uint8_t[input.size()];
+        std::copy(input.begin(), input.end(), data);
+        LLVMFuzzerTestOneInput(data, input.size());
+        delete[] data;
+    }
+    return 0;
+}
+#endif // QOI_FUZZ_STANDALONE
@@ -1,12 +1,27 @@
 #ifndef QOI_DECODER_HEADER
 #define QOI_DECODER_HEADER
 
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <fstream>
+#include <functional>
+#include <limits>
 #include <string>
+#include <thread>
 #include <vector>
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define QOI_HAVE_MMAP
+#endif
+
 #ifndef QOI_CHUNK_TAGS
 #define QOI_CHUNK_TAGS
 
@@ -19,6 +34,60 @@
 
 #endif // QOI_CHUNK_TAGS
 
+#ifndef QOI_STRIPE_TABLE
+#define QOI_STRIPE_TABLE
+
+// Striped QOI files are plain QOI files followed by a table of where each stripe starts:
+//   uint64 offset of every stripe (big-endian, from the start of the file)
+//   uint32 number of rows per stripe (big-endian)
+//   uint32 number of stripes (big-endian)
+//   4-byte magic "qois"
+#define QOI_STRIPE_TABLE_MAGIC          "qois"
+#define QOI_STRIPE_TABLE_FOOTER_SIZE    12
+
+#endif // QOI_STRIPE_TABLE
+
+#ifndef QOI_PIXEL_TYPE
+#define QOI_PIXEL_TYPE
+
+namespace qoi
+{
+/**
+ * Color of a single pixel, with the channels in the same order as they are laid out in memory
+ */
+struct Pixel
+{
+    uint8_t red;
+    uint8_t green;
+    uint8_t blue;
+    uint8_t alpha;
+};
+
+/**
+ * @brief Reinterprets the specified pixel color as a single 32-bit word, so it can be compared or copied in one go.
+ * @param[in] pixel Pixel color
+ * @return 32-bit word with the same bytes as the pixel color
+ */
+inline uint32_t PixelToWord(const Pixel &pixel)
+{
+    uint32_t word;
+    std::memcpy(&word, &pixel, sizeof(word));
+    return word;
+}
+
+/**
+ * @brief Computes the index of the specified color in the array of previously seen pixels.
+ * @param[in] pixel Pixel color
+ * @return Index of the color in the array of previously seen pixels
+ */
+inline uint32_t ColorHash(const Pixel &pixel)
+{
+    return (static_cast<uint32_t>(pixel.red) * 3 + static_cast<uint32_t>(pixel.green) * 5 + static_cast<uint32_t>(pixel.blue) * 7 + static_cast<uint32_t>(pixel.alpha) * 11) % 64;
+}
+}
+
+#endif // QOI_PIXEL_TYPE
+
 namespace qoi
 {
 /**
@@ -30,6 +99,81 @@ enum class ColorSpace
     LINEAR
 };
 
+/**
+ * Reasons why decoding a QOI image can fail
+ */
+enum class DecodeError
+{
+    None,
+    InvalidHeader,
+    InvalidStride,
+    DestinationTooSmall,
+    TruncatedData,
+    CorruptData,
+    UnreadableFile,
+    InvalidEndMarker,
+    ImageTooLarge
+};
+
+/**
+ * Largest image that the decoder allocates memory for, as set by the caller. The header of an image
+ * is checked against these before anything is allocated, so a hostile header cannot exhaust memory.
+ */
+struct DecodeLimits
+{
+    /**
+     * @brief Constructor. The defaults only reject images that cannot be addressed on this platform.
+     * @param[in] maxPixels Largest number of pixels (width times height)
+     * @param[in] maxBytes Largest size of the decoded pixels in bytes
+     */
+    explicit DecodeLimits(uint64_t maxPixels = std::numeric_limits<uint64_t>::max(), uint64_t maxBytes = std::numeric_limits<uint64_t>::max())
+        : maxPixels(maxPixels)
+        , maxBytes(maxBytes)
+    {
+    }
+
+    /**
+     * Largest number of pixels (width times height)
+     */
+    uint64_t maxPixels;
+
+    /**
+     * Largest size of the decoded pixels in bytes
+     */
+    uint64_t maxBytes;
+};
+
+/**
+ * @brief Gets a human-readable description of the specified decode error.
+ * @param[in] error Decode error
+ * @return Description of the error
+ */
+inline const char *GetErrorMessage(DecodeError error)
+{
+    switch (error)
+    {
+    case DecodeError::None:
+        return "No error";
+    case DecodeError::InvalidHeader:
+        return "Invalid QOI header";
+    case DecodeError::InvalidStride:
+        return "Destination stride is smaller than one row of pixels";
+    case DecodeError::DestinationTooSmall:
+        return "Destination buffer is too small for the image";
+    case DecodeError::TruncatedData:
+        return "QOI data ends before all pixels were decoded";
+    case DecodeError::CorruptData:
+        return "QOI data describes more pixels than the image has";
+    case DecodeError::UnreadableFile:
+        return "Cannot read the QOI file";
+    case DecodeError::InvalidEndMarker:
+        return "QOI data is not followed by a valid end marker";
+    case DecodeError::ImageTooLarge:
+        return "Image is larger than the decoder is allowed to allocate";
+    }
+    return "Unknown error";
+}
+
 /**
  * @brief Gets the byte representing the red component of the specified pixel color.
  * @param[in] color 32-bit representation of the color (RGBA)
@@ -86,198 +230,1705 @@ inline uint32_t BytesToUint32(uint8_t b0, uint8_t b1, uint8_t b2, uint8_t b3)
 }
 
 /**
- * @brief Decodes a QOI format image given data from a stream.
- * @param[in] inStream Byte stream for the QOI format image
- * @param[out] outPixelColors Vector where the decoded pixel colors will be placed
- * @param[out] outImageWidth Width of the decoded image
- * @param[out] outImageHeight Height of the decoded image
- * @param[out] outNumChannels Number of color channels in the decoded image
- * @param[out] outColorSpace Colorspace of the decoded image
- * @return Flag indicating whether the decoding process was successful or not.
+ * @brief Parses the fields of the 14-byte header of a QOI format image, which has to be fully available.
+ * @param[in] header Pointer to the 14 header bytes
+ * @param[out] outImageWidth Width of the image
+ * @param[out] outImageHeight Height of the image
+ * @param[out] outNumChannels Number of color channels in the image
+ * @param[out] outColorSpace Colorspace of the image
+ * @return DecodeError::None if the header is valid, DecodeError::InvalidHeader otherwise.
+ */
+inline DecodeError ParseHeaderFields(const uint8_t *header, uint32_t &outImageWidth, uint32_t &outImageHeight, uint8_t &outNumChannels, ColorSpace &outColorSpace)
+{
+    if ((header[0] != 'q') || (header[1] != 'o') || (header[2] != 'i') || (header[3] != 'f'))
+    {
+        return DecodeError::InvalidHeader;
+    }
+    outImageWidth = BytesToUint32(header[4], header[5], header[6], header[7]);
+    outImageHeight = BytesToUint32(header[8], header[9], header[10], header[11]);
+    outNumChannels = header[12];
+    if ((outNumChannels != 3) && (outNumChannels != 4))
+    {
+        return DecodeError::InvalidHeader;
+    }
+    if (header[13] > 2)
+    {
+        return DecodeError::InvalidHeader;
+    }
+    outColorSpace = header[13] == 0 ? ColorSpace::SRGB : ColorSpace::LINEAR;
+
+    return DecodeError::None;
+}
+
+/**
+ * @brief Parses the 14-byte header of a QOI format image.
+ * @param[in] data Pointer to the QOI data
+ * @param[in] size Size of the QOI data in bytes
+ * @param[out] outImageWidth Width of the image
+ * @param[out] outImageHeight Height of the image
+ * @param[out] outNumChannels Number of color channels in the image
+ * @param[out] outColorSpace Colorspace of the image
+ * @return DecodeError::None if the header is valid, DecodeError::InvalidHeader otherwise.
  */
-inline bool Decode(std::vector<uint8_t> &inStream, std::vector<uint8_t> &outPixelColors, uint32_t &outImageWidth, uint32_t &outImageHeight, uint8_t &outNumChannels, ColorSpace &outColorSpace)
+inline DecodeError ParseHeader(const uint8_t *data, size_t size, uint32_t &outImageWidth, uint32_t &outImageHeight, uint8_t &outNumChannels, ColorSpace &outColorSpace)
 {
-    outPixelColors.clear();
+    if (size < 22) // Minimum: 14-byte header + 8-byte end marker
+    {
+        return DecodeError::InvalidHeader;
+    }
+
+    return ParseHeaderFields(data, outImageWidth, outImageHeight, outNumChannels, outColorSpace);
+}
 
-    if (inStream.size() < 22) // Minimum: 14-byte header + 8-byte end marker
+/**
+ * @brief Checks the dimensions of an image against the limits, before any memory is allocated for its pixels.
+ *        All counts are 64-bit, so that no product of the dimensions can overflow.
+ * @param[in] imageWidth Width of the image
+ * @param[in] imageHeight Height of the image
+ * @param[in] numChannels Number of color channels in the image
+ * @param[in] limits Largest image to allow
+ * @return DecodeError::None if the image is within the limits and its pixels fit in memory that can be addressed,
+ *         DecodeError::ImageTooLarge otherwise.
+ */
+inline DecodeError CheckImageSize(uint32_t imageWidth, uint32_t imageHeight, uint8_t numChannels, const DecodeLimits &limits)
+{
+    // Divide rather than multiply, so that the comparisons hold for any limit
+    const uint64_t numPixels = static_cast<uint64_t>(imageWidth) * imageHeight;
+    if ((numPixels > limits.maxPixels) || (numPixels > limits.maxBytes / numChannels) ||
+        (numPixels > std::numeric_limits<size_t>::max() / numChannels))
     {
-        return false;
+        return DecodeError::ImageTooLarge;
     }
 
-    // --- Header ---
-    if ((inStream[0] != 'q') || (inStream[1] != 'o') || (inStream[2] != 'i') || (inStream[3] != 'f'))
+    return DecodeError::None;
+}
+
+/**
+ * @brief Checks whether the chunks of a QOI format image could possibly hold as many pixels as its header says.
+ *        Every byte holds at most one chunk, and no chunk is more than 62 pixels, so a header that claims
+ *        more is rejected before memory is allocated for pixels that can never be decoded.
+ * @param[in] size Size of the QOI format image in bytes, at least the 14 bytes of the header
+ * @param[in] imageWidth Width of the image
+ * @param[in] imageHeight Height of the image
+ * @return DecodeError::None if the chunks may hold all pixels, DecodeError::TruncatedData otherwise.
+ */
+inline DecodeError CheckChunkCapacity(size_t size, uint32_t imageWidth, uint32_t imageHeight)
+{
+    const uint64_t numPixels = static_cast<uint64_t>(imageWidth) * imageHeight;
+    if ((numPixels + 61) / 62 > size - 14)
     {
-        return false;
+        return DecodeError::TruncatedData;
+    }
+
+    return DecodeError::None;
+}
+
+/**
+ * @brief Parses the header of a QOI format image and sizes the vector for its pixels, once all checks passed.
+ * @param[in] data Pointer to the QOI format image
+ * @param[in] size Size of the QOI format image in bytes
+ * @param[in] limits Largest image to allocate memory for
+ * @param[out] outPixelColors Vector that is resized to hold every pixel of the image
+ * @param[out] outImageWidth Width of the image
+ * @param[out] outImageHeight Height of the image
+ * @param[out] outNumChannels Number of color channels in the image
+ * @param[out] outColorSpace Colorspace of the image
+ * @return DecodeError::None if the vector was sized for the image.
+ */
+inline DecodeError AllocatePixels(const uint8_t *data, size_t size, const DecodeLimits &limits, std::vector<uint8_t> &outPixelColors, uint32_t &outImageWidth, uint32_t &outImageHeight, uint8_t &outNumChannels, ColorSpace &outColorSpace)
+{
+    DecodeError error = ParseHeader(data, size, outImageWidth, outImageHeight, outNumChannels, outColorSpace);
+    if (error == DecodeError::None)
+    {
+        error = CheckImageSize(outImageWidth, outImageHeight, outNumChannels, limits);
     }
-    outImageWidth = BytesToUint32(inStream[4], inStream[5], inStream[6], inStream[7]);
-    outImageHeight = BytesToUint32(inStream[8], inStream[9], inStream[10], inStream[11]);
-    outNumChannels = inStream[12];
-    if (inStream[13] > 2)
+    if (error == DecodeError::None)
     {
-        return false;
+        error = CheckChunkCapacity(size, outImageWidth, outImageHeight);
     }
-    outColorSpace = inStream[13] == 0 ? ColorSpace::SRGB : ColorSpace::LINEAR;
+    if (error != DecodeError::None)
+    {
+        return error;
+    }
+
+    // The header tells us exactly how big the output is, so allocate it once
+    // and let the decoder write through a raw pointer. The vector is not cleared first, since then
+    // resizing it would fill all of it with zeros again, only for the decoder to overwrite them.
+    outPixelColors.resize(static_cast<size_t>(static_cast<uint64_t>(outImageWidth) * outImageHeight * outNumChannels));
+    return DecodeError::None;
+}
 
-    // --- Data ---
-    uint32_t remainingPixels = outImageWidth * outImageHeight; 
+/**
+ * @brief Writes the specified pixel color to the output buffer.
+ * @tparam NumChannels Number of color channels to write (3 or 4)
+ * @param[in] pixel Pixel color
+ * @param[in] out Pointer to where the pixel will be written
+ */
+template <uint8_t NumChannels>
+inline void StorePixel(const Pixel &pixel, uint8_t *out)
+{
+    if (NumChannels == 4)
+    {
+        std::memcpy(out, &pixel, 4);
+    }
+    else
+    {
+        out[0] = pixel.red;
+        out[1] = pixel.green;
+        out[2] = pixel.blue;
+    }
+}
 
-    uint32_t prevPixel = BytesToUint32(0, 0, 0, 255);
-    std::array<uint32_t, 64> seenPixels = {};
+/**
+ * @brief Writes the specified pixel color to consecutive pixels of the output buffer, many pixels at a time.
+ * @tparam NumChannels Number of color channels to write per pixel (3 or 4)
+ * @param[in] pixel Pixel color
+ * @param[in] out Pointer to where the first pixel will be written
+ * @param[in] end Pointer past the last pixel to write, at least one pixel after the first
+ */
+template <uint8_t NumChannels>
+inline void FillPixels(const Pixel &pixel, uint8_t *out, uint8_t *end)
+{
+    // 48 bytes hold a whole number of pixels, with either 3 or 4 channels. A copy of the pattern that
+    // starts on a pixel therefore writes whole pixels, which lets the last copy overlap the one before it.
+    const size_t PATTERN_SIZE = 48;
 
-    size_t offset = 14;
-    while ((offset < inStream.size()) && (remainingPixels > 0))
+    const uint32_t word = PixelToWord(pixel);
+    if (end - out < static_cast<ptrdiff_t>(PATTERN_SIZE))
     {
-        size_t tagOffset = offset;
-        uint8_t chunkTag = inStream[offset++];
-        if ((chunkTag == QOI_OP_RGB) || (chunkTag == QOI_OP_RGBA))
+        // Short runs are not worth building the pattern for, and get a single store per pixel instead.
+        // With 3 channels, every store also writes the next pixel's red, so the last pixel gets its own.
+        uint8_t *last = end - NumChannels;
+        for (; out < last; out += NumChannels)
         {
-            uint8_t red = inStream[offset++];
-            uint8_t green = inStream[offset++];
-            uint8_t blue = inStream[offset++];
-            uint8_t alpha = GetAlpha(prevPixel);
-            if (chunkTag == QOI_OP_RGBA)
-            {
-                alpha = inStream[offset++];
-            }
+            std::memcpy(out, &word, 4);
+        }
+        StorePixel<NumChannels>(pixel, last);
+        return;
+    }
 
-            outPixelColors.push_back(red);
-            outPixelColors.push_back(green);
-            outPixelColors.push_back(blue);
-            if (outNumChannels == 4)
-            {
-                outPixelColors.push_back(alpha);
-            }
+    uint8_t pattern[PATTERN_SIZE + 1];
+    for (size_t offset = 0; offset < PATTERN_SIZE; offset += NumChannels)
+    {
+        std::memcpy(pattern + offset, &word, 4);
+    }
 
-            uint32_t hash = (static_cast<uint32_t>(red) * 3 + static_cast<uint32_t>(green) * 5 + static_cast<uint32_t>(blue) * 7 + static_cast<uint32_t>(alpha) * 11) % 64;
-            seenPixels[hash] = BytesToUint32(red, green, blue, alpha);
+    uint8_t *last = end - PATTERN_SIZE;
+    for (; out < last; out += PATTERN_SIZE)
+    {
+        std::memcpy(out, pattern, PATTERN_SIZE);
+    }
+    std::memcpy(last, pattern, PATTERN_SIZE);
+}
 
-            prevPixel = BytesToUint32(red, green, blue, alpha);
-            --remainingPixels;
-        }
-        else if ((chunkTag & 0b11000000) == QOI_OP_INDEX)
-        {
-            uint8_t index = chunkTag & 0b00111111;
-            uint32_t pixel = seenPixels[index];
+/**
+ * Lookup tables that turn DIFF and LUMA chunks into the amounts added to each channel, so that both take the same
+ * path through the decoder. The amounts are modulo 256, just like the channels they are added to.
+ */
+struct ChunkTables
+{
+    /**
+     * Amount added to each channel by a DIFF tag byte, or by the green difference in a LUMA tag byte,
+     * for every tag byte. Zero for the other ops.
+     */
+    std::array<Pixel, 256> tagDeltas;
 
-            outPixelColors.push_back(GetRed(pixel));
-            outPixelColors.push_back(GetGreen(pixel));
-            outPixelColors.push_back(GetBlue(pixel));
-            if (outNumChannels == 4)
-            {
-                outPixelColors.push_back(GetAlpha(pixel));
-            }
+    /**
+     * Amount added to red and blue by the second byte of a LUMA chunk, for every value of that byte.
+     * These are followed by 256 entries of zero, which DIFF chunks look up instead.
+     */
+    std::array<Pixel, 512> lumaDeltas;
+
+    /**
+     * Size in bytes of the chunk that starts with each tag byte
+     */
+    std::array<uint8_t, 256> chunkSizes;
+
+    /**
+     * Number of pixels produced by the chunk that starts with each tag byte
+     */
+    std::array<uint8_t, 256> chunkPixels;
+};
 
-            prevPixel = pixel;
-            --remainingPixels;
+/**
+ * @brief Fills in the lookup tables for decoding chunks.
+ * @return Lookup tables
+ */
+inline ChunkTables BuildChunkTables()
+{
+    ChunkTables tables = {};
+    for (uint32_t byte = 0; byte < 256; ++byte)
+    {
+        Pixel &tagDelta = tables.tagDeltas[byte];
+        if ((byte & 0b11000000) == QOI_OP_DIFF)
+        {
+            tagDelta.red = static_cast<uint8_t>(((byte & 0b00110000) >> 4) - 2);
+            tagDelta.green = static_cast<uint8_t>(((byte & 0b00001100) >> 2) - 2);
+            tagDelta.blue = static_cast<uint8_t>((byte & 0b00000011) - 2);
         }
-        else if ((chunkTag & 0b11000000) == QOI_OP_DIFF)
+        else if ((byte & 0b11000000) == QOI_OP_LUMA)
         {
-            int8_t dr = static_cast<int8_t>((chunkTag & 0b00110000) >> 4) - 2;
-            int8_t dg = static_cast<int8_t>((chunkTag & 0b00001100) >> 2) - 2;
-            int8_t db = static_cast<int8_t>(chunkTag & 0b00000011) - 2;
+            uint8_t dg = static_cast<uint8_t>((byte & 0b00111111) - 32);
+            tagDelta.red = dg;
+            tagDelta.green = dg;
+            tagDelta.blue = dg;
+        }
 
-            uint8_t red = GetRed(prevPixel) + dr;
-            uint8_t green = GetGreen(prevPixel) + dg;
-            uint8_t blue = GetBlue(prevPixel) + db;
-            uint8_t alpha = GetAlpha(prevPixel);
+        tables.lumaDeltas[byte].red = static_cast<uint8_t>(((byte & 0b11110000) >> 4) - 8);
+        tables.lumaDeltas[byte].blue = static_cast<uint8_t>((byte & 0b00001111) - 8);
 
-            outPixelColors.push_back(red);
-            outPixelColors.push_back(green);
-            outPixelColors.push_back(blue);
-            if (outNumChannels == 4)
-            {
-                outPixelColors.push_back(alpha);
-            }
+        tables.chunkSizes[byte] = (byte == QOI_OP_RGB) ? 4 : (byte == QOI_OP_RGBA) ? 5 : ((byte & 0b11000000) == QOI_OP_LUMA) ? 2 : 1;
+        tables.chunkPixels[byte] = (((byte & 0b11000000) == QOI_OP_RUN) && (byte < QOI_OP_RGB)) ? (byte & 0b00111111) + 1 : 1;
+    }
+    return tables;
+}
+
+/**
+ * Holder of the lookup tables for decoding chunks. It is a template only so that the header can define the tables
+ * once for the whole program. They are filled in before main(), and their address is a constant, so the decoder
+ * does not need a register to keep track of them.
+ */
+template <typename T = void>
+struct ChunkTablesHolder
+{
+    static const ChunkTables tables;
+};
 
-            uint32_t hash = (static_cast<uint32_t>(red) * 3 + static_cast<uint32_t>(green) * 5 + static_cast<uint32_t>(blue) * 7 + static_cast<uint32_t>(alpha) * 11) % 64;
-            seenPixels[hash] = BytesToUint32(red, green, blue, alpha);
+template <typename T>
+const ChunkTables ChunkTablesHolder<T>::tables = BuildChunkTables();
 
-            prevPixel = BytesToUint32(red, green, blue, alpha);
-            --remainingPixels;
-        }
-        else if ((chunkTag & 0b11000000) == QOI_OP_LUMA)
-        {
-            int8_t dg = static_cast<int8_t>(chunkTag & 0b00111111) - 32;
+/**
+ * @brief Decodes a chunk that is whole in memory into the decoder state. This is the one place that knows what
+ *        each op does to the previous pixel and the seen pixels; the decoders differ only in where they put the pixels.
+ * @param[in,out] data Pointer to the tag byte of the chunk, moved past the chunk
+ * @param[in,out] prevPixel Previous pixel, which becomes the pixel the chunk produces
+ * @param[in,out] seenPixels Seen pixels, which get the pixel the chunk produces unless it came from them
+ * @return Number of pixels the chunk produces, all of them prevPixel: the length of a QOI_OP_RUN, 1 for the other ops
+ */
+inline uint32_t DecodeChunk(const uint8_t *&data, Pixel &prevPixel, std::array<Pixel, 64> &seenPixels)
+{
+    const ChunkTables &tables = ChunkTablesHolder<>::tables;
+    uint8_t chunkTag = *data++;
+    if (chunkTag == QOI_OP_RGB)
+    {
+        prevPixel.red = data[0];
+        prevPixel.green = data[1];
+        prevPixel.blue = data[2];
+        data += 3;
+    }
+    else if (chunkTag == QOI_OP_RGBA)
+    {
+        std::memcpy(&prevPixel, data, 4);
+        data += 4;
+    }
+    else if (static_cast<uint8_t>(chunkTag - QOI_OP_DIFF) < (QOI_OP_RUN - QOI_OP_DIFF))
+    {
+        // DIFF or LUMA, which only differ in the byte that LUMA has after the tag.
+        // DIFF looks up an entry of zero with its own tag instead, which is always there to read.
+        const uint32_t isLuma = chunkTag >> 7;
+        const Pixel &tagDelta = tables.tagDeltas[chunkTag];
+        const Pixel &lumaDelta = tables.lumaDeltas[((isLuma ^ 1) << 8) + data[static_cast<ptrdiff_t>(isLuma) - 1]];
+        data += isLuma;
+        prevPixel.red += tagDelta.red + lumaDelta.red;
+        prevPixel.green += tagDelta.green;
+        prevPixel.blue += tagDelta.blue + lumaDelta.blue;
+    }
+    else if ((chunkTag & 0b11000000) == QOI_OP_INDEX)
+    {
+        prevPixel = seenPixels[chunkTag & 0b00111111];
+        return 1;
+    }
+    else
+    {
+        // QOI_OP_RUN. Tags 0xFE and 0xFF would be run lengths 63 and 64, but those are already taken by QOI_OP_RGB
+        // and QOI_OP_RGBA. The encoder records every pixel it visits, including the ones inside a run.
+        seenPixels[ColorHash(prevPixel)] = prevPixel;
+        return tables.chunkPixels[chunkTag];
+    }
+
+    seenPixels[ColorHash(prevPixel)] = prevPixel;
+    return 1;
+}
+
+/**
+ * @brief Decodes the chunks of a QOI format image into rows of a buffer that was already sized for the whole image.
+ * @tparam NumChannels Number of color channels to write per pixel (3 or 4)
+ * @param[in] data Pointer to the first chunk, right after the header
+ * @param[in] dataEnd Pointer past the last byte of the QOI data
+ * @param[out] outPixels Pointer to the first byte of the first row
+ * @param[in] stride Distance in bytes between the starts of two consecutive rows
+ * @param[in] imageWidth Width of the image
+ * @param[in] imageHeight Height of the image
+ * @return DecodeError::None if all pixels of the image were decoded.
+ */
+template <uint8_t NumChannels>
+inline DecodeError DecodeChunks(const uint8_t *data, const uint8_t *dataEnd, uint8_t *outPixels, size_t stride, uint32_t imageWidth, uint32_t imageHeight)
+{
+    const size_t rowSize = static_cast<size_t>(imageWidth) * NumChannels;
 
-            uint8_t nextChunk = inStream[offset++];
-            int8_t dr_dg = static_cast<int8_t>((nextChunk & 0b11110000) >> 4) - 8;
-            int8_t db_dg = static_cast<int8_t>(nextChunk & 0b00001111) - 8;
+    Pixel prevPixel = { 0, 0, 0, 255 };
+    std::array<Pixel, 64> seenPixels = {};
+    const ChunkTables &tables = ChunkTablesHolder<>::tables;
 
-            int8_t dr = dr_dg + dg;
-            int8_t db = db_dg + dg;
+    // A chunk has at most 5 bytes, so one that starts before the last 4 bytes can be read without checking where it ends.
+    // The rest is the tail, which well-formed data never gets to, since the 8-byte end marker comes after the last chunk.
+    const uint8_t *tailStart = dataEnd - std::min<ptrdiff_t>(4, dataEnd - data);
 
-            uint8_t red = GetRed(prevPixel) + dr;
-            uint8_t green = GetGreen(prevPixel) + dg;
-            uint8_t blue = GetBlue(prevPixel) + db;
-            uint8_t alpha = GetAlpha(prevPixel);
+    // A run may continue past the end of a row, so the number of bytes it has left to write is carried over.
+    // Counting bytes rather than pixels saves a division by the number of channels wherever a run is split.
+    size_t runBytes = 0;
 
-            outPixelColors.push_back(red);
-            outPixelColors.push_back(green);
-            outPixelColors.push_back(blue);
-            if (outNumChannels == 4)
+    for (uint32_t y = 0; y < imageHeight; ++y)
+    {
+        uint8_t *out = outPixels + y * stride;
+        uint8_t *rowEnd = out + rowSize;
+        while (out < rowEnd)
+        {
+            if (runBytes > 0)
             {
-                outPixelColors.push_back(alpha);
+                uint8_t *fillEnd = out + std::min<size_t>(runBytes, rowEnd - out);
+                FillPixels<NumChannels>(prevPixel, out, fillEnd);
+                runBytes -= fillEnd - out;
+                out = fillEnd;
+                continue;
             }
 
-            uint32_t hash = (static_cast<uint32_t>(red) * 3 + static_cast<uint32_t>(green) * 5 + static_cast<uint32_t>(blue) * 7 + static_cast<uint32_t>(alpha) * 11) % 64;
-            seenPixels[hash] = BytesToUint32(red, green, blue, alpha);
+            if ((data >= tailStart) && ((data >= dataEnd) || (dataEnd - data < tables.chunkSizes[*data])))
+            {
+                return DecodeError::TruncatedData;
+            }
 
-            prevPixel = BytesToUint32(red, green, blue, alpha);
-            --remainingPixels;
-        }
-        else if ((chunkTag & 0b11000000) == QOI_OP_RUN)
-        {
-            uint8_t run = (chunkTag & 0b00111111);
-            run += 1; // Apply bias of -1, run -= -1, which is just run += 1
-            if (run > 62)
+            const uint32_t numPixels = DecodeChunk(data, prevPixel, seenPixels);
+            if (numPixels == 1)
             {
-                outPixelColors.clear();
-                return false;
+                StorePixel<NumChannels>(prevPixel, out);
+                out += NumChannels;
+                continue;
             }
 
-            for (uint8_t i = 0; i < run; i++)
+            // Flat areas are a series of runs of the longest length, which are merged to be filled in one go.
+            // Merging stops at the last pixel of the image, so that a run past it is an error just like before.
+            runBytes = numPixels * NumChannels;
+            if (numPixels == 62)
             {
-                outPixelColors.push_back(GetRed(prevPixel));
-                outPixelColors.push_back(GetGreen(prevPixel));
-                outPixelColors.push_back(GetBlue(prevPixel));
-                if (outNumChannels == 4)
+                const size_t bytesLeft = (rowEnd - out) + static_cast<size_t>(imageHeight - y - 1) * rowSize;
+                while ((data < dataEnd) && (static_cast<uint8_t>(*data - QOI_OP_RUN) < (QOI_OP_RGB - QOI_OP_RUN)) &&
+                       (runBytes + ((*data & 0b00111111) + 1) * NumChannels <= bytesLeft))
                 {
-                    outPixelColors.push_back(GetAlpha(prevPixel));
+                    runBytes += ((*data++ & 0b00111111) + 1) * NumChannels;
                 }
-                --remainingPixels;
             }
         }
-        else
-        {
-            outPixelColors.clear();
-            return false;
-        }
     }
 
-    return true;
+    if (runBytes > 0)
+    {
+        return DecodeError::CorruptData;
+    }
+
+    return DecodeError::None;
 }
 
 /**
- * @brief Decodes a QOI format image given data from a given file path.
- * @param[in] inFilePath Path to the QOI file to decode
+ * @brief Decodes the chunks of a QOI format image, picking the kernel for the number of channels once for the whole image.
+ * @param[in] data Pointer to the first chunk, right after the header
+ * @param[in] dataEnd Pointer past the last byte of the QOI data
+ * @param[out] outPixels Pointer to the first byte of the first row
+ * @param[in] stride Distance in bytes between the starts of two consecutive rows
+ * @param[in] imageWidth Width of the image
+ * @param[in] imageHeight Height of the image
+ * @param[in] numChannels Number of color channels to write per pixel (3 or 4)
+ * @return DecodeError::None if all pixels of the image were decoded.
+ */
+inline DecodeError DecodeChunks(const uint8_t *data, const uint8_t *dataEnd, uint8_t *outPixels, size_t stride, uint32_t imageWidth, uint32_t imageHeight, uint8_t numChannels)
+{
+    if (numChannels == 4)
+    {
+        return DecodeChunks<4>(data, dataEnd, outPixels, stride, imageWidth, imageHeight);
+    }
+    return DecodeChunks<3>(data, dataEnd, outPixels, stride, imageWidth, imageHeight);
+}
+
+/**
+ * @brief Checks that a destination buffer can hold an image with the specified properties.
+ * @param[in] imageWidth Width of the image
+ * @param[in] imageHeight Height of the image
+ * @param[in] numChannels Number of color channels in the image
+ * @param[in] dst Destination buffer
+ * @param[in] dstCapacity Size of the destination buffer in bytes
+ * @param[in,out] dstStride Distance in bytes between the starts of two consecutive rows, or 0 if the rows
+ *                are tightly packed. Replaced by the actual row size in that case.
+ * @return DecodeError::None if the image fits in the destination buffer.
+ */
+inline DecodeError CheckDestination(uint32_t imageWidth, uint32_t imageHeight, uint8_t numChannels, const uint8_t *dst, size_t dstCapacity, size_t &dstStride)
+{
+    // A row is always addressable on 64-bit platforms, but not necessarily on 32-bit ones
+    const uint64_t rowSize = static_cast<uint64_t>(imageWidth) * numChannels;
+    if (rowSize > std::numeric_limits<size_t>::max())
+    {
+        return DecodeError::DestinationTooSmall;
+    }
+    if (dstStride == 0)
+    {
+        dstStride = static_cast<size_t>(rowSize);
+    }
+    else if (dstStride < rowSize)
+    {
+        return DecodeError::InvalidStride;
+    }
+
+    if ((imageWidth == 0) || (imageHeight == 0))
+    {
+        return DecodeError::None;
+    }
+
+    // The last row does not need the padding that the stride adds after it.
+    // The check divides rather than multiplies, since the product of the stride and the height may overflow.
+    if ((dst == nullptr) || (dstCapacity < rowSize) || ((dstCapacity - rowSize) / dstStride < imageHeight - 1))
+    {
+        return DecodeError::DestinationTooSmall;
+    }
+
+    return DecodeError::None;
+}
+
+/**
+ * @brief Decodes a QOI format image into a caller-provided buffer without allocating any memory.
+ * @param[in] data Pointer to the QOI format image
+ * @param[in] size Size of the QOI format image in bytes
+ * @param[out] dst Buffer where the decoded pixel colors will be placed
+ * @param[in] dstCapacity Size of the destination buffer in bytes
+ * @param[in] dstStride Distance in bytes between the starts of two consecutive rows in the destination buffer, or 0 if the rows are tightly packed
+ * @param[out] outImageWidth Width of the decoded image
+ * @param[out] outImageHeight Height of the decoded image
+ * @param[out] outNumChannels Number of color channels in the decoded image
+ * @param[out] outColorSpace Colorspace of the decoded image
+ * @return DecodeError::None if the decoding process was successful. The image properties are
+ *         also filled in when DecodeError::DestinationTooSmall is returned, so the caller can
+ *         size a new buffer and try again.
+ */
+inline DecodeError DecodeInto(const uint8_t *data, size_t size, uint8_t *dst, size_t dstCapacity, size_t dstStride, uint32_t &outImageWidth, uint32_t &outImageHeight, uint8_t &outNumChannels, ColorSpace &outColorSpace)
+{
+    DecodeError error = ParseHeader(data, size, outImageWidth, outImageHeight, outNumChannels, outColorSpace);
+    if (error != DecodeError::None)
+    {
+        return error;
+    }
+
+    error = CheckDestination(outImageWidth, outImageHeight, outNumChannels, dst, dstCapacity, dstStride);
+    if ((error != DecodeError::None) || (outImageWidth == 0) || (outImageHeight == 0))
+    {
+        return error;
+    }
+
+    return DecodeChunks(data + 14, data + size, dst, dstStride, outImageWidth, outImageHeight, outNumChannels);
+}
+
+/**
+ * @brief Decodes a QOI format image given data from a stream into a caller-provided buffer without allocating any memory.
+ * @param[in] inStream Byte stream for the QOI format image
+ * @param[out] dst Buffer where the decoded pixel colors will be placed
+ * @param[in] dstCapacity Size of the destination buffer in bytes
+ * @param[in] dstStride Distance in bytes between the starts of two consecutive rows in the destination buffer, or 0 if the rows are tightly packed
+ * @param[out] outImageWidth Width of the decoded image
+ * @param[out] outImageHeight Height of the decoded image
+ * @param[out] outNumChannels Number of color channels in the decoded image
+ * @param[out] outColorSpace Colorspace of the decoded image
+ * @return DecodeError::None if the decoding process was successful.
+ */
+inline DecodeError DecodeInto(const std::vector<uint8_t> &inStream, uint8_t *dst, size_t dstCapacity, size_t dstStride, uint32_t &outImageWidth, uint32_t &outImageHeight, uint8_t &outNumChannels, ColorSpace &outColorSpace)
+{
+    return DecodeInto(inStream.data(), inStream.size(), dst, dstCapacity, dstStride, outImageWidth, outImageHeight, outNumChannels, outColorSpace);
+}
+
+/**
+ * @brief Decodes a QOI format image that is already in memory.
+ * @param[in] data Pointer to the QOI format image
+ * @param[in] size Size of the QOI format image in bytes
  * @param[out] outPixelColors Vector where the decoded pixel colors will be placed
  * @param[out] outImageWidth Width of the decoded image
  * @param[out] outImageHeight Height of the decoded image
  * @param[out] outNumChannels Number of color channels in the decoded image
  * @param[out] outColorSpace Colorspace of the decoded image
+ * @param[in] limits Largest image to allocate memory for
  * @return Flag indicating whether the decoding process was successful or not.
  */
-inline bool Decode(const std::string &inFilePath, std::vector<uint8_t> &outPixelColors, uint32_t &outImageWidth, uint32_t &outImageHeight, uint8_t &outNumChannels, ColorSpace &outColorSpace)
+inline bool Decode(const uint8_t *data, size_t size, std::vector<uint8_t> &outPixelColors, uint32_t &outImageWidth, uint32_t &outImageHeight, uint8_t &outNumChannels, ColorSpace &outColorSpace, const DecodeLimits &limits = DecodeLimits())
 {
-    std::ifstream file(inFilePath, std::ios::binary);
-    if (file.fail())
+    if (AllocatePixels(data, size, limits, outPixelColors, outImageWidth, outImageHeight, outNumChannels, outColorSpace) != DecodeError::None)
     {
+        outPixelColors.clear();
         return false;
     }
 
-    std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
-    return Decode(bytes, outPixelColors, outImageWidth, outImageHeight, outNumChannels, outColorSpace);
+    if (DecodeInto(data, size, outPixelColors.data(), outPixelColors.size(), 0, outImageWidth, outImageHeight, outNumChannels, outColorSpace) != DecodeError::None)
+    {
+        outPixelColors.clear();
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Decodes a QOI format image given data from a stream.
+ * @param[in] inStream Byte stream for the QOI format image
+ * @param[out] outPixelColors Vector where the decoded pixel colors will be placed
+ * @param[out] outImageWidth Width of the decoded image
+ * @param[out] outImageHeight Height of the decoded image
+ * @param[out] outNumChannels Number of color channels in the decoded image
+ * @param[out] outColorSpace Colorspace of the decoded image
+ * @param[in] limits Largest image to allocate memory for
+ * @return Flag indicating whether the decoding process was successful or not.
+ */
+inline bool Decode(std::vector<uint8_t> &inStream, std::vector<uint8_t> &outPixelColors, uint32_t &outImageWidth, uint32_t &outImageHeight, uint8_t &outNumChannels, ColorSpace &outColorSpace, const DecodeLimits &limits = DecodeLimits())
+{
+    return Decode(inStream.data(), inStream.size(), outPixelColors, outImageWidth, outImageHeight, outNumChannels, outColorSpace, limits);
 }
+
+#ifdef QOI_HAVE_MMAP
+/**
+ * Read-only memory mapping of a whole regular file, unmapped when it goes out of scope
+ */
+struct MappedFile
+{
+    /**
+     * File descriptor, or -1 if the file is not open
+     */
+    int fd = -1;
+
+    /**
+     * Pointer to the mapped bytes, or nullptr if the file is not mapped
+     */
+    const uint8_t *data = nullptr;
+
+    /**
+     * Size of the file in bytes
+     */
+    size_t size = 0;
+
+    MappedFile() = default;
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    ~MappedFile()
+    {
+        if (data != nullptr)
+        {
+            munmap(const_cast<uint8_t *>(data), size);
+        }
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+    }
+
+    /**
+     * @brief Maps the specified file for a single front-to-back read.
+     * @param[in] filePath Path to the file
+     * @return Flag indicating whether the file is a non-empty regular file that could be mapped or not.
+     */
+    bool Open(const std::string &filePath)
+    {
+        fd = open(filePath.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return false;
+        }
+
+        struct stat fileStatus;
+        if ((fstat(fd, &fileStatus) != 0) || !S_ISREG(fileStatus.st_mode) || (fileStatus.st_size <= 0))
+        {
+            return false;
+        }
+
+        void *mapping = mmap(nullptr, static_cast<size_t>(fileStatus.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED)
+        {
+            return false;
+        }
+
+        data = static_cast<const uint8_t *>(mapping);
+        size = static_cast<size_t>(fileStatus.st_size);
+
+        // The decoder reads the file exactly once from start to end, so let the kernel read ahead
+        // aggressively and drop pages behind us.
+        madvise(mapping, size, MADV_SEQUENTIAL);
+        return true;
+    }
+};
+#endif // QOI_HAVE_MMAP
+
+/**
+ * @brief Decodes a QOI format image given data from a given file path.
+ *        Regular files are decoded straight from a memory mapping, anything else (such as a pipe) is read into memory first.
+ * @param[in] inFilePath Path to the QOI file to decode
+ * @param[out] outPixelColors Vector where the decoded pixel colors will be placed
+ * @param[out] outImageWidth Width of the decoded image
+ * @param[out] outImageHeight Height of the decoded image
+ * @param[out] outNumChannels Number of color channels in the decoded image
+ * @param[out] outColorSpace Colorspace of the decoded image
+ * @param[in] limits Largest image to allocate memory for
+ * @return Flag indicating whether the decoding process was successful or not.
+ */
+inline bool Decode(const std::string &inFilePath, std::vector<uint8_t> &outPixelColors, uint32_t &outImageWidth, uint32_t &outImageHeight, uint8_t &outNumChannels, ColorSpace &outColorSpace, const DecodeLimits &limits = DecodeLimits())
+{
+#ifdef QOI_HAVE_MMAP
+    MappedFile mappedFile;
+    if (mappedFile.Open(inFilePath))
+    {
+        return Decode(mappedFile.data, mappedFile.size, outPixelColors, outImageWidth, outImageHeight, outNumChannels, outColorSpace, limits);
+    }
+#endif // QOI_HAVE_MMAP
+
+    std::ifstream file(inFilePath, std::ios::binary);
+    if (file.fail())
+    {
+        return false;
+    }
+
+    std::vector<uint8_t> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    return Decode(bytes, outPixelColors, outImageWidth, outImageHeight, outNumChannels, outColorSpace, limits);
+}
+
+/**
+ * @brief Reads the properties of a QOI format image from its header, without looking at any of its chunks.
+ * @param[in] data Pointer to the QOI format image. Only the first 14 bytes are needed.
+ * @param[in] size Number of bytes available at data
+ * @param[out] outImageWidth Width of the image
+ * @param[out] outImageHeight Height of the image
+ * @param[out] outNumChannels Number of color channels in the image
+ * @param[out] outColorSpace Colorspace of the image
+ * @return DecodeError::None if the header is valid, DecodeError::InvalidHeader otherwise.
+ */
+inline DecodeError ReadHeader(const uint8_t *data, size_t size, uint32_t &outImageWidth, uint32_t &outImageHeight, uint8_t &outNumChannels, ColorSpace &outColorSpace)
+{
+    if (size < 14)
+    {
+        return DecodeError::InvalidHeader;
+    }
+
+    return ParseHeaderFields(data, outImageWidth, outImageHeight, outNumChannels, outColorSpace);
+}
+
+/**
+ * @brief Reads the properties of a QOI format image from the header of a file, which is all that gets read of it.
+ *        This takes a single 14-byte pread() where available, so it stays cheap over many files.
+ * @param[in] inFilePath Path to the QOI file
+ * @param[out] outImageWidth Width of the image
+ * @param[out] outImageHeight Height of the image
+ * @param[out] outNumChannels Number of color channels in the image
+ * @param[out] outColorSpace Colorspace of the image
+ * @return DecodeError::None if the header is valid, DecodeError::UnreadableFile if the file cannot be read,
+ *         DecodeError::InvalidHeader otherwise.
+ */
+inline DecodeError ReadHeader(const std::string &inFilePath, uint32_t &outImageWidth, uint32_t &outImageHeight, uint8_t &outNumChannels, ColorSpace &outColorSpace)
+{
+    uint8_t header[14];
+    size_t numRead = 0;
+
+#ifdef QOI_HAVE_MMAP
+    int fd = open(inFilePath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return DecodeError::UnreadableFile;
+    }
+    ssize_t result = pread(fd, header, sizeof(header), 0);
+    close(fd);
+    if (result < 0)
+    {
+        return DecodeError::UnreadableFile;
+    }
+    numRead = static_cast<size_t>(result);
+#else
+    std::ifstream file(inFilePath, std::ios::binary);
+    if (file.fail())
+    {
+        return DecodeError::UnreadableFile;
+    }
+    file.read(reinterpret_cast<char *>(header), sizeof(header));
+    numRead = static_cast<size_t>(file.gcount());
+#endif // QOI_HAVE_MMAP
+
+    return ReadHeader(header, numRead, outImageWidth, outImageHeight, outNumChannels, outColorSpace);
+}
+
+/**
+ * @brief Reads the table of stripe offsets that EncodeStriped() appends after the end marker (see QOI_STRIPE_TABLE).
+ * @param[in] data Pointer to the QOI format image
+ * @param[in] size Size of the QOI format image in bytes
+ * @param[in] imageHeight Height of the image, from its header
+ * @param[out] outStripeOffsets Offset of the first chunk of every stripe, from the start of the image
+ * @param[out] outStripeRows Number of rows per stripe. The last stripe may have fewer.
+ * @return Flag indicating whether the image has a valid stripe table or not.
+ */
+inline bool ReadStripeTable(const uint8_t *data, size_t size, uint32_t imageHeight, std::vector<uint64_t> &outStripeOffsets, uint32_t &outStripeRows)
+{
+    if (size < 14 + 8 + QOI_STRIPE_TABLE_FOOTER_SIZE)
+    {
+        return false;
+    }
+
+    const uint8_t *footer = data + size - QOI_STRIPE_TABLE_FOOTER_SIZE;
+    if (std::memcmp(footer + 8, QOI_STRIPE_TABLE_MAGIC, 4) != 0)
+    {
+        return false;
+    }
+
+    uint32_t stripeRows = BytesToUint32(footer[0], footer[1], footer[2], footer[3]);
+    uint32_t stripeCount = BytesToUint32(footer[4], footer[5], footer[6], footer[7]);
+    if ((stripeRows == 0) || (stripeCount != std::max<uint32_t>(1, imageHeight / stripeRows + ((imageHeight % stripeRows) != 0 ? 1 : 0))))
+    {
+        return false;
+    }
+
+    uint64_t tableSize = static_cast<uint64_t>(stripeCount) * 8 + QOI_STRIPE_TABLE_FOOTER_SIZE;
+    if (size < 14 + 8 + tableSize)
+    {
+        return false;
+    }
+
+    // Every stripe has to start after the previous one, and before the end marker
+    uint64_t chunksEnd = size - tableSize - 8;
+    const uint8_t *table = data + chunksEnd + 8;
+    outStripeOffsets.resize(stripeCount);
+    for (uint32_t stripe = 0; stripe < stripeCount; ++stripe)
+    {
+        const uint8_t *entry = table + static_cast<size_t>(stripe) * 8;
+        uint64_t offset = (static_cast<uint64_t>(BytesToUint32(entry[0], entry[1], entry[2], entry[3])) << 32) | BytesToUint32(entry[4], entry[5], entry[6], entry[7]);
+        uint64_t minOffset = (stripe == 0) ? 14 : outStripeOffsets[stripe - 1];
+        if (((stripe == 0) && (offset != 14)) || (offset < minOffset) || (offset > chunksEnd))
+        {
+            outStripeOffsets.clear();
+            return false;
+        }
+        outStripeOffsets[stripe] = offset;
+    }
+
+    outStripeRows = stripeRows;
+    return true;
+}
+
+/**
+ * @brief Checks that a QOI format image is well formed, without decoding it.
+ *
+ * The chunks are walked with the same rules as Decode(): they have to add up to exactly as many pixels as the header
+ * says, without running past the end of the data. They also have to be followed by the 8-byte end marker, and then by
+ * nothing but an optional stripe table (see QOI_STRIPE_TABLE). None of these rules depend on the colors, so only the
+ * tag of every chunk is read, and nothing is written. The walk takes the same time whatever the mix of chunks, since
+ * it does not branch on them.
+ *
+ * @param[in] data Pointer to the QOI format image
+ * @param[in] size Size of the QOI format image in bytes
+ * @param[out] outErrorOffset Offset of the first byte that breaks a rule: 0 for an invalid header, the offset of
+ *             the offending chunk or end marker byte, or size if the image ends too early. 0 if the image is valid.
+ * @return DecodeError::None if the image is valid, DecodeError::InvalidHeader, DecodeError::TruncatedData,
+ *         DecodeError::CorruptData if the chunks describe more pixels than the image has, or
+ *         DecodeError::InvalidEndMarker.
+ */
+inline DecodeError Validate(const uint8_t *data, size_t size, size_t &outErrorOffset)
+{
+    outErrorOffset = 0;
+
+    uint32_t imageWidth = 0, imageHeight = 0;
+    uint8_t numChannels = 0;
+    ColorSpace colorSpace;
+    if (ReadHeader(data, size, imageWidth, imageHeight, numChannels, colorSpace) != DecodeError::None)
+    {
+        return DecodeError::InvalidHeader;
+    }
+
+    const ChunkTables &tables = ChunkTablesHolder<>::tables;
+    const uint64_t totalPixels = static_cast<uint64_t>(imageWidth) * imageHeight;
+    uint64_t numPixels = 0;
+    size_t offset = 14;
+    size_t chunkOffset = offset;
+    while ((numPixels < totalPixels) && (offset < size))
+    {
+        chunkOffset = offset;
+        uint8_t chunkTag = data[offset];
+        offset += tables.chunkSizes[chunkTag];
+        numPixels += tables.chunkPixels[chunkTag];
+    }
+
+    if ((numPixels < totalPixels) || (offset > size))
+    {
+        outErrorOffset = size;
+        return DecodeError::TruncatedData;
+    }
+    if (numPixels > totalPixels)
+    {
+        outErrorOffset = chunkOffset;
+        return DecodeError::CorruptData;
+    }
+
+    static const uint8_t END_MARKER[8] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01 };
+    for (uint8_t markerByte : END_MARKER)
+    {
+        if (offset == size)
+        {
+            outErrorOffset = size;
+            return DecodeError::TruncatedData;
+        }
+        if (data[offset] != markerByte)
+        {
+            outErrorOffset = offset;
+            return DecodeError::InvalidEndMarker;
+        }
+        ++offset;
+    }
+
+    // A stripe table has to start right after the end marker
+    if (offset < size)
+    {
+        std::vector<uint64_t> stripeOffsets;
+        uint32_t stripeRows = 0;
+        if (!ReadStripeTable(data, size, imageHeight, stripeOffsets, stripeRows) ||
+            (size - offset != stripeOffsets.size() * 8 + QOI_STRIPE_TABLE_FOOTER_SIZE))
+        {
+            outErrorOffset = offset;
+            return DecodeError::InvalidEndMarker;
+        }
+    }
+
+    return DecodeError::None;
+}
+
+/**
+ * @brief Checks that a QOI format image given as a byte stream is well formed, without decoding it.
+ * @param[in] inStream Byte stream for the QOI format image
+ * @param[out] outErrorOffset Offset of the first byte that breaks a rule, see Validate()
+ * @return DecodeError::None if the image is valid, otherwise the rule it breaks.
+ */
+inline DecodeError Validate(const std::vector<uint8_t> &inStream, size_t &outErrorOffset)
+{
+    return Validate(inStream.data(), inStream.size(), outErrorOffset);
+}
+
+/**
+ * @brief Calls a function for every index in [0, count) on a pool of threads, including the calling thread.
+ * @param[in] count Number of indices
+ * @param[in] numThreads Maximum number of threads
+ * @param[in] function Function taking the index
+ */
+template <typename Function>
+inline void ParallelFor(size_t count, size_t numThreads, const Function &function)
+{
+    std::atomic<size_t> nextIndex(0);
+    auto worker = [&]()
+    {
+        for (size_t i = nextIndex++; i < count; i = nextIndex++)
+        {
+            function(i);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < std::min(numThreads, count); ++i)
+    {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+}
+
+/**
+ * Part of a plain QOI image that is decoded on its own, starting from a guess of the decoder state
+ */
+struct SpeculativeSegment
+{
+    /**
+     * Offset of the first chunk of the segment, from the start of the image
+     */
+    size_t offset = 0;
+
+    /**
+     * Index of the first pixel that the segment produces
+     */
+    uint64_t firstPixel = 0;
+
+    /**
+     * Number of pixels that the segment produces
+     */
+    uint64_t numPixels = 0;
+
+    /**
+     * Previous pixel and seen pixels that the segment was last decoded from
+     */
+    Pixel guessedPrevPixel = { 0, 0, 0, 255 };
+    std::array<Pixel, 64> guessedSeenPixels = {};
+
+    /**
+     * Previous pixel and seen pixels after the segment was decoded
+     */
+    Pixel prevPixel = { 0, 0, 0, 255 };
+    std::array<Pixel, 64> seenPixels = {};
+
+    /**
+     * Bit mask of the seen pixels that the segment wrote, and of the ones it read before writing them
+     */
+    uint64_t writtenSlots = 0;
+    uint64_t guessedSlotsRead = 0;
+};
+
+/**
+ * @brief Walks the chunks of a plain QOI image without decoding them, and splits them into segments
+ *        of roughly the specified size. Segments preferably start at a QOI_OP_RGBA or QOI_OP_RGB chunk,
+ *        which overwrites most or all of the previous pixel.
+ * @param[in] data Pointer to the first chunk, right after the header
+ * @param[in] dataEnd Pointer past the last byte of the QOI data
+ * @param[in] totalPixels Number of pixels in the image
+ * @param[in] segmentBytes Approximate number of bytes per segment
+ * @param[out] outSegments Segments, with their offsets relative to data
+ * @return Flag indicating whether the chunks produce exactly the pixels of the image without reading past dataEnd.
+ */
+inline bool ScanSegments(const uint8_t *data, const uint8_t *dataEnd, uint64_t totalPixels, size_t segmentBytes, std::vector<SpeculativeSegment> &outSegments)
+{
+    outSegments.clear();
+    outSegments.push_back(SpeculativeSegment());
+
+    const ChunkTables &tables = ChunkTablesHolder<>::tables;
+    const size_t size = dataEnd - data;
+    size_t offset = 0;
+    size_t nextCut = segmentBytes;
+    uint64_t pixel = 0;
+    while (pixel < totalPixels)
+    {
+        if (offset >= size)
+        {
+            return false;
+        }
+
+        uint8_t chunkTag = data[offset];
+
+        // Past the target size, cut at the next literal color, or at any chunk once another segment's worth of bytes went by
+        if ((offset >= nextCut) && ((chunkTag == QOI_OP_RGBA) || (chunkTag == QOI_OP_RGB) || (offset >= nextCut + segmentBytes)))
+        {
+            outSegments.back().numPixels = pixel - outSegments.back().firstPixel;
+
+            SpeculativeSegment segment;
+            segment.offset = offset;
+            segment.firstPixel = pixel;
+            outSegments.push_back(segment);
+            nextCut = offset + segmentBytes;
+        }
+
+        offset += tables.chunkSizes[chunkTag];
+        pixel += tables.chunkPixels[chunkTag];
+    }
+
+    outSegments.back().numPixels = pixel - outSegments.back().firstPixel;
+    return (pixel == totalPixels) && (offset <= size);
+}
+
+/**
+ * @brief Decodes a segment that ScanSegments() found, starting from its guessed state, and records which
+ *        of the guessed seen pixels it depends on. The chunks are not bounds checked, since the scan already was.
+ * @tparam NumChannels Number of color channels to write per pixel (3 or 4)
+ * @param[in] data Pointer to the first chunk, right after the header
+ * @param[out] outPixels Pointer to the first byte of the first row
+ * @param[in] stride Distance in bytes between the starts of two consecutive rows
+ * @param[in] imageWidth Width of the image
+ * @param[in,out] segment Segment to decode
+ */
+template <uint8_t NumChannels>
+inline void DecodeSegment(const uint8_t *data, uint8_t *outPixels, size_t stride, uint32_t imageWidth, SpeculativeSegment &segment)
+{
+    data += segment.offset;
+
+    Pixel prevPixel = segment.guessedPrevPixel;
+    std::array<Pixel, 64> seenPixels = segment.guessedSeenPixels;
+    uint64_t writtenSlots = 0;
+    uint64_t guessedSlotsRead = 0;
+
+    uint64_t x = segment.firstPixel % imageWidth;
+    uint64_t y = segment.firstPixel / imageWidth;
+    uint64_t remaining = segment.numPixels;
+    size_t run = 0;
+    while (remaining > 0)
+    {
+        uint8_t *out = outPixels + y * stride + x * NumChannels;
+        uint64_t rowPixels = std::min<uint64_t>(imageWidth - x, remaining);
+        uint8_t *rowEnd = out + rowPixels * NumChannels;
+        while (out < rowEnd)
+        {
+            if (run > 0)
+            {
+                size_t count = std::min<size_t>(run, (rowEnd - out) / NumChannels);
+                FillPixels<NumChannels>(prevPixel, out, out + count * NumChannels);
+                out += count * NumChannels;
+                run -= count;
+                continue;
+            }
+
+            // Seen pixels that are read before the segment writes them come from the guess
+            const uint8_t chunkTag = *data;
+            const bool isIndex = ((chunkTag & 0b11000000) == QOI_OP_INDEX);
+            if (isIndex)
+            {
+                guessedSlotsRead |= (1ull << chunkTag) & ~writtenSlots;
+            }
+            const uint32_t numPixels = DecodeChunk(data, prevPixel, seenPixels);
+            if (!isIndex)
+            {
+                writtenSlots |= 1ull << ColorHash(prevPixel);
+            }
+
+            if (numPixels > 1)
+            {
+                run = numPixels;
+                continue;
+            }
+            StorePixel<NumChannels>(prevPixel, out);
+            out += NumChannels;
+        }
+
+        remaining -= rowPixels;
+        x = 0;
+        ++y;
+    }
+
+    segment.prevPixel = prevPixel;
+    segment.seenPixels = seenPixels;
+    segment.writtenSlots = writtenSlots;
+    segment.guessedSlotsRead = guessedSlotsRead;
+}
+
+/**
+ * @brief Checks whether a decoded segment only depends on parts of its guessed state that match the actual state.
+ * @param[in] data Pointer to the first chunk, right after the header
+ * @param[in] segment Decoded segment
+ * @param[in] prevPixel Actual previous pixel at the start of the segment
+ * @param[in] seenPixels Actual seen pixels at the start of the segment
+ * @return Flag indicating whether the segment was decoded correctly.
+ */
+inline bool IsGuessCorrect(const uint8_t *data, const SpeculativeSegment &segment, const Pixel &prevPixel, const std::array<Pixel, 64> &seenPixels)
+{
+    // Every chunk produces a whole pixel, so only the first chunk can see the guessed previous pixel
+    uint32_t prevPixelMask = 0xFFFFFFFF;
+    uint8_t firstChunkTag = data[segment.offset];
+    if ((firstChunkTag == QOI_OP_RGBA) || ((firstChunkTag & 0b11000000) == QOI_OP_INDEX))
+    {
+        prevPixelMask = 0;
+    }
+    else if (firstChunkTag == QOI_OP_RGB)
+    {
+        Pixel alphaOnly = { 0, 0, 0, 255 };
+        prevPixelMask = PixelToWord(alphaOnly);
+    }
+
+    if (((PixelToWord(segment.guessedPrevPixel) ^ PixelToWord(prevPixel)) & prevPixelMask) != 0)
+    {
+        return false;
+    }
+
+    for (uint64_t slots = segment.guessedSlotsRead; slots != 0; slots &= slots - 1)
+    {
+        uint32_t slot = 0;
+        while (((slots >> slot) & 1) == 0)
+        {
+            ++slot;
+        }
+        if (PixelToWord(segment.guessedSeenPixels[slot]) != PixelToWord(seenPixels[slot]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Decodes the chunks of a plain QOI image on several threads. The chunks are split into segments that are
+ *        decoded concurrently from a guess of the decoder state at their start. A second concurrent round redecodes
+ *        the segments whose guess disagrees with the state their predecessor ended in, and a final sequential pass
+ *        checks every segment against the actual state and redecodes the ones that are still wrong.
+ * @tparam NumChannels Number of color channels to write per pixel (3 or 4)
+ * @param[in] data Pointer to the first chunk, right after the header
+ * @param[in] dataEnd Pointer past the last byte of the QOI data
+ * @param[out] outPixels Pointer to the first byte of the first row
+ * @param[in] stride Distance in bytes between the starts of two consecutive rows
+ * @param[in] imageWidth Width of the image
+ * @param[in] imageHeight Height of the image
+ * @param[in] numThreads Number of threads to decode on
+ * @return DecodeError::None if all pixels of the image were decoded.
+ */
+template <uint8_t NumChannels>
+inline DecodeError DecodeChunksSpeculative(const uint8_t *data, const uint8_t *dataEnd, uint8_t *outPixels, size_t stride, uint32_t imageWidth, uint32_t imageHeight, size_t numThreads)
+{
+    // Small segments mostly cost guesses that turn out wrong, so give every thread a few large ones
+    const size_t MIN_SEGMENT_BYTES = 64 * 1024;
+    size_t segmentBytes = std::max(MIN_SEGMENT_BYTES, static_cast<size_t>(dataEnd - data) / (numThreads * 4));
+
+    std::vector<SpeculativeSegment> segments;
+    if (!ScanSegments(data, dataEnd, static_cast<uint64_t>(imageWidth) * imageHeight, segmentBytes, segments) || (segments.size() == 1))
+    {
+        // Let the sequential decoder report what is wrong with the data
+        return DecodeChunks<NumChannels>(data, dataEnd, outPixels, stride, imageWidth, imageHeight);
+    }
+
+    ParallelFor(segments.size(), numThreads, [&](size_t i)
+    {
+        DecodeSegment<NumChannels>(data, outPixels, stride, imageWidth, segments[i]);
+    });
+
+    // The first segment starts from the actual initial state, and its end state is a much better guess for
+    // the second segment than the initial one. Only redecode the segments whose dependencies changed.
+    std::vector<size_t> retries;
+    for (size_t i = 1; i < segments.size(); ++i)
+    {
+        if (!IsGuessCorrect(data, segments[i], segments[i - 1].prevPixel, segments[i - 1].seenPixels))
+        {
+            retries.push_back(i);
+        }
+    }
+
+    // When most guesses were wrong, the segments mostly depend on colors seen long before (such as a palette),
+    // and the predecessors' end states are as wrong as the initial guesses. Go straight to the sequential pass then.
+    if (retries.size() > segments.size() / 2)
+    {
+        retries.clear();
+    }
+
+    // Segments are only redecoded after all new guesses are taken, so that every guess comes from the first round
+    for (size_t i : retries)
+    {
+        segments[i].guessedPrevPixel = segments[i - 1].prevPixel;
+        segments[i].guessedSeenPixels = segments[i - 1].seenPixels;
+    }
+    ParallelFor(retries.size(), numThreads, [&](size_t i)
+    {
+        DecodeSegment<NumChannels>(data, outPixels, stride, imageWidth, segments[retries[i]]);
+    });
+
+    Pixel prevPixel = segments[0].prevPixel;
+    std::array<Pixel, 64> seenPixels = segments[0].seenPixels;
+    for (size_t i = 1; i < segments.size(); ++i)
+    {
+        SpeculativeSegment &segment = segments[i];
+        if (!IsGuessCorrect(data, segment, prevPixel, seenPixels))
+        {
+            segment.guessedPrevPixel = prevPixel;
+            segment.guessedSeenPixels = seenPixels;
+            DecodeSegment<NumChannels>(data, outPixels, stride, imageWidth, segment);
+        }
+
+        // Slots the segment did not write keep their actual values rather than the guessed ones
+        prevPixel = segment.prevPixel;
+        for (uint32_t slot = 0; slot < 64; ++slot)
+        {
+            if ((segment.writtenSlots >> slot) & 1)
+            {
+                seenPixels[slot] = segment.seenPixels[slot];
+            }
+        }
+    }
+
+    return DecodeError::None;
+}
+
+/**
+ * @brief Decodes a QOI format image into a caller-provided buffer on several threads. Images encoded with EncodeStriped()
+ *        are decoded stripe by stripe, and plain images with DecodeChunksSpeculative().
+ * @param[in] data Pointer to the QOI format image
+ * @param[in] size Size of the QOI format image in bytes
+ * @param[out] dst Buffer where the decoded pixel colors will be placed
+ * @param[in] dstCapacity Size of the destination buffer in bytes
+ * @param[in] dstStride Distance in bytes between the starts of two consecutive rows in the destination buffer, or 0 if the rows are tightly packed
+ * @param[out] outImageWidth Width of the decoded image
+ * @param[out] outImageHeight Height of the decoded image
+ * @param[out] outNumChannels Number of color channels in the decoded image
+ * @param[out] outColorSpace Colorspace of the decoded image
+ * @param[in] numThreads Number of threads to decode on, or 0 to use one per hardware thread
+ * @return DecodeError::None if the decoding process was successful.
+ */
+inline DecodeError DecodeIntoParallel(const uint8_t *data, size_t size, uint8_t *dst, size_t dstCapacity, size_t dstStride, uint32_t &outImageWidth, uint32_t &outImageHeight, uint8_t &outNumChannels, ColorSpace &outColorSpace, size_t numThreads = 0)
+{
+    DecodeError error = ParseHeader(data, size, outImageWidth, outImageHeight, outNumChannels, outColorSpace);
+    if (error != DecodeError::None)
+    {
+        return error;
+    }
+
+    error = CheckDestination(outImageWidth, outImageHeight, outNumChannels, dst, dstCapacity, dstStride);
+    if ((error != DecodeError::None) || (outImageWidth == 0) || (outImageHeight == 0))
+    {
+        return error;
+    }
+
+    if (numThreads == 0)
+    {
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    if (numThreads == 1)
+    {
+        return DecodeChunks(data + 14, data + size, dst, dstStride, outImageWidth, outImageHeight, outNumChannels);
+    }
+
+    std::vector<uint64_t> stripeOffsets;
+    uint32_t stripeRows = 0;
+    if (!ReadStripeTable(data, size, outImageHeight, stripeOffsets, stripeRows))
+    {
+        if (outNumChannels == 4)
+        {
+            return DecodeChunksSpeculative<4>(data + 14, data + size, dst, dstStride, outImageWidth, outImageHeight, numThreads);
+        }
+        return DecodeChunksSpeculative<3>(data + 14, data + size, dst, dstStride, outImageWidth, outImageHeight, numThreads);
+    }
+
+    const uint32_t stripeCount = static_cast<uint32_t>(stripeOffsets.size());
+    const uint8_t *chunksEnd = data + size - (static_cast<size_t>(stripeCount) * 8 + QOI_STRIPE_TABLE_FOOTER_SIZE) - 8;
+    const uint32_t imageWidth = outImageWidth;
+    const uint32_t imageHeight = outImageHeight;
+    const uint8_t numChannels = outNumChannels;
+
+    std::vector<DecodeError> stripeErrors(stripeCount, DecodeError::None);
+    ParallelFor(stripeCount, numThreads, [&](size_t stripe)
+    {
+        uint32_t firstRow = static_cast<uint32_t>(stripe) * stripeRows;
+        uint32_t rows = std::min(stripeRows, imageHeight - firstRow);
+        const uint8_t *stripeStart = data + stripeOffsets[stripe];
+        const uint8_t *stripeEnd = (stripe + 1 < stripeCount) ? data + stripeOffsets[stripe + 1] : chunksEnd;
+        stripeErrors[stripe] = DecodeChunks(stripeStart, stripeEnd, dst + firstRow * dstStride, dstStride, imageWidth, rows, numChannels);
+    });
+
+    for (DecodeError stripeError : stripeErrors)
+    {
+        if (stripeError != DecodeError::None)
+        {
+            return stripeError;
+        }
+    }
+    return DecodeError::None;
+}
+
+/**
+ * @brief Decodes a QOI format image given data from a stream on several threads, see DecodeIntoParallel().
+ * @param[in] inStream Byte stream for the QOI format image
+ * @param[out] outPixelColors Vector where the decoded pixel colors will be placed
+ * @param[out] outImageWidth Width of the decoded image
+ * @param[out] outImageHeight Height of the decoded image
+ * @param[out] outNumChannels Number of color channels in the decoded image
+ * @param[out] outColorSpace Colorspace of the decoded image
+ * @param[in] numThreads Number of threads to decode on, or 0 to use one per hardware thread
+ * @param[in] limits Largest image to allocate memory for
+ * @return Flag indicating whether the decoding process was successful or not.
+ */
+inline bool DecodeParallel(const std::vector<uint8_t> &inStream, std::vector<uint8_t> &outPixelColors, uint32_t &outImageWidth, uint32_t &outImageHeight, uint8_t &outNumChannels, ColorSpace &outColorSpace, size_t numThreads = 0, const DecodeLimits &limits = DecodeLimits())
+{
+    if (AllocatePixels(inStream.data(), inStream.size(), limits, outPixelColors, outImageWidth, outImageHeight, outNumChannels, outColorSpace) != DecodeError::None)
+    {
+        outPixelColors.clear();
+        return false;
+    }
+
+    if (DecodeIntoParallel(inStream.data(), inStream.size(), outPixelColors.data(), outPixelColors.size(), 0, outImageWidth, outImageHeight, outNumChannels, outColorSpace, numThreads) != DecodeError::None)
+    {
+        outPixelColors.clear();
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Class for decoding a QOI image from compressed bytes that arrive in pieces of any size, one row at a time.
+ *
+ * Besides the decoder state, it only keeps a single row of pixels, so its memory use does not depend on the
+ * height of the image or on the size of the compressed data. Rows are either handed to a callback as soon as
+ * they are complete, or pulled by the caller:
+ *
+ *     qoi::StreamDecoder decoder;
+ *     while (size_t size = ReadSomeBytes(buffer))
+ *     {
+ *         const uint8_t *data = buffer;
+ *         while (size > 0)
+ *         {
+ *             size_t consumed = decoder.Push(data, size);
+ *             data += consumed;
+ *             size -= consumed;
+ *             while (const uint8_t *row = decoder.PopRow())
+ *             {
+ *                 ...
+ *             }
+ *         }
+ *     }
+ *     qoi::DecodeError error = decoder.Finish();
+ */
+class StreamDecoder
+{
+public:
+    /**
+     * Function that receives every decoded row, along with its index. The row is only valid during the call.
+     */
+    typedef std::function<void(const uint8_t *row, uint32_t y)> RowCallback;
+
+    /**
+     * @brief Constructor for pulling rows with PopRow()
+     */
+    StreamDecoder()
+    {
+        Reset();
+    }
+
+    /**
+     * @brief Constructor for receiving rows through a callback
+     * @param[in] rowCallback Function that receives every decoded row
+     */
+    explicit StreamDecoder(RowCallback rowCallback)
+        : m_rowCallback(rowCallback)
+    {
+        Reset();
+    }
+
+    /**
+     * @brief Sets the largest image to decode, which is checked as soon as the header is complete.
+     *        The limits apply to the whole image, even though only one row of it is kept in memory.
+     * @param[in] limits Largest image to decode
+     */
+    void SetLimits(const DecodeLimits &limits)
+    {
+        m_limits = limits;
+    }
+
+    /**
+     * @brief Forgets the current image, so that another one can be decoded. The limits are kept.
+     */
+    void Reset()
+    {
+        m_headerSize = 0;
+        m_imageWidth = 0;
+        m_imageHeight = 0;
+        m_numChannels = 0;
+        m_colorSpace = ColorSpace::SRGB;
+        m_error = DecodeError::None;
+        m_row.clear();
+        m_rowOffset = 0;
+        m_rowIndex = 0;
+        m_isRowReady = false;
+        m_prevPixel = { 0, 0, 0, 255 };
+        m_seenPixels = {};
+        m_run = 0;
+        m_pendingSize = 0;
+    }
+
+    /**
+     * @brief Decodes the next piece of the compressed image.
+     *        Without a callback, this stops as soon as a row is complete, and does not continue until the row was popped.
+     * @param[in] data Pointer to the next bytes of the QOI format image
+     * @param[in] size Number of bytes
+     * @return Number of bytes that were consumed. The rest has to be pushed again.
+     */
+    size_t Push(const uint8_t *data, size_t size)
+    {
+        size_t consumed = 0;
+        if (m_error != DecodeError::None)
+        {
+            return consumed;
+        }
+
+        if (m_headerSize < 14)
+        {
+            size_t headerBytes = std::min<size_t>(14 - m_headerSize, size);
+            std::memcpy(m_header + m_headerSize, data, headerBytes);
+            m_headerSize += headerBytes;
+            consumed += headerBytes;
+            if (m_headerSize < 14)
+            {
+                return consumed;
+            }
+
+            m_error = ParseHeaderFields(m_header, m_imageWidth, m_imageHeight, m_numChannels, m_colorSpace);
+            if (m_error == DecodeError::None)
+            {
+                m_error = CheckImageSize(m_imageWidth, m_imageHeight, m_numChannels, m_limits);
+            }
+            if (m_error != DecodeError::None)
+            {
+                return consumed;
+            }
+
+            // An image without rows is already finished, however wide it claims to be
+            if (m_imageHeight > 0)
+            {
+                m_row.resize(static_cast<size_t>(m_imageWidth) * m_numChannels);
+            }
+        }
+
+        // A run left over from the last chunk may still owe rows when the input is used up
+        while (((consumed < size) || (m_run > 0)) && !IsFinished() && !m_isRowReady)
+        {
+            consumed += DecodeRow(data + consumed, size - consumed);
+        }
+
+        // Whatever follows the last pixel is the end marker
+        if (IsFinished())
+        {
+            consumed = size;
+        }
+        return consumed;
+    }
+
+    /**
+     * @brief Takes the next decoded row, when decoding without a callback.
+     * @return Pointer to the row, valid until the next call to Push(), or nullptr if no row is complete.
+     */
+    const uint8_t *PopRow()
+    {
+        if (!m_isRowReady)
+        {
+            return nullptr;
+        }
+
+        m_isRowReady = false;
+        m_rowOffset = 0;
+        ++m_rowIndex;
+        return m_row.data();
+    }
+
+    /**
+     * @brief Checks whether the whole image was decoded after all the compressed bytes were pushed.
+     * @return DecodeError::None if every row of the image was decoded.
+     */
+    DecodeError Finish() const
+    {
+        if (m_error != DecodeError::None)
+        {
+            return m_error;
+        }
+        if (m_headerSize < 14)
+        {
+            return DecodeError::InvalidHeader;
+        }
+        return IsFinished() ? DecodeError::None : DecodeError::TruncatedData;
+    }
+
+    /**
+     * @brief Checks whether every row of the image was decoded. Popping the last row is not required.
+     * @return Flag indicating whether decoding is done.
+     */
+    bool IsFinished() const
+    {
+        return (m_headerSize == 14) && ((m_rowIndex + (m_isRowReady ? 1 : 0) >= m_imageHeight) || (m_imageWidth == 0));
+    }
+
+    /**
+     * @brief Checks whether the header was decoded, after which the image properties are known.
+     * @return Flag indicating whether the header was decoded or not.
+     */
+    bool HasHeader() const
+    {
+        return (m_headerSize == 14) && (m_error != DecodeError::InvalidHeader);
+    }
+
+    /**
+     * @brief Gets the width of the image.
+     * @return Width of the image
+     */
+    uint32_t GetImageWidth() const
+    {
+        return m_imageWidth;
+    }
+
+    /**
+     * @brief Gets the height of the image.
+     * @return Height of the image
+     */
+    uint32_t GetImageHeight() const
+    {
+        return m_imageHeight;
+    }
+
+    /**
+     * @brief Gets the number of color channels in the image.
+     * @return Number of color channels
+     */
+    uint8_t GetNumChannels() const
+    {
+        return m_numChannels;
+    }
+
+    /**
+     * @brief Gets the colorspace of the image.
+     * @return Colorspace of the image
+     */
+    ColorSpace GetColorSpace() const
+    {
+        return m_colorSpace;
+    }
+
+    /**
+     * @brief Gets the index of the next row that PopRow() or the callback will deliver.
+     * @return Row index
+     */
+    uint32_t GetRowIndex() const
+    {
+        return m_rowIndex;
+    }
+
+private:
+    /**
+     * @brief Decodes chunks into the current row until it is complete or the input runs out.
+     *        A chunk that is split between two pieces of input is collected in m_pending.
+     * @param[in] data Pointer to the input
+     * @param[in] size Number of bytes of input
+     * @return Number of bytes that were consumed
+     */
+    size_t DecodeRow(const uint8_t *data, size_t size)
+    {
+        const uint8_t *in = data;
+        const uint8_t *inEnd = data + size;
+        uint8_t *out = m_row.data() + m_rowOffset;
+        uint8_t *rowEnd = m_row.data() + m_row.size();
+        Pixel prevPixel = m_prevPixel;
+        size_t run = m_run;
+
+        while (out < rowEnd)
+        {
+            if (run > 0)
+            {
+                size_t count = std::min<size_t>(run, (rowEnd - out) / m_numChannels);
+                if (m_numChannels == 4)
+                {
+                    FillPixels<4>(prevPixel, out, out + count * 4);
+                }
+                else
+                {
+                    FillPixels<3>(prevPixel, out, out + count * 3);
+                }
+                out += count * m_numChannels;
+                run -= count;
+                continue;
+            }
+
+            // The longest chunk has 5 bytes, so anything shorter left in the input may be a partial chunk.
+            // Every chunk is turned into a run, of a single pixel unless it is QOI_OP_RUN.
+            if ((m_pendingSize == 0) && (inEnd - in >= 5))
+            {
+                run = DecodeChunk(in, prevPixel, m_seenPixels);
+                continue;
+            }
+
+            if (m_pendingSize == 0)
+            {
+                if (in == inEnd)
+                {
+                    break;
+                }
+                m_pending[m_pendingSize++] = *in++;
+            }
+            // No chunk is longer than the buffer, which the compiler cannot tell from the table
+            size_t chunkSize = std::min<size_t>(ChunkTablesHolder<>::tables.chunkSizes[m_pending[0]], sizeof(m_pending));
+            while ((m_pendingSize < chunkSize) && (in < inEnd))
+            {
+                m_pending[m_pendingSize++] = *in++;
+            }
+            if (m_pendingSize < chunkSize)
+            {
+                break;
+            }
+            const uint8_t *chunk = m_pending;
+            run = DecodeChunk(chunk, prevPixel, m_seenPixels);
+            m_pendingSize = 0;
+        }
+
+        m_prevPixel = prevPixel;
+        m_run = run;
+        m_rowOffset = out - m_row.data();
+
+        if (out == rowEnd)
+        {
+            if (m_rowCallback)
+            {
+                m_rowCallback(m_row.data(), m_rowIndex);
+                m_rowOffset = 0;
+                ++m_rowIndex;
+            }
+            else
+            {
+                m_isRowReady = true;
+            }
+
+            // A run may continue into the next row, but not past the last one
+            if ((m_rowIndex + (m_isRowReady ? 1 : 0) == m_imageHeight) && (m_run > 0))
+            {
+                m_error = DecodeError::CorruptData;
+            }
+        }
+
+        return in - data;
+    }
+
+private:
+    /**
+     * Function that receives every decoded row, or empty to pull rows with PopRow()
+     */
+    RowCallback m_rowCallback;
+
+    /**
+     * Header bytes received so far
+     */
+    uint8_t m_header[14];
+
+    /**
+     * Number of header bytes received so far
+     */
+    size_t m_headerSize;
+
+    /**
+     * Properties of the image, from its header
+     */
+    uint32_t m_imageWidth;
+    uint32_t m_imageHeight;
+    uint8_t m_numChannels;
+    ColorSpace m_colorSpace;
+
+    /**
+     * First error found in the data
+     */
+    DecodeError m_error;
+
+    /**
+     * Largest image to decode
+     */
+    DecodeLimits m_limits;
+
+    /**
+     * Pixels of the row being decoded
+     */
+    std::vector<uint8_t> m_row;
+
+    /**
+     * Number of bytes of the row that were decoded
+     */
+    size_t m_rowOffset;
+
+    /**
+     * Index of the row being decoded
+     */
+    uint32_t m_rowIndex;
+
+    /**
+     * Flag indicating whether the row is complete and waits to be popped
+     */
+    bool m_isRowReady;
+
+    /**
+     * Decoder state, carried from one piece of input to the next
+     */
+    Pixel m_prevPixel;
+    std::array<Pixel, 64> m_seenPixels;
+    size_t m_run;
+
+    /**
+     * Bytes of a chunk that is split between two pieces of input
+     */
+    uint8_t m_pending[5];
+    size_t m_pendingSize;
+};
 }
 
 #endif // QOI_DECODER_HEADER
@@ -1,12 +1,37 @@
 #ifndef QOI_ENCODER_HEADER
 #define QOI_ENCODER_HEADER
 
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <fstream>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <ostream>
 #include <string>
+#include <thread>
 #include <vector>
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#define QOI_HAVE_POSIX_IO
+#endif
+
+// SSE2 is part of every x86-64 CPU, AVX2 is picked at runtime
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#include <immintrin.h>
+#define QOI_HAVE_X86_SIMD
+#endif
+
 #ifndef QOI_CHUNK_TAGS
 #define QOI_CHUNK_TAGS
 
@@ -19,6 +44,60 @@
 
 #endif // QOI_CHUNK_TAGS
 
+#ifndef QOI_STRIPE_TABLE
+#define QOI_STRIPE_TABLE
+
+// Striped QOI files are plain QOI files followed by a table of where each stripe starts:
+//   uint64 offset of every stripe (big-endian, from the start of the file)
+//   uint32 number of rows per stripe (big-endian)
+//   uint32 number of stripes (big-endian)
+//   4-byte magic "qois"
+#define QOI_STRIPE_TABLE_MAGIC          "qois"
+#define QOI_STRIPE_TABLE_FOOTER_SIZE    12
+
+#endif // QOI_STRIPE_TABLE
+
+#ifndef QOI_PIXEL_TYPE
+#define QOI_PIXEL_TYPE
+
+namespace qoi
+{
+/**
+ * Color of a single pixel, with the channels in the same order as they are laid out in memory
+ */
+struct Pixel
+{
+    uint8_t red;
+    uint8_t green;
+    uint8_t blue;
+    uint8_t alpha;
+};
+
+/**
+ * @brief Reinterprets the specified pixel color as a single 32-bit word, so it can be compared or copied in one go.
+ * @param[in] pixel Pixel color
+ * @return 32-bit word with the same bytes as the pixel color
+ */
+inline uint32_t PixelToWord(const Pixel &pixel)
+{
+    uint32_t word;
+    std::memcpy(&word, &pixel, sizeof(word));
+    return word;
+}
+
+/**
+ * @brief Computes the index of the specified color in the array of previously seen pixels.
+ * @param[in] pixel Pixel color
+ * @return Index of the color in the array of previously seen pixels
+ */
+inline uint32_t ColorHash(const Pixel &pixel)
+{
+    return (static_cast<uint32_t>(pixel.red) * 3 + static_cast<uint32_t>(pixel.green) * 5 + static_cast<uint32_t>(pixel.blue) * 7 + static_cast<uint32_t>(pixel.alpha) * 11) % 64;
+}
+}
+
+#endif // QOI_PIXEL_TYPE
+
 namespace qoi
 {
 /**
@@ -40,174 +119,1863 @@ inline void WriteBytes(uint32_t val, std::vector<uint8_t> &buffer)
 }
 
 /**
- * @brief Encodes the specified array of pixel colors to QOI format, and stores the result in an array of bytes
- * @param[in] inPixelColors Array of pixel colors
+ * @brief Writes the big-endian bytes representation of the specified value through the specified pointer
+ * @param[in] val Value
+ * @param[in] out Pointer to the first of the 4 bytes to write
+ * @return Pointer past the last byte written
+ */
+inline uint8_t *WriteBytes(uint32_t val, uint8_t *out)
+{
+    out[0] = static_cast<uint8_t>(val >> 24);
+    out[1] = static_cast<uint8_t>((val & 0x00FF0000) >> 16);
+    out[2] = static_cast<uint8_t>((val & 0x0000FF00) >> 8);
+    out[3] = static_cast<uint8_t>(val & 0x000000FF);
+    return out + 4;
+}
+
+/**
+ * @brief Computes the largest number of bytes that encoding an image with the specified properties can produce
  * @param[in] imageWidth Image width
  * @param[in] imageHeight Image height
  * @param[in] numChannels Number of channels in the image
- * @param[in] colorSpace Color space of the image
- * @param[out] outBytes Array of bytes where the resulting bytes will be stored
+ * @return Worst-case size of the encoded image in bytes, or the largest 64-bit value if that does not fit in 64 bits
  */
-inline bool Encode(const std::vector<uint8_t> &inPixelColors, const uint32_t &imageWidth, const uint32_t &imageHeight, const uint8_t &numChannels, const uint8_t &colorSpace, std::vector<uint8_t> &outBytes)
+inline uint64_t MaxEncodedSize(uint32_t imageWidth, uint32_t imageHeight, uint8_t numChannels)
 {
-    // --- Header ---
-    outBytes.push_back('q');
-    outBytes.push_back('o');
-    outBytes.push_back('i');
-    outBytes.push_back('f');
-    WriteBytes(imageWidth, outBytes);
-    WriteBytes(imageHeight, outBytes);
-    outBytes.push_back(numChannels);
-    outBytes.push_back(colorSpace);
+    // 14-byte header, one tag byte plus every channel per pixel in the worst case, 8-byte end marker
+    const uint64_t numPixels = static_cast<uint64_t>(imageWidth) * imageHeight;
+    if (numPixels > (std::numeric_limits<uint64_t>::max() - 22) / (numChannels + 1))
+    {
+        return std::numeric_limits<uint64_t>::max();
+    }
+    return 14 + numPixels * (numChannels + 1) + 8;
+}
 
-    // --- Data ---
-    uint32_t prevColor = 0x000000FF;
-    std::array<uint32_t, 64> seenPixels = {};
-    bool isRun = false;
+/**
+ * @brief Checks that a buffer of pixel colors holds a whole image with the specified properties.
+ *        The pixel count is 64-bit, so that the check cannot be fooled by dimensions whose product overflows.
+ * @param[in] numBytes Size of the buffer in bytes
+ * @param[in] imageWidth Image width
+ * @param[in] imageHeight Image height
+ * @param[in] numChannels Number of channels in the image
+ * @return Flag indicating whether the image has 3 or 4 channels and all its pixels are in the buffer.
+ */
+inline bool HasAllPixels(size_t numBytes, uint32_t imageWidth, uint32_t imageHeight, uint8_t numChannels)
+{
+    if ((numChannels != 3) && (numChannels != 4))
+    {
+        return false;
+    }
+    return static_cast<uint64_t>(imageWidth) * imageHeight <= numBytes / numChannels;
+}
+
+/**
+ * @brief Checks that a buffer holds a whole image whose rows start a fixed number of bytes apart.
+ *        The last row only needs its pixels, not the padding after them. Counted by division, so nothing can overflow.
+ * @param[in] numBytes Size of the buffer in bytes
+ * @param[in] stride Distance in bytes between the starts of two consecutive rows, or 0 if the rows are tightly packed
+ * @param[in] imageWidth Image width
+ * @param[in] imageHeight Image height
+ * @param[in] numChannels Number of channels in the image
+ * @return Flag indicating whether the image has 3 or 4 channels, the stride is at least a row, and all rows are in the buffer.
+ */
+inline bool HasAllPixels(size_t numBytes, size_t stride, uint32_t imageWidth, uint32_t imageHeight, uint8_t numChannels)
+{
+    if (stride == 0)
+    {
+        return HasAllPixels(numBytes, imageWidth, imageHeight, numChannels);
+    }
+    if ((numChannels != 3) && (numChannels != 4))
+    {
+        return false;
+    }
+
+    const uint64_t rowBytes = static_cast<uint64_t>(imageWidth) * numChannels;
+    if (stride < rowBytes)
+    {
+        return false;
+    }
+    return (imageHeight == 0) || ((rowBytes <= numBytes) && (imageHeight - 1 <= (numBytes - rowBytes) / stride));
+}
+
+/**
+ * @brief Checks whether a buffer of the specified size can be allocated in addition to what a vector already holds.
+ * @param[in] numBytes Size of the buffer in bytes
+ * @param[in] startOffset Number of bytes in front of the buffer
+ * @return Flag indicating whether the total size can be addressed on this platform.
+ */
+inline bool IsAddressable(uint64_t numBytes, size_t startOffset)
+{
+    return numBytes <= std::numeric_limits<size_t>::max() - startOffset;
+}
+
+/**
+ * State carried by the encoder from one pixel to the next
+ */
+struct EncoderState
+{
+    /**
+     * Previously encoded pixel color
+     */
+    Pixel prevPixel = { 0, 0, 0, 255 };
+
+    /**
+     * Array of previously seen pixel colors, indexed by their hash
+     */
+    std::array<Pixel, 64> seenPixels = {};
+
+    /**
+     * Number of pixels in the run that has not been written yet
+     */
+    uint32_t run = 0;
+};
+
+/**
+ * @brief Writes the pending run of the specified encoder state, if there is one
+ * @param[in] state Encoder state
+ * @param[in] out Pointer to where the chunk will be written
+ * @return Pointer past the last byte written
+ */
+inline uint8_t *FlushRun(EncoderState &state, uint8_t *out)
+{
+    if (state.run > 0)
+    {
+        // Bias of -1, so a run of 1 is encoded as 0
+        *out++ = static_cast<uint8_t>(QOI_OP_RUN | (state.run - 1));
+        state.run = 0;
+    }
+    return out;
+}
+
+/**
+ * @brief Loads the pixel color at the specified location
+ * @tparam NumChannels Number of channels per pixel (3 or 4)
+ * @param[in] in Pointer to the first channel of the pixel
+ * @return Pixel color. Alpha is always 255 for 3 channels.
+ */
+template <uint8_t NumChannels>
+inline Pixel LoadPixel(const uint8_t *in)
+{
+    Pixel pixel;
+    if (NumChannels == 4)
+    {
+        std::memcpy(&pixel, in, 4);
+    }
+    else
+    {
+        pixel.red = in[0];
+        pixel.green = in[1];
+        pixel.blue = in[2];
+        pixel.alpha = 255;
+    }
+    return pixel;
+}
+
+/**
+ * Instruction sets that the encoder can use, from slowest to fastest
+ */
+enum class SimdLevel
+{
+    Scalar,
+    SSE2,
+    AVX2
+};
+
+/**
+ * @brief Gets the fastest instruction set that this build and the CPU it runs on both support.
+ * @return Instruction set
+ */
+inline SimdLevel DetectSimdLevel()
+{
+#ifdef QOI_HAVE_X86_SIMD
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return SimdLevel::AVX2;
+    }
+    return SimdLevel::SSE2;
+#else
+    return SimdLevel::Scalar;
+#endif
+}
+
+/**
+ * @brief Gets the instruction set that the encoder currently uses, which is the fastest available one unless SetSimdLevel() said otherwise.
+ * @return Instruction set, shared by all threads
+ */
+inline SimdLevel &ActiveSimdLevel()
+{
+    static SimdLevel level = DetectSimdLevel();
+    return level;
+}
+
+/**
+ * @brief Limits the instruction set that the encoder uses, for example to compare it with the scalar code.
+ *        Levels the CPU does not support are lowered to the fastest one it does. Not thread safe.
+ * @param[in] level Fastest instruction set to use
+ */
+inline void SetSimdLevel(SimdLevel level)
+{
+    ActiveSimdLevel() = std::min(level, DetectSimdLevel());
+}
+
+/**
+ * @brief Gets the name of the specified instruction set.
+ * @param[in] level Instruction set
+ * @return Name of the instruction set
+ */
+inline const char *GetSimdLevelName(SimdLevel level)
+{
+    switch (level)
+    {
+    case SimdLevel::Scalar:
+        return "scalar";
+    case SimdLevel::SSE2:
+        return "sse2";
+    case SimdLevel::AVX2:
+        return "avx2";
+    }
+    return "unknown";
+}
+
+/**
+ * Function that counts how many pixels in a row are the same color as the first pixel of a run.
+ * The color is taken by value, so that the encoder's current pixel can stay in a register.
+ */
+typedef size_t (*RepeatCounter)(const uint8_t *pixels, size_t pixelCount, Pixel color);
 
-    for (size_t i = 0; i < inPixelColors.size(); i += numChannels)
+/**
+ * @brief Counts how many pixels at the start of the specified ones have the specified color, one pixel at a time.
+ * @tparam NumChannels Number of channels per pixel (3 or 4)
+ * @param[in] pixels Pointer to the first pixel
+ * @param[in] pixelCount Number of pixels to look at, at most
+ * @param[in] color Color of the run
+ * @return Number of pixels with that color before the first one without it
+ */
+template <uint8_t NumChannels>
+inline size_t CountRepeatsScalar(const uint8_t *pixels, size_t pixelCount, Pixel color)
+{
+    const uint32_t word = PixelToWord(color);
+    size_t count = 0;
+    while ((count < pixelCount) && (PixelToWord(LoadPixel<NumChannels>(pixels + count * NumChannels)) == word))
     {
-        uint8_t red   = inPixelColors[i];
-        uint8_t green = inPixelColors[i + 1];
-        uint8_t blue  = inPixelColors[i + 2];
-        uint8_t alpha = (numChannels == 4) ? inPixelColors[i + 3] : 255;
+        ++count;
+    }
+    return count;
+}
+
+#ifdef QOI_HAVE_X86_SIMD
+/**
+ * @brief Gets 8 bytes of the specified RGB color repeated over and over, starting at the specified channel.
+ *        Vectors of RGB pixels line up with these every 24 bytes.
+ * @param[in] color Color of the run
+ * @param[in] phase Channel that the first byte holds (0 for red, 1 for green, 2 for blue)
+ * @return The 8 bytes, in memory order
+ */
+inline int64_t GetRgbPattern(const Pixel &color, uint32_t phase)
+{
+    const uint8_t channels[3] = { color.red, color.green, color.blue };
+    uint64_t triple = channels[phase] | (static_cast<uint64_t>(channels[(phase + 1) % 3]) << 8) | (static_cast<uint64_t>(channels[(phase + 2) % 3]) << 16);
+    return static_cast<int64_t>(triple * ((1ull << 48) + (1ull << 24) + 1));
+}
 
-        uint32_t currentColor = 
-            (static_cast<uint32_t>(red)   << 24) |
-            (static_cast<uint32_t>(green) << 16) |
-            (static_cast<uint32_t>(blue)  << 8) |
-            alpha;
-        uint32_t hash = (static_cast<uint32_t>(red) * 3 + static_cast<uint32_t>(green) * 5 + static_cast<uint32_t>(blue) * 7 + static_cast<uint32_t>(alpha) * 11) % 64;
-        if (currentColor == prevColor)
+/**
+ * @brief Counts how many pixels at the start of the specified ones have the specified color, 4 RGBA or 16 RGB pixels per step.
+ * @tparam NumChannels Number of channels per pixel (3 or 4)
+ * @param[in] pixels Pointer to the first pixel
+ * @param[in] pixelCount Number of pixels to look at, at most
+ * @param[in] color Color of the run
+ * @return Number of pixels with that color before the first one without it
+ */
+template <uint8_t NumChannels>
+inline size_t CountRepeatsSSE2(const uint8_t *pixels, size_t pixelCount, Pixel color)
+{
+    size_t count = 0;
+    if (NumChannels == 4)
+    {
+        const __m128i pattern = _mm_set1_epi32(static_cast<int>(PixelToWord(color)));
+        for (; count + 4 <= pixelCount; count += 4)
         {
-            if (!isRun)
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pixels + count * 4));
+            uint32_t equalBytes = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi32(block, pattern)));
+            if (equalBytes != 0xFFFF)
             {
-                // Push a run tag, and since there's a bias of -1,
-                // actual + -1 = encoded. Since actual=1, then
-                // encoded=0
-                outBytes.push_back(QOI_OP_RUN);
-                isRun = true;
+                return count + __builtin_ctz(~equalBytes) / 4;
             }
-            else
+        }
+    }
+    else
+    {
+        // 8 bytes hold 2 2/3 pixels, so the 8-byte patterns start at red, blue and green in turn
+        const int64_t rgb = GetRgbPattern(color, 0);
+        const int64_t brg = GetRgbPattern(color, 2);
+        const int64_t gbr = GetRgbPattern(color, 1);
+        const __m128i pattern0 = _mm_set_epi64x(brg, rgb);
+        const __m128i pattern1 = _mm_set_epi64x(rgb, gbr);
+        const __m128i pattern2 = _mm_set_epi64x(gbr, brg);
+        for (; count + 16 <= pixelCount; count += 16)
+        {
+            const uint8_t *in = pixels + count * 3;
+            uint32_t equalBytes = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in)), pattern0)));
+            equalBytes |= static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + 16)), pattern1))) << 16;
+            uint64_t equalBytesHigh = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + 32)), pattern2)));
+            uint64_t allEqualBytes = equalBytes | (equalBytesHigh << 32);
+            if (allEqualBytes != 0xFFFFFFFFFFFFull)
             {
-                uint8_t run = (outBytes.back() & (~QOI_OP_RUN)) + 1;
-                if (run < 62)
-                {
-                    outBytes.back() = run | QOI_OP_RUN;
-                }
-                else
-                {
-                    outBytes.push_back(QOI_OP_RUN);
-                }
+                return count + __builtin_ctzll(~allEqualBytes) / 3;
             }
         }
-        else 
-        {
-            isRun = false;
+    }
+    return count + CountRepeatsScalar<NumChannels>(pixels + count * NumChannels, pixelCount - count, color);
+}
 
-            if (currentColor == seenPixels[hash])
+/**
+ * @brief Counts how many pixels at the start of the specified ones have the specified color, 8 RGBA or 32 RGB pixels per step.
+ * @tparam NumChannels Number of channels per pixel (3 or 4)
+ * @param[in] pixels Pointer to the first pixel
+ * @param[in] pixelCount Number of pixels to look at, at most
+ * @param[in] color Color of the run
+ * @return Number of pixels with that color before the first one without it
+ */
+template <uint8_t NumChannels>
+__attribute__((target("avx2"))) inline size_t CountRepeatsAVX2(const uint8_t *pixels, size_t pixelCount, Pixel color)
+{
+    size_t count = 0;
+    if (NumChannels == 4)
+    {
+        const __m256i pattern = _mm256_set1_epi32(static_cast<int>(PixelToWord(color)));
+        for (; count + 8 <= pixelCount; count += 8)
+        {
+            __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pixels + count * 4));
+            uint32_t equalBytes = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi32(block, pattern)));
+            if (equalBytes != 0xFFFFFFFF)
             {
-                uint8_t indexChunk = static_cast<uint8_t>(hash);
-                outBytes.push_back(indexChunk);
+                return count + __builtin_ctz(~equalBytes) / 4;
             }
-            else
+        }
+    }
+    else
+    {
+        const int64_t rgb = GetRgbPattern(color, 0);
+        const int64_t brg = GetRgbPattern(color, 2);
+        const int64_t gbr = GetRgbPattern(color, 1);
+        const __m256i pattern0 = _mm256_set_epi64x(rgb, gbr, brg, rgb);
+        const __m256i pattern1 = _mm256_set_epi64x(brg, rgb, gbr, brg);
+        const __m256i pattern2 = _mm256_set_epi64x(gbr, brg, rgb, gbr);
+        for (; count + 32 <= pixelCount; count += 32)
+        {
+            const uint8_t *in = pixels + count * 3;
+            uint32_t equalBytes0 = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(in)), pattern0)));
+            uint32_t equalBytes1 = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + 32)), pattern1)));
+            uint32_t equalBytes2 = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + 64)), pattern2)));
+            if ((equalBytes0 & equalBytes1 & equalBytes2) != 0xFFFFFFFF)
             {
-                uint8_t prevRed   = static_cast<uint8_t>(prevColor >> 24);
-                uint8_t prevGreen = static_cast<uint8_t>((prevColor & 0x00FF0000) >> 16);
-                uint8_t prevBlue  = static_cast<uint8_t>((prevColor & 0x0000FF00) >> 8);
-                uint8_t prevAlpha = static_cast<uint8_t>(prevColor);
-                
-                // TODO: There's most likely a better way of doing this, maybe exploting the bias?
-                int32_t dr = static_cast<int32_t>(red) - static_cast<int32_t>(prevRed);
-                int32_t dg = static_cast<int32_t>(green) - static_cast<int32_t>(prevGreen);
-                int32_t db = static_cast<int32_t>(blue) - static_cast<int32_t>(prevBlue);
-                int32_t dr_dg = dr - dg;
-                int32_t db_dg = db - dg;
-                if ((alpha == prevAlpha) && (-2 <= dr && dr <= 1) && (-2 <= dg && dg <= 1) && (-2 <= db && db <= 1))
-                {
-                    uint8_t chunk = QOI_OP_DIFF;
-                    chunk |= (dr + 2) << 4;
-                    chunk |= (dg + 2) << 2;
-                    chunk |= (db + 2);
-                    outBytes.push_back(chunk);
-                }
-                else if ((alpha == prevAlpha) && (-32 <= dg && dg <= 31) && (-8 <= dr_dg && dr_dg <= 7) && (-8 <= db_dg && db_dg <= 7))
+                if (equalBytes0 != 0xFFFFFFFF)
                 {
-                    uint8_t chunk0 = QOI_OP_LUMA;
-                    chunk0 |= (dg + 32);
-
-                    uint8_t chunk1 = 0;
-                    chunk1 |= (dr_dg + 8) << 4;
-                    chunk1 |= (db_dg + 8);
-
-                    outBytes.push_back(chunk0);
-                    outBytes.push_back(chunk1);
+                    return count + __builtin_ctz(~equalBytes0) / 3;
                 }
-                else
+                if (equalBytes1 != 0xFFFFFFFF)
                 {
-                    if ((numChannels == 3) || (alpha == prevAlpha))
-                    {
-                        outBytes.push_back(QOI_OP_RGB);
-                        outBytes.push_back(red);
-                        outBytes.push_back(green);
-                        outBytes.push_back(blue);
-                    }
-                    else
-                    {
-                        outBytes.push_back(QOI_OP_RGBA);
-                        outBytes.push_back(red);
-                        outBytes.push_back(green);
-                        outBytes.push_back(blue);
-                        outBytes.push_back(alpha);
-                    }
+                    return count + (32 + __builtin_ctz(~equalBytes1)) / 3;
                 }
+                return count + (64 + __builtin_ctz(~equalBytes2)) / 3;
             }
         }
+    }
+    return count + CountRepeatsSSE2<NumChannels>(pixels + count * NumChannels, pixelCount - count, color);
+}
+#endif // QOI_HAVE_X86_SIMD
 
-        seenPixels[hash] = currentColor;
-        prevColor = currentColor;
+/**
+ * @brief Gets the function that counts repeated pixels with the instruction set that the encoder currently uses.
+ * @tparam NumChannels Number of channels per pixel (3 or 4)
+ * @return Function that counts repeated pixels
+ */
+template <uint8_t NumChannels>
+inline RepeatCounter GetRepeatCounter()
+{
+#ifdef QOI_HAVE_X86_SIMD
+    switch (ActiveSimdLevel())
+    {
+    case SimdLevel::AVX2:
+        return CountRepeatsAVX2<NumChannels>;
+    case SimdLevel::SSE2:
+        return CountRepeatsSSE2<NumChannels>;
+    case SimdLevel::Scalar:
+        break;
     }
+#endif
+    return CountRepeatsScalar<NumChannels>;
+}
 
-    // --- End marker ---
-    outBytes.push_back(0x00);
-    outBytes.push_back(0x00);
-    outBytes.push_back(0x00);
-    outBytes.push_back(0x00);
-    outBytes.push_back(0x00);
-    outBytes.push_back(0x00);
-    outBytes.push_back(0x00);
-    outBytes.push_back(0x01);
+/**
+ * Number of pixels that the encoder classifies at a time
+ */
+const size_t PIXEL_BLOCK_SIZE = 256;
 
-    return true;
+/**
+ * Block of pixels, with everything about them that only depends on the pixel before each of them. That is all of it
+ * but the array of seen colors, so it can be worked out for many pixels at once, ahead of the pass that handles runs
+ * and the array one pixel at a time.
+ */
+struct PixelBlock
+{
+    /**
+     * Pixel colors as words, starting with the pixel before the block
+     */
+    uint32_t words[PIXEL_BLOCK_SIZE + 1];
+
+    /**
+     * Hash of each pixel color
+     */
+    uint32_t hashes[PIXEL_BLOCK_SIZE];
+
+    /**
+     * DIFF, LUMA, RGB or RGBA chunk that each pixel gets if its color is not in the array, first byte in the low byte
+     */
+    uint64_t chunks[PIXEL_BLOCK_SIZE];
+
+    /**
+     * Size of each of those chunks in bytes. Zero for a pixel with the same color as the one before it.
+     */
+    uint8_t chunkSizes[PIXEL_BLOCK_SIZE];
+};
+
+/**
+ * Function that classifies the pixels of a block whose words have been loaded
+ */
+typedef void (*BlockClassifier)(PixelBlock &block, size_t pixelCount);
+
+/**
+ * @brief Classifies the pixels of the specified block, one pixel at a time. This branches on every pixel just like
+ *        encoding it directly does, so it is only used for what is left over after the vector code.
+ * @param[in] block Block whose words have been loaded
+ * @param[in] first Index of the first pixel to classify
+ * @param[in] pixelCount Number of pixels in the block
+ */
+inline void ClassifyPixelsScalar(PixelBlock &block, size_t first, size_t pixelCount)
+{
+    for (size_t i = first; i < pixelCount; ++i)
+    {
+        const uint32_t word = block.words[i + 1];
+        Pixel prevPixel;
+        Pixel pixel;
+        std::memcpy(&prevPixel, &block.words[i], 4);
+        std::memcpy(&pixel, &word, 4);
+        block.hashes[i] = ColorHash(pixel);
+
+        int32_t dr = static_cast<int32_t>(pixel.red) - static_cast<int32_t>(prevPixel.red);
+        int32_t dg = static_cast<int32_t>(pixel.green) - static_cast<int32_t>(prevPixel.green);
+        int32_t db = static_cast<int32_t>(pixel.blue) - static_cast<int32_t>(prevPixel.blue);
+        int32_t dr_dg = dr - dg;
+        int32_t db_dg = db - dg;
+        if (word == block.words[i])
+        {
+            block.chunks[i] = 0;
+            block.chunkSizes[i] = 0;
+        }
+        else if (pixel.alpha != prevPixel.alpha)
+        {
+            block.chunks[i] = QOI_OP_RGBA | (static_cast<uint64_t>(word) << 8);
+            block.chunkSizes[i] = 5;
+        }
+        else if ((-2 <= dr && dr <= 1) && (-2 <= dg && dg <= 1) && (-2 <= db && db <= 1))
+        {
+            block.chunks[i] = QOI_OP_DIFF | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2);
+            block.chunkSizes[i] = 1;
+        }
+        else if ((-32 <= dg && dg <= 31) && (-8 <= dr_dg && dr_dg <= 7) && (-8 <= db_dg && db_dg <= 7))
+        {
+            block.chunks[i] = (QOI_OP_LUMA | (dg + 32)) | (((dr_dg + 8) << 4 | (db_dg + 8)) << 8);
+            block.chunkSizes[i] = 2;
+        }
+        else
+        {
+            block.chunks[i] = QOI_OP_RGB | (static_cast<uint64_t>(word) << 8);
+            block.chunkSizes[i] = 4;
+        }
+    }
 }
 
+#ifdef QOI_HAVE_X86_SIMD
 /**
- * @brief Encodes the specified array of pixel colors to a QOI image file
- * @param[in] inPixelColors Array of pixel colors
- * @param[in] imageWidth Image width
- * @param[in] imageHeight Image height
- * @param[in] numChannels Number of channels in the image
- * @param[in] colorSpace Color space of the image
- * @param[in] outputFilePath File path of the output image file
+ * @brief Adds up the two 32-bit halves of each pixel, after _mm_madd_epi16() on pixels widened to 16 bits per channel.
+ * @param[in] low Sums for the first two pixels
+ * @param[in] high Sums for the last two pixels
+ * @return One 32-bit sum per pixel
  */
-inline bool Encode(const std::vector<uint8_t> &inPixelColors, const uint32_t &imageWidth, const uint32_t &imageHeight, const uint8_t &numChannels, const uint8_t &colorSpace, const std::string &outputFilePath)
+inline __m128i AddPixelHalves(__m128i low, __m128i high)
+{
+    __m128 even = _mm_shuffle_ps(_mm_castsi128_ps(low), _mm_castsi128_ps(high), _MM_SHUFFLE(2, 0, 2, 0));
+    __m128 odd = _mm_shuffle_ps(_mm_castsi128_ps(low), _mm_castsi128_ps(high), _MM_SHUFFLE(3, 1, 3, 1));
+    return _mm_add_epi32(_mm_castps_si128(even), _mm_castps_si128(odd));
+}
+
+/**
+ * @brief Checks which 16-bit lanes of the specified vector are in the specified range.
+ * @param[in] values 16-bit signed values
+ * @param[in] min Smallest value in the range
+ * @param[in] max Largest value in the range
+ * @return All ones in the lanes that are in the range, zero elsewhere
+ */
+inline __m128i IsInRange(__m128i values, int16_t min, int16_t max)
+{
+    return _mm_and_si128(_mm_cmpgt_epi16(values, _mm_set1_epi16(min - 1)), _mm_cmplt_epi16(values, _mm_set1_epi16(max + 1)));
+}
+
+/**
+ * @brief Picks between the specified vectors with the specified mask.
+ * @param[in] mask All ones where the first vector should be taken, zero where the second one should
+ * @param[in] ifSet First vector
+ * @param[in] ifClear Second vector
+ * @return Picked vector
+ */
+inline __m128i Select(__m128i mask, __m128i ifSet, __m128i ifClear)
 {
-    std::vector<uint8_t> bytesToWrite = {};
-    if (!Encode(inPixelColors, imageWidth, imageHeight, numChannels, colorSpace, bytesToWrite))
+    return _mm_or_si128(_mm_and_si128(mask, ifSet), _mm_andnot_si128(mask, ifClear));
+}
+
+/**
+ * @brief Classifies the pixels of the specified block, 4 pixels per step.
+ *        The channel differences are taken in 16 bits, so that they do not wrap around, just like in ClassifyPixelsScalar().
+ * @param[in] block Block whose words have been loaded
+ * @param[in] pixelCount Number of pixels in the block
+ */
+inline void ClassifyBlockSSE2(PixelBlock &block, size_t pixelCount)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i allOnes = _mm_set1_epi32(-1);
+    const __m128i alphaLanes = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+    const __m128i greenLanes = _mm_set_epi16(0, 0, -1, 0, 0, 0, -1, 0);
+    const __m128i hashWeights = _mm_set_epi16(11, 7, 5, 3, 11, 7, 5, 3);
+    const __m128i diffWeights = _mm_set_epi16(0, 1, 4, 16, 0, 1, 4, 16);
+    const __m128i greenWeights = _mm_set_epi16(0, 0, 1, 0, 0, 0, 1, 0);
+    const __m128i lumaWeights = _mm_set_epi16(0, 1, 0, 16, 0, 1, 0, 16);
+    const __m128i diffBias = _mm_set1_epi16(2);
+    const __m128i lumaBias = _mm_set1_epi16(8);
+
+    size_t i = 0;
+    for (; i + 4 <= pixelCount; i += 4)
     {
-        return false;
+        __m128i prev = _mm_loadu_si128(reinterpret_cast<const __m128i *>(block.words + i));
+        __m128i cur = _mm_loadu_si128(reinterpret_cast<const __m128i *>(block.words + i + 1));
+        __m128i curLow = _mm_unpacklo_epi8(cur, zero);
+        __m128i curHigh = _mm_unpackhi_epi8(cur, zero);
+        __m128i deltaLow = _mm_sub_epi16(curLow, _mm_unpacklo_epi8(prev, zero));
+        __m128i deltaHigh = _mm_sub_epi16(curHigh, _mm_unpackhi_epi8(prev, zero));
+
+        __m128i hashes = AddPixelHalves(_mm_madd_epi16(curLow, hashWeights), _mm_madd_epi16(curHigh, hashWeights));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(block.hashes + i), _mm_and_si128(hashes, _mm_set1_epi32(63)));
+
+        // DIFF: every channel difference in [-2, 1], biased by 2
+        __m128i diffChunks = AddPixelHalves(_mm_madd_epi16(_mm_add_epi16(deltaLow, diffBias), diffWeights), _mm_madd_epi16(_mm_add_epi16(deltaHigh, diffBias), diffWeights));
+        diffChunks = _mm_or_si128(diffChunks, _mm_set1_epi32(QOI_OP_DIFF));
+        __m128i isDiff = _mm_cmpeq_epi32(_mm_packs_epi16(_mm_or_si128(IsInRange(deltaLow, -2, 1), alphaLanes), _mm_or_si128(IsInRange(deltaHigh, -2, 1), alphaLanes)), allOnes);
+
+        // LUMA: green difference in [-32, 31], red and blue differences relative to it in [-8, 7]
+        __m128i relativeLow = _mm_sub_epi16(deltaLow, _mm_shufflehi_epi16(_mm_shufflelo_epi16(deltaLow, _MM_SHUFFLE(1, 1, 1, 1)), _MM_SHUFFLE(1, 1, 1, 1)));
+        __m128i relativeHigh = _mm_sub_epi16(deltaHigh, _mm_shufflehi_epi16(_mm_shufflelo_epi16(deltaHigh, _MM_SHUFFLE(1, 1, 1, 1)), _MM_SHUFFLE(1, 1, 1, 1)));
+        __m128i lumaFirst = AddPixelHalves(_mm_madd_epi16(deltaLow, greenWeights), _mm_madd_epi16(deltaHigh, greenWeights));
+        __m128i lumaSecond = AddPixelHalves(_mm_madd_epi16(_mm_add_epi16(relativeLow, lumaBias), lumaWeights), _mm_madd_epi16(_mm_add_epi16(relativeHigh, lumaBias), lumaWeights));
+        lumaFirst = _mm_and_si128(_mm_add_epi32(lumaFirst, _mm_set1_epi32(QOI_OP_LUMA + 32)), _mm_set1_epi32(0xFF));
+        __m128i lumaChunks = _mm_or_si128(lumaFirst, _mm_slli_epi32(lumaSecond, 8));
+        __m128i lumaLow = _mm_or_si128(Select(greenLanes, IsInRange(deltaLow, -32, 31), IsInRange(relativeLow, -8, 7)), alphaLanes);
+        __m128i lumaHigh = _mm_or_si128(Select(greenLanes, IsInRange(deltaHigh, -32, 31), IsInRange(relativeHigh, -8, 7)), alphaLanes);
+        __m128i isLuma = _mm_cmpeq_epi32(_mm_packs_epi16(lumaLow, lumaHigh), allOnes);
+
+        // Alpha is the top byte of each word, so its comparison decides the sign
+        __m128i isSameAlpha = _mm_srai_epi32(_mm_cmpeq_epi8(cur, prev), 31);
+        __m128i isRun = _mm_cmpeq_epi32(cur, prev);
+
+        // Same order of checks as ClassifyPixelsScalar(), from the last one to the first one
+        __m128i chunks = _mm_set1_epi32(QOI_OP_RGB);
+        __m128i chunkSizes = _mm_set1_epi32(4);
+        chunks = Select(isLuma, lumaChunks, chunks);
+        chunkSizes = Select(isLuma, _mm_set1_epi32(2), chunkSizes);
+        chunks = Select(isDiff, diffChunks, chunks);
+        chunkSizes = Select(isDiff, _mm_set1_epi32(1), chunkSizes);
+        chunks = Select(isSameAlpha, chunks, _mm_set1_epi32(QOI_OP_RGBA));
+        chunkSizes = Select(isSameAlpha, chunkSizes, _mm_set1_epi32(5));
+        chunkSizes = _mm_andnot_si128(isRun, chunkSizes);
+
+        // RGB and RGBA chunks go on with the pixel color
+        __m128i colors = _mm_andnot_si128(_mm_and_si128(isSameAlpha, _mm_or_si128(isDiff, isLuma)), cur);
+        __m128i chunksLow = _mm_or_si128(_mm_unpacklo_epi32(chunks, zero), _mm_slli_epi64(_mm_unpacklo_epi32(colors, zero), 8));
+        __m128i chunksHigh = _mm_or_si128(_mm_unpackhi_epi32(chunks, zero), _mm_slli_epi64(_mm_unpackhi_epi32(colors, zero), 8));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(block.chunks + i), chunksLow);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(block.chunks + i + 2), chunksHigh);
+
+        chunkSizes = _mm_packus_epi16(_mm_packs_epi32(chunkSizes, chunkSizes), chunkSizes);
+        uint32_t chunkSizeBytes = static_cast<uint32_t>(_mm_cvtsi128_si32(chunkSizes));
+        std::memcpy(block.chunkSizes + i, &chunkSizeBytes, 4);
     }
+    ClassifyPixelsScalar(block, i, pixelCount);
+}
+#endif // QOI_HAVE_X86_SIMD
 
-    std::ofstream file(outputFilePath, std::ios::binary);
-    if (file.fail())
+/**
+ * @brief Gets the function that classifies blocks of pixels with the instruction set that the encoder currently uses.
+ *        AVX2 uses the SSE2 code, since the pass that follows it is what takes the time.
+ * @return Function that classifies blocks of pixels, or nullptr if blocks should not be classified ahead of time
+ */
+inline BlockClassifier GetBlockClassifier()
+{
+#ifdef QOI_HAVE_X86_SIMD
+    if (ActiveSimdLevel() != SimdLevel::Scalar)
     {
-        return false;
+        return ClassifyBlockSSE2;
     }
+#endif
+    return nullptr;
+}
+
+/**
+ * @brief Encodes pixels to QOI chunks one pixel at a time, choosing the chunk for each of them as it goes.
+ *        Stops at the first pixel at or after the specified end that is not part of a run.
+ * @tparam NumChannels Number of channels per pixel (3 or 4)
+ * @param[in] in Pointer to the first pixel
+ * @param[in] blockEnd Pointer to the pixel to stop at
+ * @param[in] pixelsEnd Pointer past the last pixel, which runs can go on to
+ * @param[in] countRepeats Function that counts repeated pixels
+ * @param[in] state Encoder state, updated as the pixels are encoded
+ * @param[in] smallChunks Number of DIFF and LUMA chunks, increased by the ones written
+ * @param[in] out Pointer to where the chunks will be written
+ * @return Pointer past the last pixel encoded
+ */
+template <uint8_t NumChannels>
+inline const uint8_t *EncodeBlockDirect(const uint8_t *in, const uint8_t *blockEnd, const uint8_t *pixelsEnd, RepeatCounter countRepeats, EncoderState &state, size_t &smallChunks, uint8_t *&out)
+{
+    // Keep the hot state in locals so it can live in registers
+    Pixel prevPixel = state.prevPixel;
+    uint32_t prevWord = PixelToWord(prevPixel);
+    uint32_t run = state.run;
+    std::array<Pixel, 64> &seenPixels = state.seenPixels;
+    size_t numSmallChunks = 0;
+    uint8_t *o = out;
 
-    file.write(reinterpret_cast<char*>(bytesToWrite.data()), bytesToWrite.size());
+    for (; in < blockEnd; in += NumChannels)
+    {
+        Pixel pixel = LoadPixel<NumChannels>(in);
+        uint32_t word = PixelToWord(pixel);
+        uint32_t hash = ColorHash(pixel);
+        if (word == prevWord)
+        {
+            // Only matters for a run at the very start, since the previous color is already in the array otherwise
+            seenPixels[hash] = pixel;
 
-    return true;
-}
+            // Take the whole run in one step, and write every full chunk of it right away.
+            // Short runs are common in busy images, so only hand runs that go on to the vector code.
+            const size_t SHORT_RUN = 4;
+            size_t remaining = (pixelsEnd - in) / NumChannels;
+            size_t repeats = 1;
+            while ((repeats < std::min(remaining, SHORT_RUN)) && (PixelToWord(LoadPixel<NumChannels>(in + repeats * NumChannels)) == word))
+            {
+                ++repeats;
+            }
+            if (repeats == SHORT_RUN)
+            {
+                repeats += countRepeats(in + SHORT_RUN * NumChannels, remaining - SHORT_RUN, pixel);
+            }
+            in += (repeats - 1) * NumChannels;
+            run += static_cast<uint32_t>(repeats % 62);
+            for (size_t fullChunks = repeats / 62 + run / 62; fullChunks > 0; --fullChunks)
+            {
+                *o++ = QOI_OP_RUN | (62 - 1);
+            }
+            run %= 62;
+            continue;
+        }
+
+        if (run > 0)
+        {
+            *o++ = static_cast<uint8_t>(QOI_OP_RUN | (run - 1));
+            run = 0;
+        }
+
+        if (word == PixelToWord(seenPixels[hash]))
+        {
+            *o++ = static_cast<uint8_t>(hash);
+        }
+        else if ((NumChannels == 4) && (pixel.alpha != prevPixel.alpha))
+        {
+            o[0] = QOI_OP_RGBA;
+            std::memcpy(o + 1, &pixel, 4);
+            o += 5;
+        }
+        else
+        {
+            int32_t dr = static_cast<int32_t>(pixel.red) - static_cast<int32_t>(prevPixel.red);
+            int32_t dg = static_cast<int32_t>(pixel.green) - static_cast<int32_t>(prevPixel.green);
+            int32_t db = static_cast<int32_t>(pixel.blue) - static_cast<int32_t>(prevPixel.blue);
+            int32_t dr_dg = dr - dg;
+            int32_t db_dg = db - dg;
+            if ((-2 <= dr && dr <= 1) && (-2 <= dg && dg <= 1) && (-2 <= db && db <= 1))
+            {
+                uint8_t chunk = QOI_OP_DIFF;
+                chunk |= (dr + 2) << 4;
+                chunk |= (dg + 2) << 2;
+                chunk |= (db + 2);
+                *o++ = chunk;
+                ++numSmallChunks;
+            }
+            else if ((-32 <= dg && dg <= 31) && (-8 <= dr_dg && dr_dg <= 7) && (-8 <= db_dg && db_dg <= 7))
+            {
+                uint8_t chunk0 = QOI_OP_LUMA;
+                chunk0 |= (dg + 32);
+
+                uint8_t chunk1 = 0;
+                chunk1 |= (dr_dg + 8) << 4;
+                chunk1 |= (db_dg + 8);
+
+                o[0] = chunk0;
+                o[1] = chunk1;
+                o += 2;
+                ++numSmallChunks;
+            }
+            else
+            {
+                o[0] = QOI_OP_RGB;
+                o[1] = pixel.red;
+                o[2] = pixel.green;
+                o[3] = pixel.blue;
+                o += 4;
+            }
+        }
+
+        seenPixels[hash] = pixel;
+        prevPixel = pixel;
+        prevWord = word;
+    }
+
+    state.prevPixel = prevPixel;
+    state.run = run;
+    smallChunks += numSmallChunks;
+    out = o;
+    return in;
+}
+
+/**
+ * @brief Encodes a block of pixels to QOI chunks, classifying all of them ahead of time so that only runs and the
+ *        array of seen colors are left to handle one pixel at a time. Stops at the end of the block, or of the run that
+ *        goes on past it.
+ * @tparam NumChannels Number of channels per pixel (3 or 4)
+ * @param[in] in Pointer to the first pixel
+ * @param[in] blockSize Number of pixels in the block, at most PIXEL_BLOCK_SIZE
+ * @param[in] pixelsEnd Pointer past the last pixel, which runs can go on to
+ * @param[in] countRepeats Function that counts repeated pixels
+ * @param[in] classifyBlock Function that classifies the block
+ * @param[in] block Scratch space for the block
+ * @param[in] state Encoder state, updated as the pixels are encoded
+ * @param[in] smallChunks Number of DIFF and LUMA chunks, increased by the ones written
+ * @param[in] out Pointer to where the chunks will be written. Must have room for 8 bytes per chunk written.
+ * @return Pointer past the last pixel encoded
+ */
+template <uint8_t NumChannels>
+inline const uint8_t *EncodeBlockClassified(const uint8_t *in, size_t blockSize, const uint8_t *pixelsEnd, RepeatCounter countRepeats, BlockClassifier classifyBlock, PixelBlock &block, EncoderState &state, size_t &smallChunks, uint8_t *&out)
+{
+    block.words[0] = PixelToWord(state.prevPixel);
+    if (NumChannels == 4)
+    {
+        std::memcpy(block.words + 1, in, blockSize * 4);
+    }
+    else
+    {
+        for (size_t i = 0; i < blockSize; ++i)
+        {
+            block.words[i + 1] = PixelToWord(LoadPixel<NumChannels>(in + i * NumChannels));
+        }
+    }
+    classifyBlock(block, blockSize);
+
+    uint32_t run = state.run;
+    std::array<Pixel, 64> &seenPixels = state.seenPixels;
+    size_t numSmallChunks = 0;
+    uint8_t *o = out;
+
+    size_t i = 0;
+    while (i < blockSize)
+    {
+        const uint32_t word = block.words[i + 1];
+        const uint32_t hash = block.hashes[i];
+        const size_t chunkSize = block.chunkSizes[i];
+        if (chunkSize == 0)
+        {
+            std::memcpy(&seenPixels[hash], &word, 4);
+
+            // The block already tells how long the run is, unless it reaches the end of it
+            size_t repeats = 1;
+            while ((i + repeats < blockSize) && (block.chunkSizes[i + repeats] == 0))
+            {
+                ++repeats;
+            }
+            if (i + repeats == blockSize)
+            {
+                const uint8_t *after = in + blockSize * NumChannels;
+                Pixel color;
+                std::memcpy(&color, &word, 4);
+                repeats += countRepeats(after, (pixelsEnd - after) / NumChannels, color);
+            }
+            i += repeats;
+            run += static_cast<uint32_t>(repeats % 62);
+            for (size_t fullChunks = repeats / 62 + run / 62; fullChunks > 0; --fullChunks)
+            {
+                *o++ = QOI_OP_RUN | (62 - 1);
+            }
+            run %= 62;
+            continue;
+        }
+
+        if (run > 0)
+        {
+            *o++ = static_cast<uint8_t>(QOI_OP_RUN | (run - 1));
+            run = 0;
+        }
+
+        if (word == PixelToWord(seenPixels[hash]))
+        {
+            *o++ = static_cast<uint8_t>(hash);
+        }
+        else
+        {
+            // All 8 bytes of the chunk at once, so that there is no branch on its kind
+            std::memcpy(o, &block.chunks[i], sizeof(uint64_t));
+            o += chunkSize;
+            numSmallChunks += (chunkSize <= 2);
+        }
+
+        std::memcpy(&seenPixels[hash], &word, 4);
+        ++i;
+    }
+
+    // Every pixel up to the end of the block, and of the run that may go on past it, has been encoded
+    const uint32_t lastWord = block.words[std::min(i, blockSize)];
+    std::memcpy(&state.prevPixel, &lastWord, 4);
+    state.run = run;
+    smallChunks += numSmallChunks;
+    out = o;
+    return in + i * NumChannels;
+}
+
+/**
+ * @brief Encodes the specified pixels to QOI chunks. A run that is still going at the last pixel is left in the state.
+ *        Photos mix DIFF, LUMA and RGB chunks at random, which makes choosing between them one pixel at a time
+ *        mispredict a lot. So where the last block of pixels had many of those, the next one is classified ahead of
+ *        time. Everywhere else the choices are easy to predict, and classifying ahead of time would only be extra work.
+ * @tparam NumChannels Number of channels per pixel (3 or 4)
+ * @param[in] pixels Pointer to the first pixel
+ * @param[in] pixelCount Number of pixels to encode
+ * @param[in] state Encoder state, updated as the pixels are encoded
+ * @param[in] out Pointer to where the chunks will be written. Must have room for pixelCount * (NumChannels + 1) bytes.
+ * @return Pointer past the last byte written
+ */
+template <uint8_t NumChannels>
+inline uint8_t *EncodePixels(const uint8_t *pixels, size_t pixelCount, EncoderState &state, uint8_t *out)
+{
+    const RepeatCounter countRepeats = GetRepeatCounter<NumChannels>();
+    const BlockClassifier classifyBlock = GetBlockClassifier();
+    PixelBlock block;
+
+    // A block is classified when at least this many of the chunks in the last one were DIFF or LUMA
+    const size_t MIXED_BLOCK = PIXEL_BLOCK_SIZE / 4;
+    size_t smallChunks = 0;
+
+    // Classified blocks write 8 bytes per chunk, so the last few pixels always go one at a time
+    const uint8_t *in = pixels;
+    const uint8_t *pixelsEnd = pixels + pixelCount * NumChannels;
+    const uint8_t *classifiedEnd = pixels + ((pixelCount > PIXEL_BLOCK_SIZE) ? (pixelCount - PIXEL_BLOCK_SIZE) * NumChannels : 0);
+    while (in < pixelsEnd)
+    {
+        const bool isMixed = (smallChunks >= MIXED_BLOCK);
+        smallChunks = 0;
+        if (isMixed && (classifyBlock != nullptr) && (in < classifiedEnd))
+        {
+            in = EncodeBlockClassified<NumChannels>(in, PIXEL_BLOCK_SIZE, pixelsEnd, countRepeats, classifyBlock, block, state, smallChunks, out);
+        }
+        else
+        {
+            const uint8_t *blockEnd = in + std::min<size_t>(PIXEL_BLOCK_SIZE, (pixelsEnd - in) / NumChannels) * NumChannels;
+            in = EncodeBlockDirect<NumChannels>(in, blockEnd, pixelsEnd, countRepeats, state, smallChunks, out);
+        }
+    }
+    return out;
+}
+
+/**
+ * @brief Encodes the specified pixels to QOI chunks, picking the kernel for the number of channels once for all of them.
+ * @param[in] pixels Pointer to the first pixel
+ * @param[in] pixelCount Number of pixels to encode
+ * @param[in] numChannels Number of channels per pixel (3 or 4)
+ * @param[in] state Encoder state, updated as the pixels are encoded
+ * @param[in] out Pointer to where the chunks will be written. Must have room for pixelCount * (numChannels + 1) bytes.
+ * @return Pointer past the last byte written
+ */
+inline uint8_t *EncodePixels(const uint8_t *pixels, size_t pixelCount, uint8_t numChannels, EncoderState &state, uint8_t *out)
+{
+    if (numChannels == 4)
+    {
+        return EncodePixels<4>(pixels, pixelCount, state, out);
+    }
+    return EncodePixels<3>(pixels, pixelCount, state, out);
+}
+
+/**
+ * @brief Encodes the specified rows of pixels to QOI chunks. Rows without padding between them are encoded in one go,
+ *        padded rows one at a time, with the state carried from each row to the next.
+ * @param[in] pixels Pointer to the first pixel of the first row
+ * @param[in] stride Distance in bytes between the starts of two consecutive rows
+ * @param[in] imageWidth Number of pixels per row
+ * @param[in] numRows Number of rows to encode
+ * @param[in] numChannels Number of channels per pixel (3 or 4)
+ * @param[in] state Encoder state, updated as the pixels are encoded
+ * @param[in] out Pointer to where the chunks will be written. Must have room for imageWidth * numRows * (numChannels + 1) bytes.
+ * @return Pointer past the last byte written
+ */
+inline uint8_t *EncodeRows(const uint8_t *pixels, size_t stride, uint32_t imageWidth, uint32_t numRows, uint8_t numChannels, EncoderState &state, uint8_t *out)
+{
+    if (stride == static_cast<size_t>(imageWidth) * numChannels)
+    {
+        return EncodePixels(pixels, static_cast<size_t>(imageWidth) * numRows, numChannels, state, out);
+    }
+
+    for (uint32_t row = 0; row < numRows; ++row)
+    {
+        out = EncodePixels(pixels + row * stride, imageWidth, numChannels, state, out);
+    }
+    return out;
+}
+
+/**
+ * @brief Writes the 14-byte QOI header through the specified pointer
+ * @param[in] imageWidth Image width
+ * @param[in] imageHeight Image height
+ * @param[in] numChannels Number of channels in the image
+ * @param[in] colorSpace Color space of the image
+ * @param[in] out Pointer to where the header will be written
+ * @return Pointer past the last byte written
+ */
+inline uint8_t *WriteHeader(uint32_t imageWidth, uint32_t imageHeight, uint8_t numChannels, uint8_t colorSpace, uint8_t *out)
+{
+    out[0] = 'q';
+    out[1] = 'o';
+    out[2] = 'i';
+    out[3] = 'f';
+    out = WriteBytes(imageWidth, out + 4);
+    out = WriteBytes(imageHeight, out);
+    out[0] = numChannels;
+    out[1] = colorSpace;
+    return out + 2;
+}
+
+/**
+ * @brief Writes the 8-byte QOI end marker through the specified pointer
+ * @param[in] out Pointer to where the end marker will be written
+ * @return Pointer past the last byte written
+ */
+inline uint8_t *WriteEndMarker(uint8_t *out)
+{
+    static const uint8_t END_MARKER[8] = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01 };
+    std::memcpy(out, END_MARKER, sizeof(END_MARKER));
+    return out + sizeof(END_MARKER);
+}
+
+/**
+ * @brief Encodes a whole image to QOI format through a pointer into a buffer that was already sized for the worst case
+ * @param[in] pixels Pointer to the first pixel of the image
+ * @param[in] stride Distance in bytes between the starts of two consecutive rows
+ * @param[in] imageWidth Image width
+ * @param[in] imageHeight Image height
+ * @param[in] numChannels Number of channels in the image
+ * @param[in] colorSpace Color space of the image
+ * @param[in] out Pointer to a buffer with room for at least MaxEncodedSize(imageWidth, imageHeight, numChannels) bytes
+ * @return Pointer past the last byte written
+ */
+inline uint8_t *EncodeImage(const uint8_t *pixels, size_t stride, uint32_t imageWidth, uint32_t imageHeight, uint8_t numChannels, uint8_t colorSpace, uint8_t *out)
+{
+    // --- Header ---
+    out = WriteHeader(imageWidth, imageHeight, numChannels, colorSpace, out);
+
+    // --- Data ---
+    EncoderState state;
+    out = EncodeRows(pixels, stride, imageWidth, imageHeight, numChannels, state, out);
+    out = FlushRun(state, out);
+
+    // --- End marker ---
+    return WriteEndMarker(out);
+}
+
+#ifdef QOI_HAVE_POSIX_IO
+/**
+ * How FileWriter makes the finished file visible, as set by the caller
+ */
+struct WriteOptions
+{
+    /**
+     * @brief Constructor. The defaults write the file in place and leave flushing it to the kernel.
+     * @param[in] isAtomic Flag indicating whether to write to a temporary file next to the output and rename it over the output at the end
+     * @param[in] isSynced Flag indicating whether to flush the file (and with isAtomic, the rename) to the storage device before returning
+     */
+    explicit WriteOptions(bool isAtomic = false, bool isSynced = false)
+        : isAtomic(isAtomic)
+        , isSynced(isSynced)
+    {
+    }
+
+    /**
+     * Flag indicating whether readers see either the old file or the whole new one, never a partly written one
+     */
+    bool isAtomic;
+
+    /**
+     * Flag indicating whether the file is on the storage device, so that it survives a crash, once Commit() returns
+     */
+    bool isSynced;
+};
+
+/**
+ * Class for writing a file straight to its file descriptor, with an error number for anything that goes wrong.
+ *
+ * The file is preallocated for the size the caller expects at most, so running out of space is found out before
+ * anything is written and the file does not fragment as it grows, and it is truncated to what was written at the end.
+ * Small writes are gathered in a buffer, and a large write goes out together with the buffer in one pwritev().
+ * The output is removed again if the writer is destroyed without Commit(), so a failed write leaves nothing behind.
+ */
+class FileWriter
+{
+public:
+    FileWriter()
+        : m_fd(-1)
+        , m_offset(0)
+        , m_bufferSize(0)
+        , m_isRegular(false)
+        , m_isSynced(false)
+    {
+    }
+
+    FileWriter(const FileWriter &) = delete;
+    FileWriter &operator=(const FileWriter &) = delete;
+
+    ~FileWriter()
+    {
+        Abort();
+    }
+
+    /**
+     * @brief Creates the output file, or with WriteOptions::isAtomic a temporary file next to it.
+     * @param[in] filePath Path to the output file
+     * @param[in] reserveSize Largest number of bytes that will be written, to preallocate, or 0 to not preallocate
+     * @param[in] options How the finished file is made visible
+     * @return 0 on success, otherwise the error number (as in errno) of the call that failed
+     */
+    int Open(const std::string &filePath, uint64_t reserveSize = 0, const WriteOptions &options = WriteOptions())
+    {
+        Abort();
+        m_filePath = filePath;
+        m_isSynced = options.isSynced;
+
+        if (options.isAtomic)
+        {
+            // Unique within the process by the counter, and across processes by the pid
+            static std::atomic<uint32_t> tempCounter(0);
+            for (int attempt = 0; (m_fd < 0) && (attempt < 100); ++attempt)
+            {
+                m_tempFilePath = filePath + ".tmp" + std::to_string(getpid()) + "." + std::to_string(tempCounter++);
+                m_fd = open(m_tempFilePath.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+                if ((m_fd < 0) && (errno != EEXIST))
+                {
+                    break;
+                }
+            }
+        }
+        else
+        {
+            m_fd = open(filePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        }
+        if (m_fd < 0)
+        {
+            int error = errno;
+            m_tempFilePath.clear();
+            m_filePath.clear();
+            return error;
+        }
+
+        // Devices and pipes are neither preallocated nor truncated
+        struct stat fileStatus;
+        m_isRegular = (fstat(m_fd, &fileStatus) == 0) && S_ISREG(fileStatus.st_mode);
+
+#ifdef __linux__
+        // File systems that cannot preallocate just grow the file as it is written
+        if (m_isRegular && (reserveSize > 0) && (reserveSize <= static_cast<uint64_t>(std::numeric_limits<off_t>::max())) &&
+            (fallocate(m_fd, 0, 0, static_cast<off_t>(reserveSize)) != 0) && (errno != EOPNOTSUPP) && (errno != ENOSYS))
+        {
+            int error = errno;
+            Abort();
+            return error;
+        }
+#else
+        (void)reserveSize;
+#endif
+        return 0;
+    }
+
+    /**
+     * @brief Appends the specified bytes to the file.
+     * @param[in] data Pointer to the bytes
+     * @param[in] size Number of bytes
+     * @return 0 on success, otherwise the error number of the write that failed
+     */
+    int Write(const uint8_t *data, size_t size)
+    {
+        if (m_fd < 0)
+        {
+            return EBADF;
+        }
+        if (size <= BUFFER_SIZE - m_bufferSize)
+        {
+            if (!m_buffer)
+            {
+                m_buffer.reset(new uint8_t[BUFFER_SIZE]);
+            }
+            std::memcpy(m_buffer.get() + m_bufferSize, data, size);
+            m_bufferSize += size;
+            return 0;
+        }
+
+        struct iovec pieces[2] = { { m_buffer.get(), m_bufferSize }, { const_cast<uint8_t *>(data), size } };
+        int error = WritePieces((m_bufferSize > 0) ? pieces : pieces + 1, (m_bufferSize > 0) ? 2 : 1);
+        m_bufferSize = 0;
+        return error;
+    }
+
+    /**
+     * @brief Writes what is left in the buffer, truncates the file to what was written, flushes it if asked to,
+     *        closes it, and with WriteOptions::isAtomic renames it over the output file.
+     * @return 0 on success, otherwise the error number of the call that failed. The output is removed then.
+     */
+    int Commit()
+    {
+        if (m_fd < 0)
+        {
+            return EBADF;
+        }
+
+        int error = 0;
+        if (m_bufferSize > 0)
+        {
+            struct iovec piece = { m_buffer.get(), m_bufferSize };
+            error = WritePieces(&piece, 1);
+            m_bufferSize = 0;
+        }
+        if ((error == 0) && m_isRegular && (ftruncate(m_fd, static_cast<off_t>(m_offset)) != 0))
+        {
+            error = errno;
+        }
+        if ((error == 0) && m_isSynced && (fsync(m_fd) != 0))
+        {
+            error = errno;
+        }
+
+        // close() reports errors of writes that the kernel deferred, e.g. on network file systems
+        int fd = m_fd;
+        m_fd = -1;
+        if ((close(fd) != 0) && (error == 0) && (errno != EINTR))
+        {
+            error = errno;
+        }
+        if ((error == 0) && !m_tempFilePath.empty() && (std::rename(m_tempFilePath.c_str(), m_filePath.c_str()) != 0))
+        {
+            error = errno;
+        }
+        if (error != 0)
+        {
+            Abort();
+            return error;
+        }
+
+        // The rename is only on the storage device once the directory that holds the file is
+        if (!m_tempFilePath.empty() && m_isSynced)
+        {
+            error = SyncDirectory(m_filePath);
+        }
+        m_tempFilePath.clear();
+        m_filePath.clear();
+        return error;
+    }
+
+    /**
+     * @brief Closes the file and removes what was written, unless Commit() succeeded. Called by the destructor.
+     *        Only the temporary file or a regular output file is removed, never a device such as /dev/null.
+     */
+    void Abort()
+    {
+        if (m_fd >= 0)
+        {
+            close(m_fd);
+            m_fd = -1;
+        }
+        if (!m_tempFilePath.empty())
+        {
+            unlink(m_tempFilePath.c_str());
+        }
+        else if (!m_filePath.empty() && m_isRegular)
+        {
+            unlink(m_filePath.c_str());
+        }
+        m_tempFilePath.clear();
+        m_filePath.clear();
+        m_offset = 0;
+        m_bufferSize = 0;
+        m_isRegular = false;
+    }
+
+    /**
+     * @brief Flushes the directory that holds the specified file to the storage device, which makes a rename in it durable.
+     * @param[in] filePath Path to the file
+     * @return 0 on success, otherwise the error number of the call that failed
+     */
+    static int SyncDirectory(const std::string &filePath)
+    {
+        size_t slash = filePath.find_last_of('/');
+        std::string directory = (slash == std::string::npos) ? "." : (slash == 0) ? "/" : filePath.substr(0, slash);
+        int fd = open(directory.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            return errno;
+        }
+        int error = (fsync(fd) != 0) ? errno : 0;
+        close(fd);
+        return error;
+    }
+
+private:
+    /**
+     * @brief Writes the specified pieces at the end of what was written so far, continuing after partial writes.
+     * @param[in] pieces Array of pieces, which is changed as they are written
+     * @param[in] numPieces Number of pieces
+     * @return 0 on success, otherwise the error number of the write that failed
+     */
+    int WritePieces(struct iovec *pieces, int numPieces)
+    {
+        while (numPieces > 0)
+        {
+            // Pipes and terminals cannot seek, so they are written at their current position
+#ifdef __linux__
+            ssize_t written = m_isRegular ? pwritev(m_fd, pieces, numPieces, static_cast<off_t>(m_offset)) : writev(m_fd, pieces, numPieces);
+#else
+            ssize_t written = m_isRegular ? pwrite(m_fd, pieces->iov_base, pieces->iov_len, static_cast<off_t>(m_offset)) : writev(m_fd, pieces, numPieces);
+#endif
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return errno;
+            }
+            m_offset += static_cast<uint64_t>(written);
+
+            size_t remaining = static_cast<size_t>(written);
+            while ((numPieces > 0) && (remaining >= pieces->iov_len))
+            {
+                remaining -= pieces->iov_len;
+                ++pieces;
+                --numPieces;
+            }
+            if (numPieces > 0)
+            {
+                pieces->iov_base = static_cast<uint8_t *>(pieces->iov_base) + remaining;
+                pieces->iov_len -= remaining;
+            }
+        }
+        return 0;
+    }
+
+private:
+    /**
+     * Size of the buffer that small writes are gathered in
+     */
+    static const size_t BUFFER_SIZE = 1 << 20;
+
+    /**
+     * File descriptor, or -1 if no file is open
+     */
+    int m_fd;
+
+    /**
+     * Path to the output file, and to the temporary file with WriteOptions::isAtomic
+     */
+    std::string m_filePath;
+    std::string m_tempFilePath;
+
+    /**
+     * Number of bytes written to the file so far
+     */
+    uint64_t m_offset;
+
+    /**
+     * Bytes that were not written to the file yet
+     */
+    std::unique_ptr<uint8_t[]> m_buffer;
+    size_t m_bufferSize;
+
+    /**
+     * Flag indicating whether the file is a regular file, which is preallocated and truncated
+     */
+    bool m_isRegular;
+
+    /**
+     * Flag indicating whether Commit() flushes the file to the storage device
+     */
+    bool m_isSynced;
+};
+#endif // QOI_HAVE_POSIX_IO
+
+/**
+ * @brief Encodes the pixels in the specified buffer to QOI format, and stores the result in an array of bytes.
+ *        The pixels are read where they are, so a buffer that another library allocated needs no copy.
+ * @param[in] pixels Pointer to the first pixel of the first row
+ * @param[in] numBytes Size of the buffer in bytes
+ * @param[in] stride Distance in bytes between the starts of two consecutive rows, or 0 if the rows are tightly packed
+ * @param[in] imageWidth Image width
+ * @param[in] imageHeight Image height
+ * @param[in] numChannels Number of channels in the image
+ * @param[in] colorSpace Color space of the image
+ * @param[out] outBytes Array of bytes where the resulting bytes will be stored
+ */
+inline bool Encode(const uint8_t *pixels, size_t numBytes, size_t stride, const uint32_t &imageWidth, const uint32_t &imageHeight, const uint8_t &numChannels, const uint8_t &colorSpace, std::vector<uint8_t> &outBytes)
+{
+    size_t startOffset = outBytes.size();
+    const uint64_t maxSize = MaxEncodedSize(imageWidth, imageHeight, numChannels);
+    if (!HasAllPixels(numBytes, stride, imageWidth, imageHeight, numChannels) || !IsAddressable(maxSize, startOffset))
+    {
+        return false;
+    }
+
+    // Size the output for the worst case up front, so that the encoder writes
+    // through a pointer and the vector is allocated exactly once.
+    outBytes.resize(startOffset + static_cast<size_t>(maxSize));
+
+    const size_t rowStride = (stride != 0) ? stride : static_cast<size_t>(imageWidth) * numChannels;
+    uint8_t *out = EncodeImage(pixels, rowStride, imageWidth, imageHeight, numChannels, colorSpace, outBytes.data() + startOffset);
+    outBytes.resize(out - outBytes.data());
+
+    return true;
+}
+
+#ifdef QOI_HAVE_POSIX_IO
+/**
+ * @brief Encodes the pixels in the specified buffer to a QOI image file through a FileWriter, reading them where they are.
+ *        The file is created and preallocated for the worst case before anything is encoded, so that a bad path or
+ *        a full disk fails fast, and it is truncated to the encoded size at the end.
+ * @param[in] pixels Pointer to the first pixel of the first row
+ * @param[in] numBytes Size of the buffer in bytes
+ * @param[in] stride Distance in bytes between the starts of two consecutive rows, or 0 if the rows are tightly packed
+ * @param[in] imageWidth Image width
+ * @param[in] imageHeight Image height
+ * @param[in] numChannels Number of channels in the image
+ * @param[in] colorSpace Color space of the image
+ * @param[in] outputFilePath File path of the output image file
+ * @param[in] options How the finished file is made visible
+ * @param[out] outErrno 0 on success, EINVAL if the pixels do not make up the image, otherwise the error number of the call that failed
+ * @return Flag indicating whether the whole file was written.
+ */
+inline bool Encode(const uint8_t *pixels, size_t numBytes, size_t stride, const uint32_t &imageWidth, const uint32_t &imageHeight, const uint8_t &numChannels, const uint8_t &colorSpace, const std::string &outputFilePath, const WriteOptions &options, int &outErrno)
+{
+    const uint64_t maxSize = MaxEncodedSize(imageWidth, imageHeight, numChannels);
+    if (!HasAllPixels(numBytes, stride, imageWidth, imageHeight, numChannels) || !IsAddressable(maxSize, 0))
+    {
+        outErrno = EINVAL;
+        return false;
+    }
+
+    FileWriter writer;
+    outErrno = writer.Open(outputFilePath, maxSize, options);
+    if (outErrno != 0)
+    {
+        return false;
+    }
+
+    // The buffer only lives until it's written out, so skip the zero-fill that a vector would do
+    std::unique_ptr<uint8_t[]> bytesToWrite(new uint8_t[static_cast<size_t>(maxSize)]);
+    const size_t rowStride = (stride != 0) ? stride : static_cast<size_t>(imageWidth) * numChannels;
+    uint8_t *end = EncodeImage(pixels, rowStride, imageWidth, imageHeight, numChannels, colorSpace, bytesToWrite.get());
+
+    outErrno = writer.Write(bytesToWrite.get(), end - bytesToWrite.get());
+    if (outErrno == 0)
+    {
+        outErrno = writer.Commit();
+    }
+    return outErrno == 0;
+}
+#endif // QOI_HAVE_POSIX_IO
+
+/**
+ * @brief Encodes the pixels in the specified buffer to a QOI image file, reading them where they are.
+ * @param[in] pixels Pointer to the first pixel of the first row
+ * @param[in] numBytes Size of the buffer in bytes
+ * @param[in] stride Distance in bytes between the starts of two consecutive rows, or 0 if the rows are tightly packed
+ * @param[in] imageWidth Image width
+ * @param[in] imageHeight Image height
+ * @param[in] numChannels Number of channels in the image
+ * @param[in] colorSpace Color space of the image
+ * @param[in] outputFilePath File path of the output image file
+ * @return Flag indicating whether the whole file was written.
+ */
+inline bool Encode(const uint8_t *pixels, size_t numBytes, size_t stride, const uint32_t &imageWidth, const uint32_t &imageHeight, const uint8_t &numChannels, const uint8_t &colorSpace, const std::string &outputFilePath)
+{
+#ifdef QOI_HAVE_POSIX_IO
+    int error = 0;
+    return Encode(pixels, numBytes, stride, imageWidth, imageHeight, numChannels, colorSpace, outputFilePath, WriteOptions(), error);
+#else
+    const uint64_t maxSize = MaxEncodedSize(imageWidth, imageHeight, numChannels);
+    if (!HasAllPixels(numBytes, stride, imageWidth, imageHeight, numChannels) || !IsAddressable(maxSize, 0))
+    {
+        return false;
+    }
+
+    // The buffer only lives until it's written out, so skip the zero-fill that a vector would do
+    std::unique_ptr<uint8_t[]> bytesToWrite(new uint8_t[static_cast<size_t>(maxSize)]);
+    const size_t rowStride = (stride != 0) ? stride : static_cast<size_t>(imageWidth) * numChannels;
+    uint8_t *end = EncodeImage(pixels, rowStride, imageWidth, imageHeight, numChannels, colorSpace, bytesToWrite.get());
+
+    std::ofstream file(outputFilePath, std::ios::binary);
+    file.write(reinterpret_cast<char*>(bytesToWrite.get()), end - bytesToWrite.get());
+    file.close();
+    return !file.fail();
+#endif
+}
+
+/**
+ * @brief Encodes the specified array of pixel colors to QOI format, and stores the result in an array of bytes
+ * @param[in] inPixelColors Array of pixel colors
+ * @param[in] imageWidth Image width
+ * @param[in] imageHeight Image height
+ * @param[in] numChannels Number of channels in the image
+ * @param[in] colorSpace Color space of the image
+ * @param[out] outBytes Array of bytes where the resulting bytes will be stored
+ */
+inline bool Encode(const std::vector<uint8_t> &inPixelColors, const uint32_t &imageWidth, const uint32_t &imageHeight, const uint8_t &numChannels, const uint8_t &colorSpace, std::vector<uint8_t> &outBytes)
+{
+    return Encode(inPixelColors.data(), inPixelColors.size(), 0, imageWidth, imageHeight, numChannels, colorSpace, outBytes);
+}
+
+/**
+ * @brief Encodes the specified array of pixel colors to a QOI image file
+ * @param[in] inPixelColors Array of pixel colors
+ * @param[in] imageWidth Image width
+ * @param[in] imageHeight Image height
+ * @param[in] numChannels Number of channels in the image
+ * @param[in] colorSpace Color space of the image
+ * @param[in] outputFilePath File path of the output image file
+ */
+inline bool Encode(const std::vector<uint8_t> &inPixelColors, const uint32_t &imageWidth, const uint32_t &imageHeight, const uint8_t &numChannels, const uint8_t &colorSpace, const std::string &outputFilePath)
+{
+    return Encode(inPixelColors.data(), inPixelColors.size(), 0, imageWidth, imageHeight, numChannels, colorSpace, outputFilePath);
+}
+
+/**
+ * @brief Encodes one stripe of a striped image so that it can be decoded without the stripes before it.
+ *
+ * The first pixel is written as a literal, so it doesn't depend on the previous pixel. The array of
+ * previously seen pixels starts out with colors that can never match the slot they're in, so a
+ * QOI_OP_INDEX is only written for slots that this stripe filled itself. A decoder that runs through
+ * all stripes in order ends up with the same pixels as one that starts fresh at this stripe.
+ *
+ * @tparam NumChannels Number of channels per pixel (3 or 4)
+ * @param[in] pixels Pointer to the first pixel of the stripe
+ * @param[in] stride Distance in bytes between the starts of two consecutive rows
+ * @param[in] imageWidth Number of pixels per row
+ * @param[in] numRows Number of rows in the stripe
+ * @param[in] out Pointer to where the chunks will be written. Must have room for imageWidth * numRows * (NumChannels + 1) bytes.
+ * @return Pointer past the last byte written
+ */
+template <uint8_t NumChannels>
+inline uint8_t *EncodeIndependentStripe(const uint8_t *pixels, size_t stride, uint32_t imageWidth, uint32_t numRows, uint8_t *out)
+{
+    if ((imageWidth == 0) || (numRows == 0))
+    {
+        return out;
+    }
+
+    // Every slot already holds (0, 0, 0, 0), which hashes to slot 0, so only slot 0 needs
+    // another color. (0, 0, 0, 255) hashes to slot 53.
+    EncoderState state;
+    state.seenPixels[0] = { 0, 0, 0, 255 };
+
+    Pixel firstPixel = LoadPixel<NumChannels>(pixels);
+    if (NumChannels == 4)
+    {
+        out[0] = QOI_OP_RGBA;
+        std::memcpy(out + 1, &firstPixel, 4);
+        out += 5;
+    }
+    else
+    {
+        out[0] = QOI_OP_RGB;
+        out[1] = firstPixel.red;
+        out[2] = firstPixel.green;
+        out[3] = firstPixel.blue;
+        out += 4;
+    }
+    state.prevPixel = firstPixel;
+    state.seenPixels[ColorHash(firstPixel)] = firstPixel;
+
+    out = EncodePixels<NumChannels>(pixels + NumChannels, imageWidth - 1, state, out);
+    out = EncodeRows(pixels + stride, stride, imageWidth, numRows - 1, NumChannels, state, out);
+    return FlushRun(state, out);
+}
+
+/**
+ * @brief Encodes the specified array of pixel colors to a striped QOI image, encoding the stripes on separate threads.
+ *
+ * The image is split into horizontal stripes that can each be decoded on their own, and a table of where
+ * each stripe starts is appended after the end marker (see QOI_STRIPE_TABLE). The result is still a valid
+ * QOI image that any decoder can read from start to end, but decoders that know about the table can decode
+ * the stripes in parallel too. Compression is slightly worse than Encode(), since every stripe starts over.
+ *
+ * @param[in] pixels Pointer to the first pixel of the first row
+ * @param[in] numBytes Size of the buffer in bytes
+ * @param[in] stride Distance in bytes between the starts of two consecutive rows, or 0 if the rows are tightly packed
+ * @param[in] imageWidth Image width
+ * @param[in] imageHeight Image height
+ * @param[in] numChannels Number of channels in the image
+ * @param[in] colorSpace Color space of the image
+ * @param[in] stripeRows Number of rows per stripe. The last stripe may have fewer.
+ * @param[in] numThreads Number of threads to encode on, or 0 to use one per hardware thread
+ * @param[out] outBytes Array of bytes where the resulting bytes will be stored
+ */
+inline bool EncodeStriped(const uint8_t *pixels, size_t numBytes, size_t stride, const uint32_t &imageWidth, const uint32_t &imageHeight, const uint8_t &numChannels, const uint8_t &colorSpace, uint32_t stripeRows, size_t numThreads, std::vector<uint8_t> &outBytes)
+{
+    if (!HasAllPixels(numBytes, stride, imageWidth, imageHeight, numChannels) || (stripeRows == 0))
+    {
+        return false;
+    }
+    const size_t rowStride = (stride != 0) ? stride : static_cast<size_t>(imageWidth) * numChannels;
+
+    // No stripe has more rows than the image, however many rows per stripe were asked for
+    uint32_t stripeCount = std::max<uint32_t>(1, imageHeight / stripeRows + ((imageHeight % stripeRows) != 0 ? 1 : 0));
+    uint64_t stripePixels = static_cast<uint64_t>(imageWidth) * std::min(stripeRows, std::max<uint32_t>(1, imageHeight));
+    size_t maxStripeSize = static_cast<size_t>(stripePixels * (numChannels + 1));
+
+    // Every stripe is encoded at its worst-case position in one buffer, then moved down
+    // next to the previous one. That way the threads never have to wait for each other.
+    // The stripes add up to at most one stripe more than the image, so this cannot overflow where the image fits in memory.
+    size_t startOffset = outBytes.size();
+    uint64_t tableSize = static_cast<uint64_t>(stripeCount) * 8 + QOI_STRIPE_TABLE_FOOTER_SIZE;
+    uint64_t bufferSize = 14 + static_cast<uint64_t>(stripeCount) * stripePixels * (numChannels + 1) + 8 + tableSize;
+    if (!IsAddressable(bufferSize, startOffset))
+    {
+        return false;
+    }
+    outBytes.resize(startOffset + static_cast<size_t>(bufferSize));
+    uint8_t *base = outBytes.data() + startOffset;
+    uint8_t *stripesBase = WriteHeader(imageWidth, imageHeight, numChannels, colorSpace, base);
+
+    std::vector<size_t> stripeSizes(stripeCount);
+    std::atomic<uint32_t> nextStripe(0);
+    auto encodeStripes = [&]()
+    {
+        for (uint32_t stripe = nextStripe++; stripe < stripeCount; stripe = nextStripe++)
+        {
+            uint32_t firstRow = stripe * stripeRows;
+            uint32_t rows = std::min(stripeRows, imageHeight - firstRow);
+            const uint8_t *stripePixels = pixels + firstRow * rowStride;
+            uint8_t *stripeStart = stripesBase + stripe * maxStripeSize;
+
+            uint8_t *stripeEnd = stripeStart;
+            if (stripe == 0)
+            {
+                // The first stripe starts from the same state as a plain image anyway
+                EncoderState state;
+                stripeEnd = EncodeRows(stripePixels, rowStride, imageWidth, rows, numChannels, state, stripeStart);
+                stripeEnd = FlushRun(state, stripeEnd);
+            }
+            else if (numChannels == 4)
+            {
+                stripeEnd = EncodeIndependentStripe<4>(stripePixels, rowStride, imageWidth, rows, stripeStart);
+            }
+            else
+            {
+                stripeEnd = EncodeIndependentStripe<3>(stripePixels, rowStride, imageWidth, rows, stripeStart);
+            }
+            stripeSizes[stripe] = stripeEnd - stripeStart;
+        }
+    };
+
+    if (numThreads == 0)
+    {
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < std::min<size_t>(numThreads, stripeCount); ++i)
+    {
+        threads.emplace_back(encodeStripes);
+    }
+    encodeStripes();
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+
+    // --- Data, packed ---
+    std::vector<uint64_t> stripeOffsets(stripeCount);
+    uint8_t *out = stripesBase;
+    for (uint32_t stripe = 0; stripe < stripeCount; ++stripe)
+    {
+        stripeOffsets[stripe] = out - base;
+        std::memmove(out, stripesBase + stripe * maxStripeSize, stripeSizes[stripe]);
+        out += stripeSizes[stripe];
+    }
+
+    // --- End marker ---
+    out = WriteEndMarker(out);
+
+    // --- Stripe table ---
+    for (uint64_t stripeOffset : stripeOffsets)
+    {
+        out = WriteBytes(static_cast<uint32_t>(stripeOffset >> 32), out);
+        out = WriteBytes(static_cast<uint32_t>(stripeOffset), out);
+    }
+    out = WriteBytes(stripeRows, out);
+    out = WriteBytes(stripeCount, out);
+    std::memcpy(out, QOI_STRIPE_TABLE_MAGIC, 4);
+    out += 4;
+
+    outBytes.resize(out - outBytes.data());
+    return true;
+}
+
+/**
+ * @brief Encodes the specified array of pixel colors to a striped QOI image, encoding the stripes on separate threads.
+ * @param[in] inPixelColors Array of pixel colors
+ * @param[in] imageWidth Image width
+ * @param[in] imageHeight Image height
+ * @param[in] numChannels Number of channels in the image
+ * @param[in] colorSpace Color space of the image
+ * @param[in] stripeRows Number of rows per stripe. The last stripe may have fewer.
+ * @param[in] numThreads Number of threads to encode on, or 0 to use one per hardware thread
+ * @param[out] outBytes Array of bytes where the resulting bytes will be stored
+ */
+inline bool EncodeStriped(const std::vector<uint8_t> &inPixelColors, const uint32_t &imageWidth, const uint32_t &imageHeight, const uint8_t &numChannels, const uint8_t &colorSpace, uint32_t stripeRows, size_t numThreads, std::vector<uint8_t> &outBytes)
+{
+    return EncodeStriped(inPixelColors.data(), inPixelColors.size(), 0, imageWidth, imageHeight, numChannels, colorSpace, stripeRows, numThreads, outBytes);
+}
+
+/**
+ * Class for encoding a QOI image from rows that are produced one after the other, writing the compressed bytes
+ * to a sink as it goes.
+ *
+ * The encoder state carries over from one row to the next, so the output is byte for byte what Encode() produces
+ * for the same image. Besides the state, it only keeps a buffer of roughly 64 KiB or a few rows, whichever is larger.
+ */
+class StreamEncoder
+{
+public:
+    /**
+     * Function that receives the compressed bytes. Returns false if the bytes could not be written.
+     */
+    typedef std::function<bool(const uint8_t *data, size_t size)> Sink;
+
+    /**
+     * @brief Constructor for writing to a callback
+     * @param[in] imageWidth Image width
+     * @param[in] imageHeight Image height
+     * @param[in] numChannels Number of channels in the image (3 or 4)
+     * @param[in] colorSpace Color space of the image
+     * @param[in] sink Function that receives the compressed bytes
+     */
+    StreamEncoder(uint32_t imageWidth, uint32_t imageHeight, uint8_t numChannels, uint8_t colorSpace, Sink sink)
+        : m_sink(sink)
+        , m_imageWidth(imageWidth)
+        , m_imageHeight(imageHeight)
+        , m_numChannels(numChannels)
+        , m_rowsEncoded(0)
+        , m_bufferSize(0)
+        , m_isFailed((numChannels != 3) && (numChannels != 4))
+        , m_isFinished(false)
+    {
+        const size_t MIN_BUFFER_SIZE = 64 * 1024;
+        m_buffer.resize(std::max(MIN_BUFFER_SIZE, GetMaxRowSize() + 22));
+        m_bufferSize = WriteHeader(imageWidth, imageHeight, numChannels, colorSpace, m_buffer.data()) - m_buffer.data();
+    }
+
+    /**
+     * @brief Constructor for writing to an output stream
+     * @param[in] imageWidth Image width
+     * @param[in] imageHeight Image height
+     * @param[in] numChannels Number of channels in the image (3 or 4)
+     * @param[in] colorSpace Color space of the image
+     * @param[in] stream Stream that receives the compressed bytes. Must outlive the encoder.
+     */
+    StreamEncoder(uint32_t imageWidth, uint32_t imageHeight, uint8_t numChannels, uint8_t colorSpace, std::ostream &stream)
+        : StreamEncoder(imageWidth, imageHeight, numChannels, colorSpace, [&stream](const uint8_t *data, size_t size)
+            {
+                stream.write(reinterpret_cast<const char *>(data), size);
+                return stream.good();
+            })
+    {
+    }
+
+#ifdef QOI_HAVE_POSIX_IO
+    /**
+     * @brief Constructor for writing to a file descriptor, such as a file, a pipe or a socket
+     * @param[in] imageWidth Image width
+     * @param[in] imageHeight Image height
+     * @param[in] numChannels Number of channels in the image (3 or 4)
+     * @param[in] colorSpace Color space of the image
+     * @param[in] fd File descriptor that receives the compressed bytes. It is not closed by the encoder.
+     */
+    StreamEncoder(uint32_t imageWidth, uint32_t imageHeight, uint8_t numChannels, uint8_t colorSpace, int fd)
+        : StreamEncoder(imageWidth, imageHeight, numChannels, colorSpace, [fd](const uint8_t *data, size_t size)
+            {
+                while (size > 0)
+                {
+                    ssize_t written = write(fd, data, size);
+                    if (written < 0)
+                    {
+                        if (errno == EINTR)
+                        {
+                            continue;
+                        }
+                        return false;
+                    }
+                    data += written;
+                    size -= static_cast<size_t>(written);
+                }
+                return true;
+            })
+    {
+    }
+#endif // QOI_HAVE_POSIX_IO
+
+    /**
+     * @brief Encodes the next rows of the image.
+     * @param[in] rows Pointer to the first pixel of the first row
+     * @param[in] numRows Number of rows
+     * @param[in] stride Distance in bytes between the starts of two consecutive rows, or 0 if the rows are tightly packed
+     * @return Flag indicating whether the rows were encoded and every full buffer was written to the sink.
+     */
+    bool PushRows(const uint8_t *rows, uint32_t numRows, size_t stride = 0)
+    {
+        const size_t rowSize = static_cast<size_t>(m_imageWidth) * m_numChannels;
+        if (stride == 0)
+        {
+            stride = rowSize;
+        }
+        if (m_isFailed || m_isFinished || (stride < rowSize) || (numRows > m_imageHeight - m_rowsEncoded))
+        {
+            return false;
+        }
+
+        for (uint32_t y = 0; y < numRows; ++y)
+        {
+            if ((m_buffer.size() - m_bufferSize < GetMaxRowSize()) && !Flush())
+            {
+                return false;
+            }
+
+            uint8_t *out = m_buffer.data() + m_bufferSize;
+            out = EncodePixels(rows + y * stride, m_imageWidth, m_numChannels, m_state, out);
+            m_bufferSize = out - m_buffer.data();
+        }
+
+        m_rowsEncoded += numRows;
+        return true;
+    }
+
+    /**
+     * @brief Writes the pending run and the end marker, and hands everything that is left to the sink.
+     *        Every row of the image has to be pushed first.
+     * @return Flag indicating whether the whole image was written.
+     */
+    bool Finish()
+    {
+        if (m_isFailed || m_isFinished || (m_rowsEncoded != m_imageHeight))
+        {
+            return false;
+        }
+
+        // The buffer always has room for a row, which is more than the run and the end marker
+        uint8_t *out = m_buffer.data() + m_bufferSize;
+        out = FlushRun(m_state, out);
+        out = WriteEndMarker(out);
+        m_bufferSize = out - m_buffer.data();
+
+        m_isFinished = true;
+        return Flush();
+    }
+
+    /**
+     * @brief Gets the number of rows that were encoded so far.
+     * @return Number of rows
+     */
+    uint32_t GetRowsEncoded() const
+    {
+        return m_rowsEncoded;
+    }
+
+private:
+    /**
+     * @brief Gets the largest number of bytes that a single row can be encoded to, plus the run it may flush.
+     * @return Number of bytes
+     */
+    size_t GetMaxRowSize() const
+    {
+        return static_cast<size_t>(m_imageWidth) * (m_numChannels + 1) + 1;
+    }
+
+    /**
+     * @brief Hands the buffered bytes to the sink.
+     * @return Flag indicating whether the sink took them.
+     */
+    bool Flush()
+    {
+        if ((m_bufferSize > 0) && !m_sink(m_buffer.data(), m_bufferSize))
+        {
+            m_isFailed = true;
+            return false;
+        }
+        m_bufferSize = 0;
+        return true;
+    }
+
+private:
+    /**
+     * Function that receives the compressed bytes
+     */
+    Sink m_sink;
+
+    /**
+     * Properties of the image
+     */
+    uint32_t m_imageWidth;
+    uint32_t m_imageHeight;
+    uint8_t m_numChannels;
+
+    /**
+     * Encoder state, carried from one row to the next
+     */
+    EncoderState m_state;
+
+    /**
+     * Number of rows that were encoded so far
+     */
+    uint32_t m_rowsEncoded;
+
+    /**
+     * Compressed bytes that were not handed to the sink yet
+     */
+    std::vector<uint8_t> m_buffer;
+    size_t m_bufferSize;
+
+    /**
+     * Flag indicating whether the sink failed or the number of channels is invalid
+     */
+    bool m_isFailed;
+
+    /**
+     * Flag indicating whether Finish() was called
+     */
+    bool m_isFinished;
+};
 }
 
-#endif // QOI_ENCODER_HEADER 
+#endif // QOI_ENCODER_HEADER
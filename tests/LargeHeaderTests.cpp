@@ -0,0 +1,193 @@
+#include "qoi_decoder.hpp"
+#include "qoi_encoder.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+namespace
+{
+/**
+ * Largest single allocation made since the last call to ResetLargestAllocation()
+ */
+size_t g_largestAllocation = 0;
+
+/**
+ * Largest allocation a check may make, well below the pixels of any of the images it tries
+ */
+const size_t MAX_ALLOCATION = 1 << 20;
+
+/**
+ * Number of checks that failed
+ */
+int g_numFailed = 0;
+
+/**
+ * @brief Reports a check that failed, and carries on with the next one.
+ * @param[in] isOk Condition that has to hold
+ * @param[in] message What is checked
+ */
+void Check(bool isOk, const char *message)
+{
+    if (!isOk)
+    {
+        fprintf(stderr, "FAILED: %s\n", message);
+        ++g_numFailed;
+    }
+}
+
+/**
+ * @brief Forgets the allocations made so far, so that the next check only sees its own.
+ */
+void ResetLargestAllocation()
+{
+    g_largestAllocation = 0;
+}
+
+/**
+ * @brief Makes a QOI image of the specified dimensions whose chunks are all runs of the same color, followed by the end marker.
+ * @param[in] imageWidth Width in the header
+ * @param[in] imageHeight Height in the header
+ * @param[in] numChannels Number of channels in the header
+ * @param[in] numPixels Number of pixels that the runs make, which may be fewer than the header claims
+ * @return Bytes of the image
+ */
+std::vector<uint8_t> MakeImage(uint32_t imageWidth, uint32_t imageHeight, uint8_t numChannels, size_t numPixels)
+{
+    std::vector<uint8_t> bytes = { 'q', 'o', 'i', 'f' };
+    for (uint32_t value : { imageWidth, imageHeight })
+    {
+        bytes.push_back(static_cast<uint8_t>(value >> 24));
+        bytes.push_back(static_cast<uint8_t>(value >> 16));
+        bytes.push_back(static_cast<uint8_t>(value >> 8));
+        bytes.push_back(static_cast<uint8_t>(value));
+    }
+    bytes.push_back(numChannels);
+    bytes.push_back(0);
+    bytes.insert(bytes.end(), numPixels / 62, 0xFD);
+    if (numPixels % 62 != 0)
+    {
+        bytes.push_back(static_cast<uint8_t>(0xC0 | (numPixels % 62 - 1)));
+    }
+    bytes.insert(bytes.end(), { 0, 0, 0, 0, 0, 0, 0, 1 });
+    return bytes;
+}
+
+/**
+ * @brief Decodes the specified image with Decode() and checks that it is rejected without allocating its pixels.
+ * @param[in] bytes Bytes of the image
+ * @param[in] limits Limits to decode with
+ * @param[in] message What is checked
+ */
+void CheckDecodeRejects(const std::vector<uint8_t> &bytes, const qoi::DecodeLimits &limits, const char *message)
+{
+    std::vector<uint8_t> pixels;
+    uint32_t imageWidth = 0, imageHeight = 0;
+    uint8_t numChannels = 0;
+    qoi::ColorSpace colorSpace;
+    ResetLargestAllocation();
+    Check(!qoi::Decode(bytes.data(), bytes.size(), pixels, imageWidth, imageHeight, numChannels, colorSpace, limits), message);
+    Check(g_largestAllocation <= MAX_ALLOCATION, message);
+}
+
+/**
+ * @brief Pushes the specified image to a StreamDecoder and returns the error it finishes with, checking that it
+ *        never allocates its pixels.
+ * @param[in] bytes Bytes of the image
+ * @param[in] limits Limits to decode with
+ * @param[in] message What is checked
+ * @return Error that the decoder finished with
+ */
+qoi::DecodeError StreamDecode(const std::vector<uint8_t> &bytes, const qoi::DecodeLimits &limits, const char *message)
+{
+    ResetLargestAllocation();
+    qoi::StreamDecoder decoder;
+    decoder.SetLimits(limits);
+    decoder.Push(bytes.data(), bytes.size());
+    Check(g_largestAllocation <= MAX_ALLOCATION, message);
+    return decoder.Finish();
+}
+}
+
+/**
+ * @brief Records the size of every allocation, so that the checks can tell that no buffer for the pixels was made.
+ */
+void *operator new(size_t size)
+{
+    if (size > g_largestAllocation)
+    {
+        g_largestAllocation = size;
+    }
+    void *memory = malloc((size > 0) ? size : 1);
+    if (memory == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+void operator delete(void *memory) noexcept
+{
+    free(memory);
+}
+
+/**
+ * @brief Checks that images with huge dimensions in their header are rejected before the memory for their pixels is
+ *        allocated, both by the decoder and the encoder.
+ * @return 0 if every check passed, 1 otherwise
+ */
+int main()
+{
+    const qoi::DecodeLimits noLimits;
+
+    // 4G x 4G RGBA pixels can never be addressed, whatever the limits
+    const std::vector<uint8_t> hugeImage = MakeImage(0xFFFFFFFF, 0xFFFFFFFF, 4, 62);
+    CheckDecodeRejects(hugeImage, noLimits, "Decode() rejects a 4G x 4G RGBA header");
+    Check(StreamDecode(hugeImage, noLimits, "StreamDecoder rejects a 4G x 4G RGBA header") == qoi::DecodeError::ImageTooLarge,
+          "StreamDecoder reports ImageTooLarge for a 4G x 4G RGBA header");
+
+    // 1000 x 1000 RGB, fully covered by its runs, is only rejected by the limits
+    const std::vector<uint8_t> image = MakeImage(1000, 1000, 3, 1000 * 1000);
+    CheckDecodeRejects(image, qoi::DecodeLimits(999999), "Decode() rejects an image over maxPixels");
+    CheckDecodeRejects(image, qoi::DecodeLimits(UINT64_MAX, 2999999), "Decode() rejects an image over maxBytes");
+    Check(StreamDecode(image, qoi::DecodeLimits(999999), "StreamDecoder checks maxPixels before allocating") == qoi::DecodeError::ImageTooLarge,
+          "StreamDecoder rejects an image over maxPixels");
+    Check(StreamDecode(image, qoi::DecodeLimits(UINT64_MAX, 2999999), "StreamDecoder checks maxBytes before allocating") == qoi::DecodeError::ImageTooLarge,
+          "StreamDecoder rejects an image over maxBytes");
+
+    std::vector<uint8_t> pixels;
+    uint32_t imageWidth = 0, imageHeight = 0;
+    uint8_t numChannels = 0;
+    qoi::ColorSpace colorSpace;
+    ResetLargestAllocation();
+    Check(qoi::Decode(image.data(), image.size(), pixels, imageWidth, imageHeight, numChannels, colorSpace, qoi::DecodeLimits(1000000, 3000000)) &&
+              (pixels.size() == 3000000),
+          "Decode() accepts an image exactly at the limits");
+    Check(g_largestAllocation >= 3000000, "Allocations of the pixels are seen by the checks");
+
+    // 65536 x 65536 pixels within the limits, but a single chunk cannot hold them
+    const std::vector<uint8_t> shortImage = MakeImage(65536, 65536, 4, 62);
+    ResetLargestAllocation();
+    Check(qoi::AllocatePixels(shortImage.data(), shortImage.size(), noLimits, pixels, imageWidth, imageHeight, numChannels, colorSpace) ==
+              qoi::DecodeError::TruncatedData,
+          "A header claiming more pixels than the chunks can hold is TruncatedData");
+    Check(g_largestAllocation <= MAX_ALLOCATION, "A header claiming more pixels than the chunks can hold allocates nothing");
+    CheckDecodeRejects(shortImage, noLimits, "Decode() rejects a header claiming more pixels than the chunks can hold");
+
+    // 2^31 x 2^31 RGBA wrapped to 0 bytes in 32 bits, so a tiny buffer passed as all the pixels
+    const uint8_t tinyPixels[16] = {};
+    std::vector<uint8_t> encoded;
+    ResetLargestAllocation();
+    Check(!qoi::Encode(tinyPixels, sizeof(tinyPixels), 0, 1u << 31, 1u << 31, 4, 0, encoded), "Encode() refuses 2^31 x 2^31 pixels from 16 bytes");
+    Check(encoded.empty() && (g_largestAllocation <= MAX_ALLOCATION), "Encode() allocates nothing for 2^31 x 2^31 pixels from 16 bytes");
+
+    if (g_numFailed > 0)
+    {
+        fprintf(stderr, "%d checks failed\n", g_numFailed);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
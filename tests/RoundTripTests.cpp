@@ -0,0 +1,334 @@
+#include "qoi_decoder.hpp"
+#include "qoi_encoder.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+/**
+ * Number of checks that failed
+ */
+int g_numFailed = 0;
+
+/**
+ * @brief Reports a check that failed, and carries on with the next one.
+ * @param[in] isOk Condition that has to hold
+ * @param[in] message What is checked
+ */
+void Check(bool isOk, const char *message)
+{
+    if (!isOk)
+    {
+        fprintf(stderr, "FAILED: %s\n", message);
+        ++g_numFailed;
+    }
+}
+
+/**
+ * Pseudo-random number generator, so that the images are the same on every run
+ */
+class Random
+{
+public:
+    /**
+     * @brief Constructor
+     * @param[in] seed Starting state
+     */
+    explicit Random(uint32_t seed)
+        : m_state(seed)
+    {
+    }
+
+    /**
+     * @brief Gets the next number.
+     * @param[in] bound Upper bound, excluded
+     * @return Number from 0 to bound - 1
+     */
+    uint32_t Next(uint32_t bound)
+    {
+        m_state = m_state * 1664525u + 1013904223u;
+        return (m_state >> 8) % bound;
+    }
+
+private:
+    /**
+     * Current state
+     */
+    uint32_t m_state;
+};
+
+/**
+ * @brief Makes an image that uses every op: runs that cross from one row into the next, colors that come back from
+ *        a small palette so that the index is hit across rows too, small and medium changes for DIFF and LUMA, and
+ *        random colors and alpha for RGB and RGBA.
+ * @param[in] imageWidth Image width
+ * @param[in] imageHeight Image height
+ * @param[in] numChannels Number of channels (3 or 4)
+ * @param[in] seed Seed of the pixels
+ * @return Pixels, with the rows tightly packed
+ */
+std::vector<uint8_t> MakePixels(uint32_t imageWidth, uint32_t imageHeight, uint8_t numChannels, uint32_t seed)
+{
+    Random random(seed);
+    uint8_t palette[8][4];
+    for (auto &color : palette)
+    {
+        for (uint8_t &channel : color)
+        {
+            channel = static_cast<uint8_t>(random.Next(256));
+        }
+    }
+
+    const size_t numPixels = static_cast<size_t>(imageWidth) * imageHeight;
+    std::vector<uint8_t> pixels(numPixels * numChannels);
+    uint8_t color[4] = { 0, 0, 0, 255 };
+    for (size_t i = 0; i < numPixels;)
+    {
+        // Runs and repeats last several pixels, which often takes them over the end of a row
+        size_t count = 1;
+        switch (random.Next(6))
+        {
+        case 0:
+            count = 1 + random.Next(3 * imageWidth / 2 + 2);
+            break;
+        case 1:
+            std::memcpy(color, palette[random.Next(8)], 4);
+            count = 1 + random.Next(3);
+            break;
+        case 2:
+            for (int c = 0; c < 3; ++c)
+            {
+                color[c] = static_cast<uint8_t>(color[c] + random.Next(3) - 1);
+            }
+            break;
+        case 3:
+            for (int c = 0; c < 3; ++c)
+            {
+                color[c] = static_cast<uint8_t>(color[c] + random.Next(17) - 8);
+            }
+            break;
+        case 4:
+            for (int c = 0; c < 3; ++c)
+            {
+                color[c] = static_cast<uint8_t>(random.Next(256));
+            }
+            break;
+        default:
+            color[3] = static_cast<uint8_t>(random.Next(4) * 85);
+            break;
+        }
+
+        for (; (count > 0) && (i < numPixels); --count, ++i)
+        {
+            std::memcpy(&pixels[i * numChannels], color, numChannels);
+        }
+    }
+    return pixels;
+}
+
+/**
+ * @brief Encodes an image with a StreamEncoder, pushing the specified number of rows at a time from a buffer whose
+ *        rows are padded to the specified stride.
+ * @param[in] pixels Pixels, with the rows tightly packed
+ * @param[in] imageWidth Image width
+ * @param[in] imageHeight Image height
+ * @param[in] numChannels Number of channels (3 or 4)
+ * @param[in] rowsPerPush Number of rows per call to PushRows()
+ * @param[in] padding Bytes added after every row
+ * @return Encoded bytes, or nothing if the encoder failed
+ */
+std::vector<uint8_t> StreamEncode(const std::vector<uint8_t> &pixels, uint32_t imageWidth, uint32_t imageHeight, uint8_t numChannels, uint32_t rowsPerPush, size_t padding)
+{
+    const size_t rowSize = static_cast<size_t>(imageWidth) * numChannels;
+    const size_t stride = rowSize + padding;
+    std::vector<uint8_t> paddedPixels(stride * imageHeight, 0xAA);
+    for (uint32_t y = 0; y < imageHeight; ++y)
+    {
+        std::memcpy(&paddedPixels[y * stride], &pixels[y * rowSize], rowSize);
+    }
+
+    std::vector<uint8_t> bytes;
+    qoi::StreamEncoder encoder(imageWidth, imageHeight, numChannels, 0, [&bytes](const uint8_t *data, size_t size)
+    {
+        bytes.insert(bytes.end(), data, data + size);
+        return true;
+    });
+    for (uint32_t y = 0; y < imageHeight; y += rowsPerPush)
+    {
+        if (!encoder.PushRows(&paddedPixels[y * stride], std::min(rowsPerPush, imageHeight - y), stride))
+        {
+            return std::vector<uint8_t>();
+        }
+    }
+    if (!encoder.Finish())
+    {
+        return std::vector<uint8_t>();
+    }
+    return bytes;
+}
+
+/**
+ * @brief Decodes an image with a StreamDecoder that rows are pulled from, pushing it one byte at a time.
+ * @param[in] bytes Encoded image
+ * @return Decoded pixels, or nothing if the decoder failed
+ */
+std::vector<uint8_t> StreamDecodeBytewise(const std::vector<uint8_t> &bytes)
+{
+    std::vector<uint8_t> pixels;
+    qoi::StreamDecoder decoder;
+    for (size_t offset = 0; offset < bytes.size();)
+    {
+        offset += decoder.Push(&bytes[offset], 1);
+        while (const uint8_t *row = decoder.PopRow())
+        {
+            pixels.insert(pixels.end(), row, row + static_cast<size_t>(decoder.GetImageWidth()) * decoder.GetNumChannels());
+        }
+    }
+    if (decoder.Finish() != qoi::DecodeError::None)
+    {
+        return std::vector<uint8_t>();
+    }
+    return pixels;
+}
+
+/**
+ * @brief Decodes an image with a StreamDecoder that hands the rows to a callback, pushing pieces of random sizes.
+ * @param[in] bytes Encoded image
+ * @param[in] seed Seed of the piece sizes
+ * @return Decoded pixels, or nothing if the decoder failed
+ */
+std::vector<uint8_t> StreamDecodeRandomPieces(const std::vector<uint8_t> &bytes, uint32_t seed)
+{
+    std::vector<uint8_t> pixels;
+    qoi::StreamDecoder decoder([&pixels, &decoder](const uint8_t *row, uint32_t)
+    {
+        pixels.insert(pixels.end(), row, row + static_cast<size_t>(decoder.GetImageWidth()) * decoder.GetNumChannels());
+    });
+    Random random(seed);
+    for (size_t offset = 0; offset < bytes.size();)
+    {
+        size_t size = std::min<size_t>(1 + random.Next(300), bytes.size() - offset);
+        offset += decoder.Push(&bytes[offset], size);
+    }
+    if (decoder.Finish() != qoi::DecodeError::None)
+    {
+        return std::vector<uint8_t>();
+    }
+    return pixels;
+}
+
+/**
+ * @brief Runs every check on an image of the specified dimensions.
+ * @param[in] imageWidth Image width
+ * @param[in] imageHeight Image height
+ * @param[in] numChannels Number of channels (3 or 4)
+ * @param[in] seed Seed of the pixels
+ */
+void CheckRoundTrips(uint32_t imageWidth, uint32_t imageHeight, uint8_t numChannels, uint32_t seed)
+{
+    const std::vector<uint8_t> pixels = MakePixels(imageWidth, imageHeight, numChannels, seed);
+    const size_t rowSize = static_cast<size_t>(imageWidth) * numChannels;
+
+    std::vector<uint8_t> encoded;
+    Check(qoi::Encode(pixels, imageWidth, imageHeight, numChannels, 0, encoded), "Encode() encodes the image");
+
+    // The scalar and the vector encoders make the same bytes, and so does the stream encoder with any row split
+    const qoi::SimdLevel detectedLevel = qoi::DetectSimdLevel();
+    for (qoi::SimdLevel level : { qoi::SimdLevel::Scalar, qoi::SimdLevel::SSE2, qoi::SimdLevel::AVX2 })
+    {
+        if (level > detectedLevel)
+        {
+            continue;
+        }
+        qoi::SetSimdLevel(level);
+
+        std::vector<uint8_t> levelEncoded;
+        Check(qoi::Encode(pixels, imageWidth, imageHeight, numChannels, 0, levelEncoded) && (levelEncoded == encoded),
+              "Encode() makes the same bytes with every instruction set");
+        Check(StreamEncode(pixels, imageWidth, imageHeight, numChannels, 1, 0) == encoded, "StreamEncoder with one row per push makes the same bytes as Encode()");
+        Check(StreamEncode(pixels, imageWidth, imageHeight, numChannels, 7, 0) == encoded, "StreamEncoder with seven rows per push makes the same bytes as Encode()");
+        Check(StreamEncode(pixels, imageWidth, imageHeight, numChannels, 3, 5) == encoded, "StreamEncoder with padded rows makes the same bytes as Encode()");
+    }
+    qoi::SetSimdLevel(detectedLevel);
+
+    std::vector<uint8_t> decoded;
+    uint32_t decodedWidth = 0, decodedHeight = 0;
+    uint8_t decodedNumChannels = 0;
+    qoi::ColorSpace colorSpace;
+    Check(qoi::Decode(encoded.data(), encoded.size(), decoded, decodedWidth, decodedHeight, decodedNumChannels, colorSpace) && (decoded == pixels) &&
+              (decodedWidth == imageWidth) && (decodedHeight == imageHeight) && (decodedNumChannels == numChannels),
+          "Decode() gives back the pixels that were encoded");
+
+    Check(StreamDecodeBytewise(encoded) == pixels, "StreamDecoder gives back the pixels when pushed one byte at a time");
+    Check(StreamDecodeRandomPieces(encoded, seed) == pixels, "StreamDecoder gives back the pixels when pushed pieces of random sizes");
+
+    // Rows padded to a stride, whose padding is left as it was
+    const size_t stride = rowSize + 13;
+    const size_t capacity = stride * (imageHeight - 1) + rowSize;
+    std::vector<uint8_t> strided(capacity, 0xAA);
+    Check(qoi::DecodeInto(encoded.data(), encoded.size(), strided.data(), capacity, stride, decodedWidth, decodedHeight, decodedNumChannels, colorSpace) == qoi::DecodeError::None,
+          "DecodeInto() decodes into rows padded to a stride");
+    bool isStridedOk = true;
+    for (uint32_t y = 0; y < imageHeight; ++y)
+    {
+        isStridedOk = isStridedOk && (std::memcmp(&strided[y * stride], &pixels[y * rowSize], rowSize) == 0);
+        for (size_t x = rowSize; (y + 1 < imageHeight) && (x < stride); ++x)
+        {
+            isStridedOk = isStridedOk && (strided[y * stride + x] == 0xAA);
+        }
+    }
+    Check(isStridedOk, "DecodeInto() writes every row at its stride and leaves the padding alone");
+    Check(qoi::DecodeInto(encoded.data(), encoded.size(), strided.data(), capacity - 1, stride, decodedWidth, decodedHeight, decodedNumChannels, colorSpace) ==
+              qoi::DecodeError::DestinationTooSmall,
+          "DecodeInto() refuses a destination one byte too small for the last row");
+    Check(qoi::DecodeInto(encoded.data(), encoded.size(), strided.data(), capacity, rowSize - 1, decodedWidth, decodedHeight, decodedNumChannels, colorSpace) ==
+              qoi::DecodeError::InvalidStride,
+          "DecodeInto() refuses a stride shorter than a row");
+
+    // Plain images are split into segments that are decoded speculatively
+    std::vector<uint8_t> parallelDecoded;
+    Check(qoi::DecodeParallel(encoded, parallelDecoded, decodedWidth, decodedHeight, decodedNumChannels, colorSpace, 4) && (parallelDecoded == pixels),
+          "DecodeParallel() gives back the pixels of a plain image");
+
+    // Striped images decode the same with and without threads, whatever the number of stripes
+    for (uint32_t stripeRows : { 1u, 8u, imageHeight })
+    {
+        std::vector<uint8_t> striped;
+        Check(qoi::EncodeStriped(pixels, imageWidth, imageHeight, numChannels, 0, stripeRows, 3, striped), "EncodeStriped() encodes the image");
+        Check(qoi::DecodeParallel(striped, parallelDecoded, decodedWidth, decodedHeight, decodedNumChannels, colorSpace, 3) && (parallelDecoded == pixels),
+              "DecodeParallel() gives back the pixels of a striped image");
+        Check(qoi::Decode(striped.data(), striped.size(), decoded, decodedWidth, decodedHeight, decodedNumChannels, colorSpace) && (decoded == pixels),
+              "Decode() gives back the pixels of a striped image");
+        Check(StreamDecodeRandomPieces(striped, seed) == pixels, "StreamDecoder gives back the pixels of a striped image");
+    }
+}
+}
+
+/**
+ * @brief Checks that images come back unchanged from every pair of encoder and decoder, and that the stream and
+ *        striped encoders make the bytes they should.
+ * @return 0 if every check passed, 1 otherwise
+ */
+int main()
+{
+    // A single column puts every run and index hit across rows
+    CheckRoundTrips(1, 300, 3, 1);
+    CheckRoundTrips(1, 300, 4, 2);
+    CheckRoundTrips(97, 61, 3, 3);
+    CheckRoundTrips(97, 61, 4, 4);
+
+    // Large enough for DecodeParallel() to split the chunks of a plain image into several segments
+    CheckRoundTrips(613, 487, 3, 5);
+    CheckRoundTrips(613, 487, 4, 6);
+
+    if (g_numFailed > 0)
+    {
+        fprintf(stderr, "%d checks failed\n", g_numFailed);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
@@ -0,0 +1,815 @@
+#include "AsyncBatchEncoder.hpp"
+
+#include "BatchEncoder.hpp"
+#include "Converter.hpp"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <system_error>
+#include <thread>
+
+namespace
+{
+/**
+ * Step of its conversion that a file is at
+ */
+enum class Stage
+{
+    Reading,
+    Encoding,
+    Writing,
+    Syncing
+};
+
+/**
+ * One file on its way through the conversion
+ */
+struct FileJob
+{
+    /**
+     * Path to the input file, to the output file, and to the file that is actually written (a temporary one with WriteOptions::isAtomic)
+     */
+    std::string inputFilePath;
+    std::string outputFilePath;
+    std::string writtenFilePath;
+
+    /**
+     * Step of the conversion that the file is at
+     */
+    Stage stage = Stage::Reading;
+
+    /**
+     * File descriptor of the input while it is read, and of the output while it is written, or -1
+     */
+    int fd = -1;
+
+    /**
+     * Bytes of the input file, until they are encoded, their number, and the size of the buffer holding them
+     */
+    std::unique_ptr<uint8_t[]> inputBytes;
+    size_t inputSize = 0;
+    size_t inputCapacity = 0;
+
+    /**
+     * Bytes of the QOI file, until they are written
+     */
+    std::vector<uint8_t> outputBytes;
+
+    /**
+     * Number of bytes of the input read, or of the output written, so far
+     */
+    size_t numTransferred = 0;
+
+    /**
+     * Number of bytes of the memory budget that the file holds
+     */
+    size_t reservedBytes = 0;
+
+    /**
+     * Estimated number of bytes that decoding and encoding the file needs on top of its buffers, known once it is read
+     */
+    size_t conversionBytes = 0;
+
+    /**
+     * Description of what went wrong, if the conversion failed
+     */
+    std::string error;
+};
+
+/**
+ * State of one run of AsyncBatchEncoder. Everything but the work and done queues, and the total of the reservations,
+ * belongs to the thread that submits the requests; a file belongs to a worker while it is in the work queue.
+ */
+class Pipeline
+{
+public:
+    Pipeline(IoEngine &engine, unsigned queueDepth, size_t numThreads, size_t memoryBudget, uint32_t stripeRows, uint64_t maxPixels, const qoi::WriteOptions &writeOptions, bool isVerbose)
+        : m_engine(engine)
+        , m_queueDepth(std::max(1u, queueDepth))
+        , m_numThreads(numThreads)
+        , m_memoryBudget(memoryBudget)
+        , m_stripeRows(stripeRows)
+        , m_maxPixels(maxPixels)
+        , m_writeOptions(writeOptions)
+        , m_isVerbose(isVerbose)
+        , m_numInFlight(0)
+        , m_numEncoding(0)
+        , m_numActive(0)
+        , m_numFinished(0)
+        , m_pendingConversionBytes(0)
+        , m_reservedBytes(0)
+        , m_freeBytes(0)
+        , m_isStopping(false)
+        , m_stats()
+    {
+    }
+
+    /**
+     * @brief Converts the specified files.
+     * @param[in] inputFilePaths Paths to the input image files
+     * @param[in] outputDirectory Directory where the QOI files will be written, or empty to write them next to the inputs
+     * @return Numbers of the run
+     */
+    AsyncBatchEncoder::Stats Run(const std::vector<std::string> &inputFilePaths, const std::string &outputDirectory)
+    {
+        const auto startTime = std::chrono::steady_clock::now();
+        m_jobs.resize(inputFilePaths.size());
+        for (size_t i = 0; i < m_jobs.size(); ++i)
+        {
+            m_jobs[i].inputFilePath = inputFilePaths[i];
+            m_jobs[i].outputFilePath = BatchEncoder::GetOutputFilePath(inputFilePaths[i], outputDirectory);
+        }
+
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i < std::min(m_numThreads, std::max<size_t>(1, m_jobs.size())); ++i)
+        {
+            workers.emplace_back(&Pipeline::RunWorker, this);
+        }
+
+        std::vector<IoCompletion> completions;
+        size_t nextJob = 0;
+        while (m_numFinished < m_jobs.size())
+        {
+            TakeEncodedFiles();
+            StartEncodes();
+
+            // Writes go first, since they are what returns memory to the budget
+            while ((m_numInFlight < m_queueDepth) && !m_pendingWrites.empty())
+            {
+                size_t index = m_pendingWrites.front();
+                m_pendingWrites.pop_front();
+                SubmitWrite(index);
+            }
+
+            // A new file is read while there is room in the queue and the budget, and the workers are not too far behind
+            while ((m_numInFlight < m_queueDepth) && (nextJob < m_jobs.size()) && (m_numEncoding + m_pendingEncodes.size() < m_queueDepth + m_numThreads) &&
+                   StartRead(nextJob))
+            {
+                ++nextJob;
+            }
+
+            if (m_numFinished == m_jobs.size())
+            {
+                break;
+            }
+
+            completions.clear();
+            m_engine.Wait(completions);
+            for (const IoCompletion &completion : completions)
+            {
+                --m_numInFlight;
+                HandleCompletion(completion);
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_workMutex);
+            m_isStopping = true;
+        }
+        m_workQueued.notify_all();
+        for (std::thread &worker : workers)
+        {
+            worker.join();
+        }
+
+        // Renames only survive a crash once their directory is flushed, which is needed once per directory
+        for (const std::string &directory : m_renamedDirectories)
+        {
+            // SyncDirectory() flushes the directory a path is in, which the trailing slash makes the directory itself
+            int error = qoi::FileWriter::SyncDirectory(directory);
+            if (error != 0)
+            {
+                std::cerr << (directory.empty() ? "." : directory) << ": Cannot sync directory: " << std::generic_category().message(error) << "!" << std::endl;
+                ++m_stats.numFailed;
+            }
+        }
+
+        m_stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+        return m_stats;
+    }
+
+private:
+    /**
+     * @brief Opens the specified input file and submits the read of its first bytes, unless the file does not fit in
+     *        the memory budget next to the files in flight and the conversions that they are waiting for. The file is
+     *        kept open until it fits, or until no other file is in flight.
+     * @param[in] index Index of the file
+     * @return True if the file was started, or failed, and false if it has to wait for room in the budget
+     */
+    bool StartRead(size_t index)
+    {
+        FileJob &job = m_jobs[index];
+        if (job.fd < 0)
+        {
+            job.fd = open(job.inputFilePath.c_str(), O_RDONLY | O_CLOEXEC);
+            struct stat fileStatus;
+            if ((job.fd < 0) || (fstat(job.fd, &fileStatus) != 0) || !S_ISREG(fileStatus.st_mode) || (fileStatus.st_size <= 0))
+            {
+                ++m_numActive;
+                Finish(index, "Cannot read input image file!");
+                return true;
+            }
+            if (static_cast<uint64_t>(fileStatus.st_size) > static_cast<uint64_t>(INT_MAX))
+            {
+                ++m_numActive;
+                Finish(index, "Input image file is too large!");
+                return true;
+            }
+            job.inputSize = static_cast<size_t>(fileStatus.st_size);
+        }
+
+        if ((m_numActive > 0) && !HasRoomInBudget(m_pendingConversionBytes + job.inputSize))
+        {
+            return false;
+        }
+
+        ++m_numActive;
+        AcquireInput(job);
+        SubmitTransfer(index);
+        return true;
+    }
+
+    /**
+     * @brief Opens the output file of the specified file and submits the write of its first bytes.
+     * @param[in] index Index of the file
+     */
+    void SubmitWrite(size_t index)
+    {
+        FileJob &job = m_jobs[index];
+        job.stage = Stage::Writing;
+        job.numTransferred = 0;
+        if (m_writeOptions.isAtomic)
+        {
+            job.writtenFilePath = job.outputFilePath + ".tmp" + std::to_string(getpid()) + "." + std::to_string(index);
+            job.fd = open(job.writtenFilePath.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+        }
+        else
+        {
+            job.writtenFilePath = job.outputFilePath;
+            job.fd = open(job.writtenFilePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        }
+        if (job.fd < 0)
+        {
+            int error = errno;
+            job.writtenFilePath.clear();
+            Finish(index, "Cannot write output file " + job.outputFilePath + ": " + std::generic_category().message(error) + "!");
+            return;
+        }
+        SubmitTransfer(index);
+    }
+
+    /**
+     * @brief Submits the read or write of the bytes of the specified file that are not transferred yet.
+     * @param[in] index Index of the file
+     */
+    void SubmitTransfer(size_t index)
+    {
+        FileJob &job = m_jobs[index];
+        if (job.stage == Stage::Reading)
+        {
+            size_t size = std::min(job.inputSize - job.numTransferred, IoEngine::MAX_REQUEST_SIZE);
+            m_engine.SubmitRead(job.fd, job.inputBytes.get() + job.numTransferred, size, job.numTransferred, index);
+        }
+        else
+        {
+            size_t size = std::min(job.outputBytes.size() - job.numTransferred, IoEngine::MAX_REQUEST_SIZE);
+            m_engine.SubmitWrite(job.fd, job.outputBytes.data() + job.numTransferred, size, job.numTransferred, index);
+        }
+        ++m_numInFlight;
+    }
+
+    /**
+     * @brief Moves the file of the specified completed request on to its next step.
+     * @param[in] completion Completed request
+     */
+    void HandleCompletion(const IoCompletion &completion)
+    {
+        const size_t index = static_cast<size_t>(completion.tag);
+        FileJob &job = m_jobs[index];
+        if ((completion.result < 0) || ((completion.result == 0) && (job.stage != Stage::Syncing)))
+        {
+            // A read of nothing means that the file got shorter since it was opened
+            const int error = (completion.result < 0) ? static_cast<int>(-completion.result) : EIO;
+            Finish(index, (job.stage == Stage::Reading) ? "Cannot read input image file: " + std::generic_category().message(error) + "!"
+                                                         : "Cannot write output file " + job.outputFilePath + ": " + std::generic_category().message(error) + "!");
+            return;
+        }
+
+        switch (job.stage)
+        {
+        case Stage::Reading:
+            job.numTransferred += static_cast<size_t>(completion.result);
+            if (job.numTransferred < job.inputSize)
+            {
+                SubmitTransfer(index);
+                return;
+            }
+            close(job.fd);
+            job.fd = -1;
+            m_stats.bytesRead += job.inputSize;
+
+            // The header is in memory now, so the peak of the conversion is known before a worker starts it
+            job.stage = Stage::Encoding;
+            job.conversionBytes = EstimateConversionMemory(job.inputBytes.get(), job.inputSize);
+            AcquireOutput(job);
+            m_pendingEncodes.push_back(index);
+            m_pendingConversionBytes += job.conversionBytes;
+            break;
+
+        case Stage::Writing:
+            job.numTransferred += static_cast<size_t>(completion.result);
+            if (job.numTransferred < job.outputBytes.size())
+            {
+                SubmitTransfer(index);
+                return;
+            }
+            if (m_writeOptions.isSynced)
+            {
+                job.stage = Stage::Syncing;
+                m_engine.SubmitSync(job.fd, index);
+                ++m_numInFlight;
+                return;
+            }
+            Commit(index);
+            break;
+
+        case Stage::Syncing:
+            Commit(index);
+            break;
+
+        case Stage::Encoding:
+            break;
+        }
+    }
+
+    /**
+     * @brief Takes the files that the workers are done with, and queues the writes of those that were encoded.
+     */
+    void TakeEncodedFiles()
+    {
+        std::deque<size_t> encoded;
+        {
+            std::lock_guard<std::mutex> lock(m_doneMutex);
+            encoded.swap(m_doneQueue);
+        }
+
+        for (size_t index : encoded)
+        {
+            --m_numEncoding;
+            RecycleInput(m_jobs[index]);
+            if (!m_jobs[index].error.empty())
+            {
+                Finish(index, m_jobs[index].error);
+                continue;
+            }
+            m_pendingWrites.push_back(index);
+        }
+    }
+
+    /**
+     * @brief Hands the files that were read to the workers, in order, while the estimated peak of their conversion fits
+     *        in the memory budget, or one at a time while no other file is converted, like BatchEncoder::AcquireMemory().
+     */
+    void StartEncodes()
+    {
+        bool isStarted = false;
+        while (!m_pendingEncodes.empty())
+        {
+            const size_t index = m_pendingEncodes.front();
+            FileJob &job = m_jobs[index];
+            if ((m_numEncoding > 0) && !HasRoomInBudget(job.conversionBytes))
+            {
+                break;
+            }
+            m_pendingEncodes.pop_front();
+            m_pendingConversionBytes -= job.conversionBytes;
+
+            Reserve(job, job.reservedBytes + job.conversionBytes);
+            ++m_numEncoding;
+            {
+                std::lock_guard<std::mutex> lock(m_workMutex);
+                m_workQueue.push_back(index);
+            }
+            isStarted = true;
+        }
+        if (isStarted)
+        {
+            m_workQueued.notify_all();
+        }
+    }
+
+    /**
+     * @brief Closes the output file of the specified file, which was written completely, and renames it into place.
+     * @param[in] index Index of the file
+     */
+    void Commit(size_t index)
+    {
+        FileJob &job = m_jobs[index];
+        int fd = job.fd;
+        job.fd = -1;
+        if ((close(fd) != 0) && (errno != EINTR))
+        {
+            int error = errno;
+            Finish(index, "Cannot write output file " + job.outputFilePath + ": " + std::generic_category().message(error) + "!");
+            return;
+        }
+        if (m_writeOptions.isAtomic)
+        {
+            if (std::rename(job.writtenFilePath.c_str(), job.outputFilePath.c_str()) != 0)
+            {
+                int error = errno;
+                Finish(index, "Cannot write output file " + job.outputFilePath + ": " + std::generic_category().message(error) + "!");
+                return;
+            }
+            if (m_writeOptions.isSynced)
+            {
+                size_t slash = job.outputFilePath.find_last_of('/');
+                m_renamedDirectories.insert((slash == std::string::npos) ? std::string() : job.outputFilePath.substr(0, slash + 1));
+            }
+        }
+        job.writtenFilePath.clear();
+
+        m_stats.bytesWritten += job.outputBytes.size();
+        if (m_isVerbose)
+        {
+            std::cout << job.inputFilePath << " -> " << job.outputFilePath << std::endl;
+        }
+        Finish(index, std::string());
+    }
+
+    /**
+     * @brief Ends the conversion of the specified file, reports it if it failed, and returns its memory to the budget.
+     * @param[in] index Index of the file
+     * @param[in] error Description of what went wrong, or empty if the file was converted
+     */
+    void Finish(size_t index, const std::string &error)
+    {
+        FileJob &job = m_jobs[index];
+        if (job.fd >= 0)
+        {
+            close(job.fd);
+            job.fd = -1;
+        }
+
+        // A partly written output is removed, so that a failed conversion leaves nothing behind
+        if (!job.writtenFilePath.empty())
+        {
+            unlink(job.writtenFilePath.c_str());
+        }
+
+        if (error.empty())
+        {
+            ++m_stats.numConverted;
+        }
+        else
+        {
+            ++m_stats.numFailed;
+            std::cerr << job.inputFilePath << ": " << error << std::endl;
+        }
+
+        Reserve(job, 0);
+        job.inputBytes.reset();
+        RecycleOutput(job);
+        --m_numActive;
+        ++m_numFinished;
+    }
+
+    /**
+     * @brief Gives the specified file a buffer for its input, reusing a free one that is large enough if there is one.
+     *        Fresh buffers are zero pages that fault in on the first read, which costs about as much as the read itself.
+     * @param[in] job File whose input size is known
+     */
+    void AcquireInput(FileJob &job)
+    {
+        auto freeInput = m_freeInputs.lower_bound(job.inputSize);
+        if (freeInput != m_freeInputs.end())
+        {
+            job.inputCapacity = freeInput->first;
+            job.inputBytes = std::move(freeInput->second);
+            m_freeInputs.erase(freeInput);
+            m_freeBytes -= job.inputCapacity;
+            m_reservedBytes -= job.inputCapacity;
+        }
+        else
+        {
+            job.inputCapacity = job.inputSize;
+            job.inputBytes.reset(new uint8_t[job.inputCapacity]);
+        }
+        Reserve(job, job.inputCapacity);
+    }
+
+    /**
+     * @brief Takes the input buffer of the specified file, which was encoded, to be reused by a later file. The free
+     *        buffers hold on to their share of the memory budget, and there are never more than files in flight.
+     * @param[in] job File that the workers are done with
+     */
+    void RecycleInput(FileJob &job)
+    {
+        if (job.inputBytes && (m_freeInputs.size() < m_queueDepth + m_numThreads))
+        {
+            m_freeBytes += job.inputCapacity;
+            m_reservedBytes += job.inputCapacity;
+            m_freeInputs.emplace(job.inputCapacity, std::move(job.inputBytes));
+        }
+        job.inputBytes.reset();
+        Reserve(job, job.outputBytes.capacity());
+    }
+
+    /**
+     * @brief Gives the specified file a free output buffer to encode into, if there is one. The encoder sizes its
+     *        output for the worst case up front, so a fresh buffer faults in more memory than the QOI file needs.
+     * @param[in] job File that was read
+     */
+    void AcquireOutput(FileJob &job)
+    {
+        if (!m_freeOutputs.empty())
+        {
+            job.outputBytes = std::move(m_freeOutputs.back());
+            m_freeOutputs.pop_back();
+            m_freeBytes -= job.outputBytes.capacity();
+            m_reservedBytes -= job.outputBytes.capacity();
+            Reserve(job, job.inputCapacity + job.outputBytes.capacity());
+        }
+    }
+
+    /**
+     * @brief Takes the output buffer of the specified file, whose conversion ended, to be reused by a later file.
+     * @param[in] job File whose conversion ended
+     */
+    void RecycleOutput(FileJob &job)
+    {
+        if ((job.outputBytes.capacity() > 0) && (m_freeOutputs.size() < m_queueDepth + m_numThreads))
+        {
+            job.outputBytes.clear();
+            m_freeBytes += job.outputBytes.capacity();
+            m_reservedBytes += job.outputBytes.capacity();
+            m_freeOutputs.push_back(std::move(job.outputBytes));
+        }
+        std::vector<uint8_t>().swap(job.outputBytes);
+    }
+
+    /**
+     * @brief Checks whether the specified number of bytes fits in the memory budget next to what the files in flight
+     *        hold, releasing the free buffers if they are what stands in the way.
+     * @param[in] numBytes Number of bytes to add to the reservations
+     * @return True if the bytes fit in the memory budget
+     */
+    bool HasRoomInBudget(size_t numBytes)
+    {
+        if ((m_reservedBytes.load() + numBytes > m_memoryBudget) && (m_freeBytes > 0))
+        {
+            m_reservedBytes -= m_freeBytes;
+            m_freeBytes = 0;
+            m_freeInputs.clear();
+            m_freeOutputs.clear();
+        }
+        return m_reservedBytes.load() + numBytes <= m_memoryBudget;
+    }
+
+    /**
+     * @brief Changes how many bytes of the memory budget the specified file holds. The reservation may exceed the
+     *        budget, which only stops new files from being read until enough memory is returned.
+     * @param[in] job File
+     * @param[in] numBytes Number of bytes that the file holds from now on
+     */
+    void Reserve(FileJob &job, size_t numBytes)
+    {
+        m_reservedBytes += numBytes;
+        m_reservedBytes -= job.reservedBytes;
+        job.reservedBytes = numBytes;
+    }
+
+    /**
+     * @brief Decodes and encodes the files in the work queue until the run is over. Runs on every worker thread.
+     */
+    void RunWorker()
+    {
+        while (true)
+        {
+            size_t index = 0;
+            {
+                std::unique_lock<std::mutex> lock(m_workMutex);
+                m_workQueued.wait(lock, [this]() { return !m_workQueue.empty() || m_isStopping; });
+                if (m_workQueue.empty())
+                {
+                    return;
+                }
+                index = m_workQueue.front();
+                m_workQueue.pop_front();
+            }
+
+            // The file holds its estimated peak while it is converted, and its input and output once it is encoded
+            FileJob &job = m_jobs[index];
+            if (!ConvertToQoi(job.inputBytes.get(), job.inputSize, job.outputBytes, job.error, m_stripeRows, m_maxPixels) && job.error.empty())
+            {
+                job.error = "Failed to encode " + job.inputFilePath + " to QOI format!";
+            }
+            Reserve(job, job.inputCapacity + job.outputBytes.capacity());
+
+            {
+                std::lock_guard<std::mutex> lock(m_doneMutex);
+                m_doneQueue.push_back(index);
+            }
+            m_engine.Wake();
+        }
+    }
+
+private:
+    /**
+     * Settings of the run
+     */
+    IoEngine &m_engine;
+    unsigned m_queueDepth;
+    size_t m_numThreads;
+    size_t m_memoryBudget;
+    uint32_t m_stripeRows;
+    uint64_t m_maxPixels;
+    qoi::WriteOptions m_writeOptions;
+    bool m_isVerbose;
+
+    /**
+     * Every file of the run
+     */
+    std::vector<FileJob> m_jobs;
+
+    /**
+     * Number of requests in flight, of files handed to the workers but not taken back from them, of files between
+     * their first read and the end of their conversion, and of files whose conversion ended
+     */
+    size_t m_numInFlight;
+    size_t m_numEncoding;
+    size_t m_numActive;
+    size_t m_numFinished;
+
+    /**
+     * Files that were read and wait for room in the memory budget to be converted, and the sum of their estimates
+     */
+    std::deque<size_t> m_pendingEncodes;
+    size_t m_pendingConversionBytes;
+
+    /**
+     * Files that were encoded and wait for room in the queue to be written
+     */
+    std::deque<size_t> m_pendingWrites;
+
+    /**
+     * Total number of bytes of the memory budget that the files and the free buffers hold
+     */
+    std::atomic<size_t> m_reservedBytes;
+
+    /**
+     * Input buffers of encoded files, by size, and output buffers of finished files, kept for later files, and their total size
+     */
+    std::multimap<size_t, std::unique_ptr<uint8_t[]>> m_freeInputs;
+    std::vector<std::vector<uint8_t>> m_freeOutputs;
+    size_t m_freeBytes;
+
+    /**
+     * Files that were read and wait for a worker, guarded by m_workMutex
+     */
+    std::deque<size_t> m_workQueue;
+    std::mutex m_workMutex;
+    std::condition_variable m_workQueued;
+    bool m_isStopping;
+
+    /**
+     * Files that the workers are done with, guarded by m_doneMutex
+     */
+    std::deque<size_t> m_doneQueue;
+    std::mutex m_doneMutex;
+
+    /**
+     * Every directory that a file was renamed into with WriteOptions::isSynced, with a trailing slash, or empty for the current one
+     */
+    std::set<std::string> m_renamedDirectories;
+
+    /**
+     * Numbers of the run
+     */
+    AsyncBatchEncoder::Stats m_stats;
+};
+}
+
+/**
+ * @brief Constructor
+ * @param[in] engine Engine that performs the reads and writes. Must outlive the encoder.
+ * @param[in] queueDepth Largest number of reads and writes in flight at once
+ * @param[in] numThreads Number of worker threads that decode and encode, or 0 to use one per hardware thread
+ * @param[in] memoryBudget Maximum number of bytes that the files in flight may use together
+ * @param[in] stripeRows Number of rows per independently decodable stripe, or 0 to write plain QOI files
+ * @param[in] maxPixels Largest number of pixels an input image may have, checked before it is decoded
+ * @param[in] writeOptions How every output file is made visible, and whether it is flushed to the storage device
+ */
+AsyncBatchEncoder::AsyncBatchEncoder(IoEngine &engine, unsigned queueDepth, size_t numThreads, size_t memoryBudget, uint32_t stripeRows, uint64_t maxPixels, const qoi::WriteOptions &writeOptions)
+    : m_engine(engine)
+    , m_queueDepth(queueDepth)
+    , m_numThreads(numThreads)
+    , m_memoryBudget(memoryBudget)
+    , m_stripeRows(stripeRows)
+    , m_maxPixels(maxPixels)
+    , m_writeOptions(writeOptions)
+    , m_stats()
+{
+    if (m_numThreads == 0)
+    {
+        m_numThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+}
+
+/**
+ * @brief Converts the specified image files to QOI. No two inputs may have the same output file (see
+ *        BatchEncoder::RemoveCollidingInputs()), since their writes would overlap and a failed one would be unlinked.
+ * @param[in] inputFilePaths Paths to the input image files
+ * @param[in] outputDirectory Directory where the QOI files will be written, or empty to write them next to the inputs
+ * @param[in] isVerbose Flag indicating whether to print every converted file
+ * @return Number of files that could not be converted
+ */
+size_t AsyncBatchEncoder::Run(const std::vector<std::string> &inputFilePaths, const std::string &outputDirectory, bool isVerbose)
+{
+    Pipeline pipeline(m_engine, m_queueDepth, m_numThreads, m_memoryBudget, m_stripeRows, m_maxPixels, m_writeOptions, isVerbose);
+    m_stats = pipeline.Run(inputFilePaths, outputDirectory);
+    return m_stats.numFailed;
+}
+
+/**
+ * @brief Gets the numbers of the last run.
+ * @return Numbers of the last run
+ */
+const AsyncBatchEncoder::Stats &AsyncBatchEncoder::GetStats() const
+{
+    return m_stats;
+}
+
+/**
+ * @brief Converts the specified image files once per queue depth, from 1 up to the specified one in powers of two,
+ *        and prints the throughput of every run as a table. The inputs are dropped from the page cache before every
+ *        run, where the kernel allows it, so that every run reads them from the storage device.
+ * @param[in] inputFilePaths Paths to the input image files
+ * @param[in] outputDirectory Directory where the QOI files will be written, or empty to write them next to the inputs
+ * @param[in] engineKind Kind of engine that performs the reads and writes
+ * @param[in] maxQueueDepth Largest queue depth to run with
+ * @param[in] numThreads Number of worker threads that decode and encode, or 0 to use one per hardware thread
+ * @param[in] memoryBudget Maximum number of bytes that the files in flight may use together
+ * @param[in] stripeRows Number of rows per independently decodable stripe, or 0 to write plain QOI files
+ * @param[in] maxPixels Largest number of pixels an input image may have, checked before it is decoded
+ * @return Number of runs in which a file could not be converted, or in which the engine could not be created
+ */
+size_t RunIoBenchmark(const std::vector<std::string> &inputFilePaths, const std::string &outputDirectory, IoEngineKind engineKind, unsigned maxQueueDepth, size_t numThreads, size_t memoryBudget, uint32_t stripeRows, uint64_t maxPixels)
+{
+    size_t numFailedRuns = 0;
+    bool isHeaderPrinted = false;
+    for (unsigned queueDepth = 1; queueDepth <= std::max(1u, maxQueueDepth); queueDepth *= 2)
+    {
+        std::unique_ptr<IoEngine> engine = IoEngine::Create(engineKind, queueDepth);
+        if (!engine)
+        {
+            std::cerr << "Cannot create the I/O engine (io_uring may be disabled on this system)!" << std::endl;
+            return numFailedRuns + 1;
+        }
+
+        // Clean pages are dropped right away, so the next run reads the inputs from the device again
+        for (const std::string &inputFilePath : inputFilePaths)
+        {
+            int fd = open(inputFilePath.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd >= 0)
+            {
+                posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+                close(fd);
+            }
+        }
+
+        AsyncBatchEncoder encoder(*engine, queueDepth, numThreads, memoryBudget, stripeRows, maxPixels);
+        if (encoder.Run(inputFilePaths, outputDirectory) > 0)
+        {
+            ++numFailedRuns;
+        }
+
+        const AsyncBatchEncoder::Stats &stats = encoder.GetStats();
+        if (!isHeaderPrinted)
+        {
+            std::printf("engine: %s, %zu files\n", engine->GetName(), inputFilePaths.size());
+            std::printf("%6s %10s %10s %12s %12s\n", "depth", "seconds", "files/s", "read MB/s", "written MB/s");
+            isHeaderPrinted = true;
+        }
+        const double seconds = std::max(stats.seconds, 1e-9);
+        std::printf("%6u %10.3f %10.1f %12.1f %12.1f\n", queueDepth, stats.seconds, stats.numConverted / seconds,
+                    stats.bytesRead / seconds / 1e6, stats.bytesWritten / seconds / 1e6);
+        std::fflush(stdout);
+    }
+    return numFailedRuns;
+}
@@ -0,0 +1,134 @@
+#ifndef ASYNC_BATCH_ENCODER_HEADER
+#define ASYNC_BATCH_ENCODER_HEADER
+
+#include "IoEngine.hpp"
+#include "qoi_encoder.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Class for converting many image files to QOI with the disk and the CPU busy at the same time.
+ *
+ * One thread keeps up to a queue depth of reads and writes in flight on an IoEngine, while worker threads decode
+ * and encode the files that were already read, from memory. A file is only read while it fits in the memory budget
+ * next to the files in flight and the conversions they are waiting for. Once it is read, its image header gives the
+ * estimated peak of its conversion, and it only goes to a worker when that fits in the budget too, or when no other
+ * file is converted, like with BatchEncoder. Peak memory stays within the budget, plus the conversion of one file
+ * that does not fit in it on its own.
+ */
+class AsyncBatchEncoder
+{
+public:
+    /**
+     * Numbers of the last run
+     */
+    struct Stats
+    {
+        /**
+         * Number of files that were converted, and that failed
+         */
+        size_t numConverted;
+        size_t numFailed;
+
+        /**
+         * Number of bytes read from the inputs and written to the outputs
+         */
+        uint64_t bytesRead;
+        uint64_t bytesWritten;
+
+        /**
+         * Wall-clock time of the run in seconds
+         */
+        double seconds;
+    };
+
+    /**
+     * @brief Constructor
+     * @param[in] engine Engine that performs the reads and writes. Must outlive the encoder.
+     * @param[in] queueDepth Largest number of reads and writes in flight at once
+     * @param[in] numThreads Number of worker threads that decode and encode, or 0 to use one per hardware thread
+     * @param[in] memoryBudget Maximum number of bytes that the files in flight may use together
+     * @param[in] stripeRows Number of rows per independently decodable stripe, or 0 to write plain QOI files
+     * @param[in] maxPixels Largest number of pixels an input image may have, checked before it is decoded
+     * @param[in] writeOptions How every output file is made visible, and whether it is flushed to the storage device
+     */
+    AsyncBatchEncoder(IoEngine &engine, unsigned queueDepth, size_t numThreads, size_t memoryBudget, uint32_t stripeRows = 0, uint64_t maxPixels = UINT64_MAX, const qoi::WriteOptions &writeOptions = qoi::WriteOptions());
+
+    /**
+     * @brief Converts the specified image files to QOI. No two inputs may have the same output file (see
+     *        BatchEncoder::RemoveCollidingInputs()), since their writes would overlap and a failed one would be unlinked.
+     * @param[in] inputFilePaths Paths to the input image files
+     * @param[in] outputDirectory Directory where the QOI files will be written, or empty to write them next to the inputs
+     * @param[in] isVerbose Flag indicating whether to print every converted file
+     * @return Number of files that could not be converted
+     */
+    size_t Run(const std::vector<std::string> &inputFilePaths, const std::string &outputDirectory, bool isVerbose = false);
+
+    /**
+     * @brief Gets the numbers of the last run.
+     * @return Numbers of the last run
+     */
+    const Stats &GetStats() const;
+
+private:
+    /**
+     * Engine that performs the reads and writes
+     */
+    IoEngine &m_engine;
+
+    /**
+     * Largest number of reads and writes in flight at once
+     */
+    unsigned m_queueDepth;
+
+    /**
+     * Number of worker threads that decode and encode
+     */
+    size_t m_numThreads;
+
+    /**
+     * Maximum number of bytes that the files in flight may use together
+     */
+    size_t m_memoryBudget;
+
+    /**
+     * Number of rows per independently decodable stripe, or 0 to write plain QOI files
+     */
+    uint32_t m_stripeRows;
+
+    /**
+     * Largest number of pixels an input image may have
+     */
+    uint64_t m_maxPixels;
+
+    /**
+     * How every output file is made visible, and whether it is flushed to the storage device
+     */
+    qoi::WriteOptions m_writeOptions;
+
+    /**
+     * Numbers of the last run
+     */
+    Stats m_stats;
+};
+
+/**
+ * @brief Converts the specified image files once per queue depth, from 1 up to the specified one in powers of two,
+ *        and prints the throughput of every run as a table. The inputs are dropped from the page cache before every
+ *        run, where the kernel allows it, so that every run reads them from the storage device.
+ * @param[in] inputFilePaths Paths to the input image files
+ * @param[in] outputDirectory Directory where the QOI files will be written, or empty to write them next to the inputs
+ * @param[in] engineKind Kind of engine that performs the reads and writes
+ * @param[in] maxQueueDepth Largest queue depth to run with
+ * @param[in] numThreads Number of worker threads that decode and encode, or 0 to use one per hardware thread
+ * @param[in] memoryBudget Maximum number of bytes that the files in flight may use together
+ * @param[in] stripeRows Number of rows per independently decodable stripe, or 0 to write plain QOI files
+ * @param[in] maxPixels Largest number of pixels an input image may have, checked before it is decoded
+ * @return Number of runs in which a file could not be converted, or in which the engine could not be created
+ */
+size_t RunIoBenchmark(const std::vector<std::string> &inputFilePaths, const std::string &outputDirectory, IoEngineKind engineKind, unsigned maxQueueDepth, size_t numThreads, size_t memoryBudget, uint32_t stripeRows = 0, uint64_t maxPixels = UINT64_MAX);
+
+#endif // ASYNC_BATCH_ENCODER_HEADER
@@ -0,0 +1,322 @@
+#include "BatchEncoder.hpp"
+
+#include "Converter.hpp"
+
+#include <dirent.h>
+#include <glob.h>
+#include <sys/stat.h>
+
+#include <strings.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <unordered_map>
+
+namespace
+{
+/**
+ * Extensions of the image files stb_image can read, which are the only ones taken from a directory for conversion
+ */
+const char *const IMAGE_EXTENSIONS[] = { "png", "jpg", "jpeg", "bmp", "tga", "psd", "gif", "hdr", "pic", "pnm", "ppm", "pgm" };
+
+/**
+ * @brief Checks whether the specified file name ends with the specified extension, ignoring case.
+ * @param[in] fileName File name
+ * @param[in] extension Extension without the dot
+ * @return True if the file name has the extension, false otherwise
+ */
+bool HasExtension(const char *fileName, const char *extension)
+{
+    const char *dot = strrchr(fileName, '.');
+    return (dot != nullptr) && (strcasecmp(dot + 1, extension) == 0);
+}
+
+/**
+ * @brief Checks whether the specified file name has the extension of an image stb_image can read.
+ * @param[in] fileName File name
+ * @return True if the file is such an image, false otherwise
+ */
+bool IsImageFileName(const char *fileName)
+{
+    for (const char *extension : IMAGE_EXTENSIONS)
+    {
+        if (HasExtension(fileName, extension))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+}
+
+/**
+ * @brief Constructor
+ * @param[in] numThreads Number of worker threads, or 0 to use one per hardware thread
+ * @param[in] memoryBudget Maximum number of bytes that conversions in flight may use together
+ * @param[in] stripeRows Number of rows per independently decodable stripe, or 0 to write plain QOI files
+ * @param[in] maxPixels Largest number of pixels an input image may have, checked before it is decoded
+ * @param[in] writeOptions How every output file is made visible, and whether it is flushed to the storage device
+ */
+BatchEncoder::BatchEncoder(size_t numThreads, size_t memoryBudget, uint32_t stripeRows, uint64_t maxPixels, const qoi::WriteOptions &writeOptions)
+    : m_numThreads(numThreads)
+    , m_memoryBudget(memoryBudget)
+    , m_stripeRows(stripeRows)
+    , m_maxPixels(maxPixels)
+    , m_writeOptions(writeOptions)
+    , m_memoryInUse(0)
+{
+    if (m_numThreads == 0)
+    {
+        m_numThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+}
+
+/**
+ * @brief Destructor
+ */
+BatchEncoder::~BatchEncoder()
+{
+}
+
+/**
+ * @brief Converts the specified image files to QOI.
+ * @param[in] inputFilePaths Paths to the input image files
+ * @param[in] outputDirectory Directory where the QOI files will be written, or empty to write them next to the inputs
+ * @param[in] isVerbose Flag indicating whether to print every converted file
+ * @return Number of files that could not be converted
+ */
+size_t BatchEncoder::Run(const std::vector<std::string> &inputFilePaths, const std::string &outputDirectory, bool isVerbose)
+{
+    std::atomic<size_t> nextIndex(0);
+    std::atomic<size_t> numFailed(0);
+    std::mutex outputMutex;
+
+    auto worker = [&]()
+    {
+        std::string error;
+        for (size_t i = nextIndex++; i < inputFilePaths.size(); i = nextIndex++)
+        {
+            const std::string &inputFilePath = inputFilePaths[i];
+            std::string outputFilePath = GetOutputFilePath(inputFilePath, outputDirectory);
+
+            bool isSuccess = false;
+            size_t memoryNeeded = EstimateConversionMemory(inputFilePath);
+            if (memoryNeeded == 0)
+            {
+                error = "Cannot read input image file!";
+            }
+            else
+            {
+                AcquireMemory(memoryNeeded);
+                isSuccess = ConvertToQoi(inputFilePath, outputFilePath, error, m_stripeRows, m_maxPixels, m_writeOptions);
+                ReleaseMemory(memoryNeeded);
+            }
+
+            if (!isSuccess)
+            {
+                ++numFailed;
+                std::lock_guard<std::mutex> lock(outputMutex);
+                std::cerr << inputFilePath << ": " << error << std::endl;
+            }
+            else if (isVerbose)
+            {
+                std::lock_guard<std::mutex> lock(outputMutex);
+                std::cout << inputFilePath << " -> " << outputFilePath << std::endl;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    size_t numThreads = std::min(m_numThreads, std::max<size_t>(1, inputFilePaths.size()));
+    for (size_t i = 1; i < numThreads; ++i)
+    {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+
+    return numFailed;
+}
+
+/**
+ * @brief Collects the input files named by the specified argument: a directory, a glob pattern, or "-" for a list of paths on stdin.
+ * @param[in] input Directory, glob pattern, or "-"
+ * @param[out] outFilePaths Vector where the file paths will be appended
+ * @param[in] isQoiOnly Flag indicating whether to take only the QOI files of a directory, rather than the images stb_image can read
+ */
+void BatchEncoder::CollectInputs(const std::string &input, std::vector<std::string> &outFilePaths, bool isQoiOnly)
+{
+    if (input == "-")
+    {
+        std::string line;
+        while (std::getline(std::cin, line))
+        {
+            if (!line.empty())
+            {
+                outFilePaths.push_back(line);
+            }
+        }
+        return;
+    }
+
+    struct stat inputStat;
+    if ((stat(input.c_str(), &inputStat) == 0) && S_ISDIR(inputStat.st_mode))
+    {
+        DIR *directory = opendir(input.c_str());
+        if (directory == nullptr)
+        {
+            // Kept as it is, such as a directory that cannot be listed, so that it is reported as a failed input
+            outFilePaths.push_back(input);
+            return;
+        }
+
+        size_t firstIndex = outFilePaths.size();
+        while (dirent *entry = readdir(directory))
+        {
+            std::string path = input + "/" + entry->d_name;
+            struct stat fileStat;
+            if ((stat(path.c_str(), &fileStat) != 0) || !S_ISREG(fileStat.st_mode))
+            {
+                continue;
+            }
+
+            // Other files, such as ones that are already QOI, Thumbs.db or a README, would only be reported as failures
+            // when encoding
+            if (isQoiOnly ? !HasExtension(entry->d_name, "qoi") : !IsImageFileName(entry->d_name))
+            {
+                continue;
+            }
+
+            outFilePaths.push_back(path);
+        }
+        closedir(directory);
+
+        std::sort(outFilePaths.begin() + firstIndex, outFilePaths.end());
+        return;
+    }
+
+    // Shells expand unquoted patterns themselves, but a quoted one gets here as is. A path that matches nothing,
+    // such as a mistyped file name, is kept as it is, so that it fails to open and is reported rather than skipped.
+    glob_t globResult;
+    if (glob(input.c_str(), GLOB_NOCHECK, nullptr, &globResult) == 0)
+    {
+        for (size_t i = 0; i < globResult.gl_pathc; ++i)
+        {
+            outFilePaths.push_back(globResult.gl_pathv[i]);
+        }
+    }
+    globfree(&globResult);
+}
+
+/**
+ * @brief Gets the path of the QOI file that the specified input file is converted to.
+ * @param[in] inputFilePath Path to the input image file
+ * @param[in] outputDirectory Directory where the QOI file will be written, or empty to write it next to the input
+ * @return Path to the output QOI file
+ */
+std::string BatchEncoder::GetOutputFilePath(const std::string &inputFilePath, const std::string &outputDirectory)
+{
+    size_t nameStart = inputFilePath.find_last_of('/');
+    nameStart = (nameStart == std::string::npos) ? 0 : nameStart + 1;
+
+    size_t extensionStart = inputFilePath.find_last_of('.');
+    if ((extensionStart == std::string::npos) || (extensionStart < nameStart))
+    {
+        extensionStart = inputFilePath.size();
+    }
+
+    if (outputDirectory.empty())
+    {
+        return inputFilePath.substr(0, extensionStart) + ".qoi";
+    }
+    return outputDirectory + "/" + inputFilePath.substr(nameStart, extensionStart - nameStart) + ".qoi";
+}
+
+/**
+ * @brief Removes the inputs that would be converted to the same QOI file as another input, such as a/x.png and
+ *        b/x.png with an output directory, or x.png and x.jpg without one, and reports each of them on stderr.
+ *        An input that is named more than once is kept once, since it only makes one file.
+ * @param[in,out] inputFilePaths Paths to the input image files, of which only the ones with an output of their own are kept
+ * @param[in] outputDirectory Directory where the QOI files will be written, or empty to write them next to the inputs
+ * @return Number of inputs that were removed because their output collides, which count as failed
+ */
+size_t BatchEncoder::RemoveCollidingInputs(std::vector<std::string> &inputFilePaths, const std::string &outputDirectory)
+{
+    // Two workers writing the same path would race on it, and only one of the images would survive
+    std::unordered_map<std::string, std::vector<std::string>> inputsByOutput;
+    std::vector<std::string> outputFilePaths;
+    outputFilePaths.reserve(inputFilePaths.size());
+    for (const std::string &inputFilePath : inputFilePaths)
+    {
+        outputFilePaths.push_back(GetOutputFilePath(inputFilePath, outputDirectory));
+        std::vector<std::string> &inputs = inputsByOutput[outputFilePaths.back()];
+        if (std::find(inputs.begin(), inputs.end(), inputFilePath) == inputs.end())
+        {
+            inputs.push_back(inputFilePath);
+        }
+    }
+
+    size_t numRemoved = 0;
+    std::vector<std::string> keptFilePaths;
+    keptFilePaths.reserve(inputFilePaths.size());
+    for (size_t i = 0; i < inputFilePaths.size(); ++i)
+    {
+        auto inputs = inputsByOutput.find(outputFilePaths[i]);
+        if (inputs == inputsByOutput.end())
+        {
+            // Already kept or reported under an earlier mention of the same input
+            continue;
+        }
+
+        if (inputs->second.size() == 1)
+        {
+            keptFilePaths.push_back(inputFilePaths[i]);
+        }
+        else
+        {
+            for (const std::string &inputFilePath : inputs->second)
+            {
+                std::cerr << inputFilePath << ": Output file " << outputFilePaths[i] << " would also be written for another input!" << std::endl;
+                ++numRemoved;
+            }
+        }
+        inputsByOutput.erase(inputs);
+    }
+
+    inputFilePaths.swap(keptFilePaths);
+    return numRemoved;
+}
+
+/**
+ * @brief Waits until the specified number of bytes fits in the memory budget, then reserves them.
+ *        A conversion that is larger than the whole budget runs once nothing else is in flight.
+ * @param[in] numBytes Number of bytes to reserve
+ */
+void BatchEncoder::AcquireMemory(size_t numBytes)
+{
+    std::unique_lock<std::mutex> lock(m_memoryMutex);
+    m_memoryReleased.wait(lock, [&]()
+    {
+        return (m_memoryInUse == 0) || (m_memoryInUse + numBytes <= m_memoryBudget);
+    });
+    m_memoryInUse += numBytes;
+}
+
+/**
+ * @brief Returns bytes reserved by AcquireMemory() to the budget.
+ * @param[in] numBytes Number of bytes to return
+ */
+void BatchEncoder::ReleaseMemory(size_t numBytes)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_memoryMutex);
+        m_memoryInUse -= numBytes;
+    }
+    m_memoryReleased.notify_all();
+}
@@ -0,0 +1,129 @@
+#ifndef BATCH_ENCODER_HEADER
+#define BATCH_ENCODER_HEADER
+
+#include "qoi_encoder.hpp"
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Class for converting many image files to QOI on a pool of worker threads.
+ *
+ * Every worker reserves an estimate of the memory its conversion needs before it decodes the input,
+ * and waits while the reservations of all workers would exceed the memory budget. This keeps peak
+ * memory bounded no matter how many files or threads there are.
+ */
+class BatchEncoder
+{
+public:
+    /**
+     * @brief Constructor
+     * @param[in] numThreads Number of worker threads, or 0 to use one per hardware thread
+     * @param[in] memoryBudget Maximum number of bytes that conversions in flight may use together
+     * @param[in] stripeRows Number of rows per independently decodable stripe, or 0 to write plain QOI files
+     * @param[in] maxPixels Largest number of pixels an input image may have, checked before it is decoded
+     * @param[in] writeOptions How every output file is made visible, and whether it is flushed to the storage device
+     */
+    BatchEncoder(size_t numThreads, size_t memoryBudget, uint32_t stripeRows = 0, uint64_t maxPixels = UINT64_MAX, const qoi::WriteOptions &writeOptions = qoi::WriteOptions());
+
+    /**
+     * @brief Destructor
+     */
+    ~BatchEncoder();
+
+    /**
+     * @brief Converts the specified image files to QOI.
+     * @param[in] inputFilePaths Paths to the input image files
+     * @param[in] outputDirectory Directory where the QOI files will be written, or empty to write them next to the inputs
+     * @param[in] isVerbose Flag indicating whether to print every converted file
+     * @return Number of files that could not be converted
+     */
+    size_t Run(const std::vector<std::string> &inputFilePaths, const std::string &outputDirectory, bool isVerbose = false);
+
+    /**
+     * @brief Collects the input files named by the specified argument: a directory, a glob pattern, or "-" for a list of paths on stdin.
+     * @param[in] input Directory, glob pattern, or "-"
+     * @param[out] outFilePaths Vector where the file paths will be appended
+     * @param[in] isQoiOnly Flag indicating whether to take only the QOI files of a directory, rather than the images stb_image can read
+     */
+    static void CollectInputs(const std::string &input, std::vector<std::string> &outFilePaths, bool isQoiOnly = false);
+
+    /**
+     * @brief Gets the path of the QOI file that the specified input file is converted to.
+     * @param[in] inputFilePath Path to the input image file
+     * @param[in] outputDirectory Directory where the QOI file will be written, or empty to write it next to the input
+     * @return Path to the output QOI file
+     */
+    static std::string GetOutputFilePath(const std::string &inputFilePath, const std::string &outputDirectory);
+
+    /**
+     * @brief Removes the inputs that would be converted to the same QOI file as another input, such as a/x.png and
+     *        b/x.png with an output directory, or x.png and x.jpg without one, and reports each of them on stderr.
+     *        An input that is named more than once is kept once, since it only makes one file.
+     * @param[in,out] inputFilePaths Paths to the input image files, of which only the ones with an output of their own are kept
+     * @param[in] outputDirectory Directory where the QOI files will be written, or empty to write them next to the inputs
+     * @return Number of inputs that were removed because their output collides, which count as failed
+     */
+    static size_t RemoveCollidingInputs(std::vector<std::string> &inputFilePaths, const std::string &outputDirectory);
+
+private:
+    /**
+     * @brief Waits until the specified number of bytes fits in the memory budget, then reserves them.
+     *        A conversion that is larger than the whole budget runs once nothing else is in flight.
+     * @param[in] numBytes Number of bytes to reserve
+     */
+    void AcquireMemory(size_t numBytes);
+
+    /**
+     * @brief Returns bytes reserved by AcquireMemory() to the budget.
+     * @param[in] numBytes Number of bytes to return
+     */
+    void ReleaseMemory(size_t numBytes);
+
+private:
+    /**
+     * Number of worker threads
+     */
+    size_t m_numThreads;
+
+    /**
+     * Maximum number of bytes that conversions in flight may use together
+     */
+    size_t m_memoryBudget;
+
+    /**
+     * Number of rows per independently decodable stripe, or 0 to write plain QOI files
+     */
+    uint32_t m_stripeRows;
+
+    /**
+     * Largest number of pixels an input image may have
+     */
+    uint64_t m_maxPixels;
+
+    /**
+     * How every output file is made visible, and whether it is flushed to the storage device
+     */
+    qoi::WriteOptions m_writeOptions;
+
+    /**
+     * Number of bytes currently reserved by conversions in flight
+     */
+    size_t m_memoryInUse;
+
+    /**
+     * Mutex guarding m_memoryInUse
+     */
+    std::mutex m_memoryMutex;
+
+    /**
+     * Signalled whenever memory is returned to the budget
+     */
+    std::condition_variable m_memoryReleased;
+};
+
+#endif // BATCH_ENCODER_HEADER
@@ -0,0 +1,380 @@
+#include "Converter.hpp"
+
+#include "qoi_decoder.hpp"
+#include "qoi_encoder.hpp"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <system_error>
+#include <vector>
+
+namespace
+{
+/**
+ * Size by which the buffer grows while reading an input of unknown size, such as a pipe
+ */
+const size_t READ_CHUNK_SIZE = 1 << 20;
+
+/**
+ * @brief Reads a whole file into memory until it ends, for inputs that cannot be mapped, such as a pipe.
+ * @param[in] filePath Path to the file, or "-" to read stdin
+ * @param[out] outBytes Contents of the file
+ * @return Flag indicating whether the whole file was read or not.
+ */
+bool ReadWholeFile(const std::string &filePath, std::vector<uint8_t> &outBytes)
+{
+    const bool isStdin = (filePath == "-");
+    int fd = isStdin ? STDIN_FILENO : open(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    // Stdin may still be a regular file, whose size is known. One byte more, so that the end is seen without growing the buffer.
+    struct stat fileStatus;
+    size_t expectedSize = 0;
+    if ((fstat(fd, &fileStatus) == 0) && S_ISREG(fileStatus.st_mode))
+    {
+        expectedSize = static_cast<size_t>(fileStatus.st_size);
+    }
+    outBytes.resize(std::max(expectedSize + 1, READ_CHUNK_SIZE));
+    size_t size = 0;
+    bool isSuccess = true;
+    while (true)
+    {
+        if (size == outBytes.size())
+        {
+            outBytes.resize(outBytes.size() + std::max(READ_CHUNK_SIZE, outBytes.size() / 2));
+        }
+
+        ssize_t numRead = read(fd, outBytes.data() + size, outBytes.size() - size);
+        if (numRead < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            isSuccess = false;
+            break;
+        }
+        if (numRead == 0)
+        {
+            break;
+        }
+        size += static_cast<size_t>(numRead);
+    }
+
+    if (!isStdin)
+    {
+        close(fd);
+    }
+    outBytes.resize(size);
+    return isSuccess;
+}
+
+/**
+ * @brief Writes all the specified bytes to a file descriptor, continuing after partial writes (as to a pipe).
+ * @param[in] fd File descriptor
+ * @param[in] data Pointer to the bytes
+ * @param[in] size Number of bytes
+ * @return Flag indicating whether all bytes were written or not.
+ */
+bool WriteAll(int fd, const uint8_t *data, size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t written = write(fd, data, size);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        size -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+/**
+ * @brief Gets the number of channels that QOI stores for an image with the specified number of channels, as QOI has
+ *        no gray formats: gray is expanded to RGB, and gray with alpha to RGBA.
+ * @param[in] numChannels Number of channels in the image, from 1 to 4
+ * @return 3 or 4
+ */
+int GetQoiNumChannels(int numChannels)
+{
+    return ((numChannels == 2) || (numChannels == 4)) ? 4 : 3;
+}
+
+/**
+ * Pixels decoded by stb_image, freed with stbi_image_free()
+ */
+typedef std::unique_ptr<stbi_uc, void (*)(void *)> StbiPixels;
+
+/**
+ * @brief Decodes an image held in memory with stb_image, unless it is QOI already or has too many pixels.
+ * @param[in] inputBytes Pointer to the bytes of the image file
+ * @param[in] inputSize Size of the image file in bytes
+ * @param[in] maxPixels Largest number of pixels the image may have, checked before it is decoded
+ * @param[out] outWidth Image width
+ * @param[out] outHeight Image height
+ * @param[out] outNumChannels Number of channels in the decoded pixels, 3 or 4 as gray images are expanded
+ * @param[out] outError Description of what went wrong, if the image could not be decoded
+ * @return Decoded pixels, with the rows tightly packed, or nullptr if the image could not be decoded
+ */
+StbiPixels LoadPixels(const uint8_t *inputBytes, size_t inputSize, uint64_t maxPixels, int &outWidth, int &outHeight, int &outNumChannels, std::string &outError)
+{
+    StbiPixels pixels(nullptr, stbi_image_free);
+
+    // Check if the input file happens to be in QOI format already by checking the first four bytes.
+    // If it is, then we don't do anything.
+    if ((inputSize >= 4) && (std::memcmp(inputBytes, "qoif", 4) == 0))
+    {
+        outError = "Input image file is already in QOI format!";
+        return pixels;
+    }
+
+    // stb_image takes the size of the input as an int
+    if (inputSize > static_cast<size_t>(INT_MAX))
+    {
+        outError = "Input image file is too large!";
+        return pixels;
+    }
+
+    // stb_image reads the dimensions from the header alone, so an image that is too large is never decoded
+    int numChannels = 0;
+    const bool hasInfo = (stbi_info_from_memory(inputBytes, static_cast<int>(inputSize), &outWidth, &outHeight, &numChannels) != 0);
+    if (hasInfo && (static_cast<uint64_t>(outWidth) * static_cast<uint64_t>(outHeight) > maxPixels))
+    {
+        outError = "Input image has more than " + std::to_string(maxPixels) + " pixels!";
+        return pixels;
+    }
+
+    // The encoder reads the pixels straight from stb_image's buffer, which is freed on every way out. Gray images
+    // are expanded by stb_image while it decodes them, since the encoder only takes RGB and RGBA.
+    const int desiredNumChannels = hasInfo ? GetQoiNumChannels(numChannels) : 0;
+    pixels.reset(stbi_load_from_memory(inputBytes, static_cast<int>(inputSize), &outWidth, &outHeight, &numChannels, desiredNumChannels));
+    if (!pixels)
+    {
+        outError = "Cannot read input image file!";
+        return pixels;
+    }
+    outNumChannels = (desiredNumChannels != 0) ? desiredNumChannels : numChannels;
+    return pixels;
+}
+
+/**
+ * @brief Encodes the pixels decoded by stb_image to QOI format in memory, striped if asked to.
+ * @param[in] pixels Pointer to the pixels, with the rows tightly packed
+ * @param[in] width Image width
+ * @param[in] height Image height
+ * @param[in] numChannels Number of channels in the image
+ * @param[in] stripeRows Number of rows per independently decodable stripe, or 0 to encode a plain QOI image
+ * @param[out] outBytes Array of bytes where the QOI image will be stored
+ * @return Flag indicating whether the image could be encoded or not.
+ */
+bool EncodeToBytes(const uint8_t *pixels, int width, int height, int numChannels, uint32_t stripeRows, std::vector<uint8_t> &outBytes)
+{
+    // stb_image packs the rows tightly
+    const size_t rowStride = static_cast<size_t>(width) * static_cast<size_t>(numChannels);
+    const size_t pixelBytes = rowStride * static_cast<size_t>(height);
+    if (stripeRows > 0)
+    {
+        // The stripes of a single image are encoded in parallel
+        return qoi::EncodeStriped(pixels, pixelBytes, rowStride, width, height, numChannels, 0, stripeRows, 0, outBytes);
+    }
+    return qoi::Encode(pixels, pixelBytes, rowStride, width, height, numChannels, 0, outBytes);
+}
+
+/**
+ * @brief Estimates how much memory converting an image with the specified properties to QOI needs at its peak.
+ * @param[in] width Image width
+ * @param[in] height Image height
+ * @param[in] numChannels Number of channels in the image, as stb_image reports it
+ * @return Estimated peak memory in bytes
+ */
+size_t EstimateMemory(int width, int height, int numChannels)
+{
+    // stb_image's pixels, with gray expanded as LoadPixels() asks for, about as much again while it decodes them (a
+    // PNG is inflated whole before it is unfiltered), and the worst-case encoded output. The encoder reads the pixels
+    // in place, so there is no copy of them. Counted in 64 bits, and anything that does not fit in memory asks for all of it.
+    const int qoiNumChannels = GetQoiNumChannels(numChannels);
+    uint64_t pixelBytes = static_cast<uint64_t>(width) * static_cast<uint64_t>(height) * static_cast<uint64_t>(qoiNumChannels);
+    uint64_t memoryNeeded = 2 * pixelBytes + qoi::MaxEncodedSize(width, height, qoiNumChannels);
+    return static_cast<size_t>(std::min<uint64_t>(memoryNeeded, std::numeric_limits<size_t>::max()));
+}
+}
+
+/**
+ * @brief Converts an image file in any format that stb_image can read to a QOI image file.
+ *        The input is read only once, into memory, so it may also be a pipe.
+ * @param[in] inputFilePath Path to the input image file, or "-" to read it from stdin
+ * @param[in] outputFilePath Path to the output QOI file, or "-" to write it to stdout
+ * @param[out] outError Description of what went wrong, if the conversion failed
+ * @param[in] stripeRows Number of rows per independently decodable stripe, or 0 to write a plain QOI file
+ * @param[in] maxPixels Largest number of pixels an input image may have, checked before it is decoded
+ * @param[in] writeOptions How the output file is made visible, and whether it is flushed to the storage device
+ * @return Flag indicating whether the conversion was successful or not.
+ */
+bool ConvertToQoi(const std::string &inputFilePath, const std::string &outputFilePath, std::string &outError, uint32_t stripeRows, uint64_t maxPixels, const qoi::WriteOptions &writeOptions)
+{
+    // Regular files are mapped rather than copied, anything else is read until it ends
+    std::unique_ptr<qoi::MappedFile> mappedFile(new qoi::MappedFile());
+    std::vector<uint8_t> readBytes;
+    const uint8_t *inputBytes = nullptr;
+    size_t inputSize = 0;
+    if ((inputFilePath != "-") && mappedFile->Open(inputFilePath))
+    {
+        inputBytes = mappedFile->data;
+        inputSize = mappedFile->size;
+    }
+    else if (ReadWholeFile(inputFilePath, readBytes))
+    {
+        inputBytes = readBytes.data();
+        inputSize = readBytes.size();
+    }
+    else
+    {
+        outError = "Cannot read input image file!";
+        return false;
+    }
+
+    int inputImageWidth = 0, inputImageHeight = 0, inputImageNumChannels = 0;
+    StbiPixels pixels = LoadPixels(inputBytes, inputSize, maxPixels, inputImageWidth, inputImageHeight, inputImageNumChannels, outError);
+    if (!pixels)
+    {
+        return false;
+    }
+
+    // The compressed input is not needed any more, so don't keep it around while encoding
+    mappedFile.reset();
+    std::vector<uint8_t>().swap(readBytes);
+
+    // stb_image packs the rows tightly
+    const size_t rowStride = static_cast<size_t>(inputImageWidth) * static_cast<size_t>(inputImageNumChannels);
+    const size_t pixelBytes = rowStride * static_cast<size_t>(inputImageHeight);
+
+    const bool isStdout = (outputFilePath == "-");
+    if ((stripeRows > 0) || isStdout)
+    {
+        // The stripes of a single image are encoded in parallel. Output to stdout is encoded into memory first too.
+        std::vector<uint8_t> bytes;
+        if (!EncodeToBytes(pixels.get(), inputImageWidth, inputImageHeight, inputImageNumChannels, stripeRows, bytes))
+        {
+            outError = "Failed to encode " + inputFilePath + " to QOI format!";
+            return false;
+        }
+
+        // All of the image goes out in one write, so a pipe reader sees the image at once
+        if (isStdout)
+        {
+            if (!WriteAll(STDOUT_FILENO, bytes.data(), bytes.size()))
+            {
+                outError = "Cannot write to stdout!";
+                return false;
+            }
+            return true;
+        }
+
+        qoi::FileWriter writer;
+        int error = writer.Open(outputFilePath, bytes.size(), writeOptions);
+        if (error == 0)
+        {
+            error = writer.Write(bytes.data(), bytes.size());
+        }
+        if (error == 0)
+        {
+            error = writer.Commit();
+        }
+        if (error != 0)
+        {
+            outError = "Cannot write output file " + outputFilePath + ": " + std::generic_category().message(error) + "!";
+            return false;
+        }
+    }
+    else
+    {
+        int error = 0;
+        if (!qoi::Encode(pixels.get(), pixelBytes, rowStride, inputImageWidth, inputImageHeight, inputImageNumChannels, 0, outputFilePath, writeOptions, error))
+        {
+            outError = (error == EINVAL) ? "Failed to encode " + inputFilePath + " to QOI format!"
+                                         : "Cannot write output file " + outputFilePath + ": " + std::generic_category().message(error) + "!";
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Estimates how much memory converting the specified image file to QOI needs at its peak, without decoding it.
+ * @param[in] inputFilePath Path to the input image file
+ * @return Estimated peak memory in bytes, or 0 if the image file cannot be read
+ */
+size_t EstimateConversionMemory(const std::string &inputFilePath)
+{
+    int width = 0, height = 0, numChannels = 0;
+    if (stbi_info(inputFilePath.c_str(), &width, &height, &numChannels) == 0)
+    {
+        return 0;
+    }
+
+    return EstimateMemory(width, height, numChannels);
+}
+
+/**
+ * @brief Estimates how much memory converting the specified image file, already in memory, to QOI needs at its peak.
+ * @param[in] inputBytes Pointer to the bytes of the image file
+ * @param[in] inputSize Size of the image file in bytes
+ * @return Estimated peak memory in bytes, or 0 if the header of the image cannot be read
+ */
+size_t EstimateConversionMemory(const uint8_t *inputBytes, size_t inputSize)
+{
+    int width = 0, height = 0, numChannels = 0;
+    if ((inputSize > static_cast<size_t>(INT_MAX)) || (stbi_info_from_memory(inputBytes, static_cast<int>(inputSize), &width, &height, &numChannels) == 0))
+    {
+        return 0;
+    }
+    return EstimateMemory(width, height, numChannels);
+}
+
+/**
+ * @brief Converts an image file held in memory, in any format that stb_image can read, to a QOI image in memory.
+ * @param[in] inputBytes Pointer to the bytes of the image file
+ * @param[in] inputSize Size of the image file in bytes
+ * @param[out] outBytes Array of bytes where the QOI image will be stored
+ * @param[out] outError Description of what went wrong, if the conversion failed
+ * @param[in] stripeRows Number of rows per independently decodable stripe, or 0 to encode a plain QOI image
+ * @param[in] maxPixels Largest number of pixels the image may have, checked before it is decoded
+ * @return Flag indicating whether the conversion was successful or not.
+ */
+bool ConvertToQoi(const uint8_t *inputBytes, size_t inputSize, std::vector<uint8_t> &outBytes, std::string &outError, uint32_t stripeRows, uint64_t maxPixels)
+{
+    int width = 0, height = 0, numChannels = 0;
+    StbiPixels pixels = LoadPixels(inputBytes, inputSize, maxPixels, width, height, numChannels, outError);
+    if (!pixels)
+    {
+        return false;
+    }
+
+    if (!EncodeToBytes(pixels.get(), width, height, numChannels, stripeRows, outBytes))
+    {
+        outError = "Failed to encode the image to QOI format!";
+        return false;
+    }
+    return true;
+}
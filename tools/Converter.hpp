@@ -0,0 +1,51 @@
+#ifndef CONVERTER_HEADER
+#define CONVERTER_HEADER
+
+#include "qoi_encoder.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Converts an image file in any format that stb_image can read to a QOI image file.
+ *        The input is read only once, into memory, so it may also be a pipe.
+ * @param[in] inputFilePath Path to the input image file, or "-" to read it from stdin
+ * @param[in] outputFilePath Path to the output QOI file, or "-" to write it to stdout
+ * @param[out] outError Description of what went wrong, if the conversion failed
+ * @param[in] stripeRows Number of rows per independently decodable stripe, or 0 to write a plain QOI file
+ * @param[in] maxPixels Largest number of pixels an input image may have, checked before it is decoded
+ * @param[in] writeOptions How the output file is made visible, and whether it is flushed to the storage device
+ * @return Flag indicating whether the conversion was successful or not.
+ */
+bool ConvertToQoi(const std::string &inputFilePath, const std::string &outputFilePath, std::string &outError, uint32_t stripeRows = 0, uint64_t maxPixels = UINT64_MAX, const qoi::WriteOptions &writeOptions = qoi::WriteOptions());
+
+/**
+ * @brief Converts an image file held in memory, in any format that stb_image can read, to a QOI image in memory.
+ * @param[in] inputBytes Pointer to the bytes of the image file
+ * @param[in] inputSize Size of the image file in bytes
+ * @param[out] outBytes Array of bytes where the QOI image will be stored
+ * @param[out] outError Description of what went wrong, if the conversion failed
+ * @param[in] stripeRows Number of rows per independently decodable stripe, or 0 to encode a plain QOI image
+ * @param[in] maxPixels Largest number of pixels the image may have, checked before it is decoded
+ * @return Flag indicating whether the conversion was successful or not.
+ */
+bool ConvertToQoi(const uint8_t *inputBytes, size_t inputSize, std::vector<uint8_t> &outBytes, std::string &outError, uint32_t stripeRows = 0, uint64_t maxPixels = UINT64_MAX);
+
+/**
+ * @brief Estimates how much memory converting the specified image file to QOI needs at its peak, without decoding it.
+ * @param[in] inputFilePath Path to the input image file
+ * @return Estimated peak memory in bytes, or 0 if the image file cannot be read
+ */
+size_t EstimateConversionMemory(const std::string &inputFilePath);
+
+/**
+ * @brief Estimates how much memory converting the specified image file, already in memory, to QOI needs at its peak.
+ * @param[in] inputBytes Pointer to the bytes of the image file
+ * @param[in] inputSize Size of the image file in bytes
+ * @return Estimated peak memory in bytes, or 0 if the header of the image cannot be read
+ */
+size_t EstimateConversionMemory(const uint8_t *inputBytes, size_t inputSize);
+
+#endif // CONVERTER_HEADER
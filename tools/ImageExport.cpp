@@ -0,0 +1,552 @@
+#include "ImageExport.hpp"
+
+#include "qoi_decoder.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+namespace
+{
+/**
+ * Formats that a QOI image can be decoded to
+ */
+enum class ExportFormat
+{
+    RGBA,
+    RGB,
+    PPM,
+    PAM,
+    PNG
+};
+
+/**
+ * Size of the pieces in which the QOI file is read and handed to the decoder
+ */
+const size_t READ_SIZE = 1 << 20;
+
+/**
+ * Largest number of bytes in a stored (uncompressed) deflate block
+ */
+const size_t MAX_STORED_BLOCK_SIZE = 65535;
+
+/**
+ * Largest number of stored deflate blocks, with their 5-byte headers, that fit in one PNG chunk of at most 2^31 - 1
+ * bytes, next to the zlib header and checksum
+ */
+const size_t MAX_BLOCKS_PER_CHUNK = (0x7FFFFFFF - 6) / (MAX_STORED_BLOCK_SIZE + 5);
+
+/**
+ * @brief Looks up the output format with the specified name.
+ * @param[in] name Name of the format, which is also its file extension
+ * @param[out] outFormat Output format
+ * @return Flag indicating whether the name is a known format or not.
+ */
+bool ParseFormat(const std::string &name, ExportFormat &outFormat)
+{
+    const struct
+    {
+        const char *name;
+        ExportFormat format;
+    } FORMATS[] = {
+        { "rgba", ExportFormat::RGBA },
+        { "rgb", ExportFormat::RGB },
+        { "ppm", ExportFormat::PPM },
+        { "pam", ExportFormat::PAM },
+        { "png", ExportFormat::PNG },
+    };
+
+    for (const auto &entry : FORMATS)
+    {
+        if (name == entry.name)
+        {
+            outFormat = entry.format;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Updates a CRC-32 (as used by PNG) with the specified bytes.
+ *        Eight bytes are folded in at a time through eight tables, rather than one byte per table lookup,
+ *        since the CRC covers every pixel of a PNG file.
+ * @param[in] crc CRC of the bytes so far, starting from 0
+ * @param[in] data Pointer to the bytes
+ * @param[in] size Number of bytes
+ * @return CRC of all bytes
+ */
+uint32_t UpdateCrc32(uint32_t crc, const uint8_t *data, size_t size)
+{
+    typedef std::array<std::array<uint32_t, 256>, 8> CrcTables;
+    static const CrcTables TABLES = []()
+    {
+        CrcTables tables;
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            uint32_t value = i;
+            for (int bit = 0; bit < 8; ++bit)
+            {
+                value = (value & 1) ? (0xEDB88320u ^ (value >> 1)) : (value >> 1);
+            }
+            tables[0][i] = value;
+        }
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            for (size_t table = 1; table < 8; ++table)
+            {
+                tables[table][i] = tables[0][tables[table - 1][i] & 0xFF] ^ (tables[table - 1][i] >> 8);
+            }
+        }
+        return tables;
+    }();
+
+    crc = ~crc;
+    for (; size >= 8; size -= 8, data += 8)
+    {
+        const uint32_t low = crc ^ (static_cast<uint32_t>(data[0]) | (static_cast<uint32_t>(data[1]) << 8) | (static_cast<uint32_t>(data[2]) << 16) | (static_cast<uint32_t>(data[3]) << 24));
+        crc = TABLES[7][low & 0xFF] ^ TABLES[6][(low >> 8) & 0xFF] ^ TABLES[5][(low >> 16) & 0xFF] ^ TABLES[4][low >> 24] ^
+              TABLES[3][data[4]] ^ TABLES[2][data[5]] ^ TABLES[1][data[6]] ^ TABLES[0][data[7]];
+    }
+    for (; size > 0; --size, ++data)
+    {
+        crc = TABLES[0][(crc ^ *data) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+/**
+ * @brief Stores a 32-bit value in big-endian byte order, as PNG has all its numbers.
+ * @param[in] value Value
+ * @param[out] out Pointer to where the 4 bytes will be stored
+ */
+void StoreUint32(uint32_t value, uint8_t *out)
+{
+    out[0] = static_cast<uint8_t>(value >> 24);
+    out[1] = static_cast<uint8_t>(value >> 16);
+    out[2] = static_cast<uint8_t>(value >> 8);
+    out[3] = static_cast<uint8_t>(value);
+}
+
+/**
+ * Class for writing decoded rows to an output stream in one of the export formats, one row at a time.
+ * It keeps at most a single row worth of memory, for converting channels.
+ */
+class RowWriter
+{
+public:
+    /**
+     * @brief Constructor
+     * @param[in] out Stream to write to
+     * @param[in] format Output format
+     * @param[in] imageWidth Width of the image
+     * @param[in] imageHeight Height of the image
+     * @param[in] numChannels Number of color channels in the decoded rows
+     */
+    RowWriter(std::ostream &out, ExportFormat format, uint32_t imageWidth, uint32_t imageHeight, uint8_t numChannels)
+        : m_out(out)
+        , m_format(format)
+        , m_imageWidth(imageWidth)
+        , m_imageHeight(imageHeight)
+        , m_numChannels(numChannels)
+        , m_outputChannels(numChannels)
+        , m_rowIndex(0)
+        , m_adler(1)
+        , m_crc(0)
+    {
+        if ((format == ExportFormat::RGBA) || (format == ExportFormat::RGB) || (format == ExportFormat::PPM))
+        {
+            m_outputChannels = (format == ExportFormat::RGBA) ? 4 : 3;
+        }
+    }
+
+    /**
+     * @brief Checks that the format can hold the image, and writes its header.
+     * @param[out] outError Description of what went wrong, if the format cannot hold the image
+     * @return Flag indicating whether the header was written or not.
+     */
+    bool WriteHeader(std::string &outError)
+    {
+        const std::string width = std::to_string(m_imageWidth);
+        const std::string height = std::to_string(m_imageHeight);
+        if (m_format == ExportFormat::PPM)
+        {
+            m_out << "P6\n" << width << " " << height << "\n255\n";
+        }
+        else if (m_format == ExportFormat::PAM)
+        {
+            m_out << "P7\nWIDTH " << width << "\nHEIGHT " << height << "\nDEPTH " << static_cast<int>(m_numChannels)
+                  << "\nMAXVAL 255\nTUPLTYPE " << ((m_numChannels == 4) ? "RGB_ALPHA" : "RGB") << "\nENDHDR\n";
+        }
+        else if (m_format == ExportFormat::PNG)
+        {
+            if ((m_imageWidth == 0) || (m_imageHeight == 0) || (m_imageWidth > 0x7FFFFFFF) || (m_imageHeight > 0x7FFFFFFF))
+            {
+                outError = "PNG cannot hold an image of " + width + " x " + height + " pixels!";
+                return false;
+            }
+
+            static const uint8_t SIGNATURE[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+            m_out.write(reinterpret_cast<const char *>(SIGNATURE), sizeof(SIGNATURE));
+
+            // 8 bits per channel, truecolor with or without alpha, no interlacing
+            uint8_t fields[13];
+            StoreUint32(m_imageWidth, fields);
+            StoreUint32(m_imageHeight, fields + 4);
+            fields[8] = 8;
+            fields[9] = (m_numChannels == 4) ? 6 : 2;
+            fields[10] = fields[11] = fields[12] = 0;
+            BeginChunk("IHDR", sizeof(fields));
+            WriteChunkData(fields, sizeof(fields));
+            EndChunk();
+        }
+        return true;
+    }
+
+    /**
+     * @brief Writes the next row of the image.
+     * @param[in] row Pointer to the decoded row
+     */
+    void WriteRow(const uint8_t *row)
+    {
+        const uint8_t *pixels = ConvertRow(row);
+        const size_t rowSize = static_cast<size_t>(m_imageWidth) * m_outputChannels;
+        if (m_format != ExportFormat::PNG)
+        {
+            m_out.write(reinterpret_cast<const char *>(pixels), rowSize);
+            ++m_rowIndex;
+            return;
+        }
+
+        // Every row goes into IDAT chunks of its own, with the row in stored deflate blocks. The zlib stream
+        // starts in the first chunk and ends in the last, so the chunks join up into one valid stream.
+        // The filter type (none) comes before the pixels of each row, and both are split into blocks together.
+        // A chunk holds at most 2^31 - 1 bytes, so a row wider than that is split over several chunks of whole blocks.
+        const bool isFirstRow = (m_rowIndex == 0);
+        const bool isLastRow = (m_rowIndex + 1 == m_imageHeight);
+        const size_t dataSize = rowSize + 1;
+        size_t offset = 0;
+        while (offset < dataSize)
+        {
+            const size_t chunkEnd = offset + std::min(dataSize - offset, MAX_BLOCKS_PER_CHUNK * MAX_STORED_BLOCK_SIZE);
+            const size_t numBlocks = (chunkEnd - offset + MAX_STORED_BLOCK_SIZE - 1) / MAX_STORED_BLOCK_SIZE;
+            const bool isFirstChunk = isFirstRow && (offset == 0);
+            const bool isLastChunk = isLastRow && (chunkEnd == dataSize);
+            BeginChunk("IDAT", static_cast<uint32_t>((isFirstChunk ? 2 : 0) + numBlocks * 5 + (chunkEnd - offset) + (isLastChunk ? 4 : 0)));
+            if (isFirstChunk)
+            {
+                // Deflate with a 32K window, no preset dictionary, fastest compression (CMF * 256 + FLG is a multiple of 31)
+                const uint8_t zlibHeader[] = { 0x78, 0x01 };
+                WriteChunkData(zlibHeader, sizeof(zlibHeader));
+            }
+
+            while (offset < chunkEnd)
+            {
+                const size_t blockSize = std::min(MAX_STORED_BLOCK_SIZE, chunkEnd - offset);
+                const bool isFinal = isLastChunk && (offset + blockSize == dataSize);
+                uint8_t blockHeader[6] = { static_cast<uint8_t>(isFinal ? 1 : 0), static_cast<uint8_t>(blockSize), static_cast<uint8_t>(blockSize >> 8),
+                                           static_cast<uint8_t>(~blockSize), static_cast<uint8_t>(~blockSize >> 8), 0 };
+
+                // The first block also takes the filter type, which is the last byte of its header here
+                size_t headerSize = 5;
+                size_t pixelBytes = blockSize;
+                if (offset == 0)
+                {
+                    UpdateAdler(blockHeader + 5, 1);
+                    ++headerSize;
+                    --pixelBytes;
+                }
+                const uint8_t *blockPixels = pixels + ((offset == 0) ? 0 : offset - 1);
+                WriteChunkData(blockHeader, headerSize);
+                WriteChunkData(blockPixels, pixelBytes);
+                UpdateAdler(blockPixels, pixelBytes);
+                offset += blockSize;
+            }
+
+            if (isLastChunk)
+            {
+                uint8_t adler[4];
+                StoreUint32(m_adler, adler);
+                WriteChunkData(adler, sizeof(adler));
+            }
+            EndChunk();
+        }
+        ++m_rowIndex;
+    }
+
+    /**
+     * @brief Writes whatever the format needs after the last row.
+     */
+    void WriteEnd()
+    {
+        if (m_format == ExportFormat::PNG)
+        {
+            BeginChunk("IEND", 0);
+            EndChunk();
+        }
+        m_out.flush();
+    }
+
+private:
+    /**
+     * @brief Converts a decoded row to the number of channels of the output format, if they differ.
+     * @param[in] row Pointer to the decoded row
+     * @return Pointer to the row in the output channels
+     */
+    const uint8_t *ConvertRow(const uint8_t *row)
+    {
+        if (m_outputChannels == m_numChannels)
+        {
+            return row;
+        }
+
+        m_row.resize(static_cast<size_t>(m_imageWidth) * m_outputChannels);
+        uint8_t *out = m_row.data();
+        for (uint32_t x = 0; x < m_imageWidth; ++x)
+        {
+            out[0] = row[0];
+            out[1] = row[1];
+            out[2] = row[2];
+            if (m_outputChannels == 4)
+            {
+                // Opaque, as an RGB image is
+                out[3] = 255;
+            }
+            row += m_numChannels;
+            out += m_outputChannels;
+        }
+        return m_row.data();
+    }
+
+    /**
+     * @brief Starts a PNG chunk by writing its length and type.
+     * @param[in] type Four-letter type of the chunk
+     * @param[in] length Number of bytes of data in the chunk
+     */
+    void BeginChunk(const char *type, uint32_t length)
+    {
+        uint8_t chunkHeader[8];
+        StoreUint32(length, chunkHeader);
+        std::memcpy(chunkHeader + 4, type, 4);
+        m_out.write(reinterpret_cast<const char *>(chunkHeader), sizeof(chunkHeader));
+        m_crc = UpdateCrc32(0, chunkHeader + 4, 4);
+    }
+
+    /**
+     * @brief Writes data of the current PNG chunk.
+     * @param[in] data Pointer to the data
+     * @param[in] size Number of bytes
+     */
+    void WriteChunkData(const uint8_t *data, size_t size)
+    {
+        m_out.write(reinterpret_cast<const char *>(data), size);
+        m_crc = UpdateCrc32(m_crc, data, size);
+    }
+
+    /**
+     * @brief Ends the current PNG chunk by writing its CRC.
+     */
+    void EndChunk()
+    {
+        uint8_t crc[4];
+        StoreUint32(m_crc, crc);
+        m_out.write(reinterpret_cast<const char *>(crc), sizeof(crc));
+    }
+
+    /**
+     * @brief Updates the Adler-32 checksum that ends the zlib stream with the specified uncompressed bytes.
+     * @param[in] data Pointer to the bytes
+     * @param[in] size Number of bytes
+     */
+    void UpdateAdler(const uint8_t *data, size_t size)
+    {
+        uint32_t a = m_adler & 0xFFFF;
+        uint32_t b = m_adler >> 16;
+        while (size > 0)
+        {
+            // 5552 is the most bytes that can be summed before b may overflow 32 bits
+            size_t count = std::min<size_t>(size, 5552);
+            for (size_t i = 0; i < count; ++i)
+            {
+                a += data[i];
+                b += a;
+            }
+            a %= 65521;
+            b %= 65521;
+            data += count;
+            size -= count;
+        }
+        m_adler = (b << 16) | a;
+    }
+
+    /**
+     * Stream to write to
+     */
+    std::ostream &m_out;
+
+    /**
+     * Output format
+     */
+    ExportFormat m_format;
+
+    /**
+     * Width of the image
+     */
+    uint32_t m_imageWidth;
+
+    /**
+     * Height of the image
+     */
+    uint32_t m_imageHeight;
+
+    /**
+     * Number of color channels in the decoded rows
+     */
+    uint8_t m_numChannels;
+
+    /**
+     * Number of color channels in the output
+     */
+    uint8_t m_outputChannels;
+
+    /**
+     * Index of the next row to write
+     */
+    uint32_t m_rowIndex;
+
+    /**
+     * Adler-32 checksum of the uncompressed PNG data so far
+     */
+    uint32_t m_adler;
+
+    /**
+     * Row converted to the output channels
+     */
+    std::vector<uint8_t> m_row;
+
+    /**
+     * CRC of the current PNG chunk so far
+     */
+    uint32_t m_crc;
+};
+}
+
+/**
+ * @brief Decodes a QOI image file to raw pixels, a PPM or PAM file, or a PNG file with uncompressed data.
+ *        Rows go from the decoder to the output as soon as they are decoded, so only one row is ever in memory.
+ * @param[in] inputFilePath Path to the QOI file, or "-" to read it from stdin
+ * @param[in] outputFilePath Path to the output file, or "-" to write to stdout
+ * @param[in] format "rgba", "rgb", "ppm", "pam" or "png", or empty to pick it from the extension of the output file
+ * @param[out] outError Description of what went wrong, if the conversion failed
+ * @param[in] maxPixels Largest number of pixels the image may have, checked before it is decoded
+ * @return Flag indicating whether the conversion was successful or not.
+ */
+bool ConvertFromQoi(const std::string &inputFilePath, const std::string &outputFilePath, const std::string &format, std::string &outError, uint64_t maxPixels)
+{
+    const bool isStdout = (outputFilePath == "-");
+    std::string formatName = format;
+    if (formatName.empty() && !isStdout)
+    {
+        size_t dotIndex = outputFilePath.find_last_of('.');
+        if ((dotIndex != std::string::npos) && (outputFilePath.find_first_of('/', dotIndex) == std::string::npos))
+        {
+            formatName = outputFilePath.substr(dotIndex + 1);
+        }
+    }
+
+    ExportFormat exportFormat;
+    if (!ParseFormat(formatName, exportFormat))
+    {
+        outError = formatName.empty() ? "Cannot tell the output format, specify one with -f!" : "Unknown output format " + formatName + "!";
+        return false;
+    }
+
+    const bool isStdin = (inputFilePath == "-");
+    std::ifstream inputFileStream;
+    if (!isStdin)
+    {
+        inputFileStream.open(inputFilePath, std::ios::binary);
+    }
+    std::istream &inputFile = isStdin ? std::cin : inputFileStream;
+    if (inputFile.fail())
+    {
+        outError = "Cannot read input file " + inputFilePath + "!";
+        return false;
+    }
+
+    std::unique_ptr<RowWriter> writer;
+    qoi::StreamDecoder decoder([&](const uint8_t *row, uint32_t)
+    {
+        writer->WriteRow(row);
+    });
+    decoder.SetLimits(qoi::DecodeLimits(maxPixels));
+
+    // Only open the output once the header was read, so that a file that is not QOI leaves nothing behind
+    char header[14];
+    inputFile.read(header, sizeof(header));
+    decoder.Push(reinterpret_cast<const uint8_t *>(header), static_cast<size_t>(inputFile.gcount()));
+    qoi::DecodeError error = decoder.Finish();
+    if (!decoder.HasHeader() || ((error != qoi::DecodeError::None) && (error != qoi::DecodeError::TruncatedData)))
+    {
+        outError = std::string(qoi::GetErrorMessage(error)) + "!";
+        return false;
+    }
+
+    std::ofstream outputFile;
+    if (!isStdout)
+    {
+        outputFile.open(outputFilePath, std::ios::out | std::ios::binary);
+        if (outputFile.fail())
+        {
+            outError = "Cannot write output file " + outputFilePath + "!";
+            return false;
+        }
+    }
+    std::ostream &out = isStdout ? std::cout : outputFile;
+
+    writer.reset(new RowWriter(out, exportFormat, decoder.GetImageWidth(), decoder.GetImageHeight(), decoder.GetNumChannels()));
+    bool isSuccess = writer->WriteHeader(outError);
+    if (isSuccess)
+    {
+        std::vector<char> buffer(READ_SIZE);
+        while (!decoder.IsFinished() && inputFile)
+        {
+            // With a callback, the decoder takes everything it is given unless it found an error
+            inputFile.read(buffer.data(), buffer.size());
+            size_t numRead = static_cast<size_t>(inputFile.gcount());
+            if (decoder.Push(reinterpret_cast<const uint8_t *>(buffer.data()), numRead) < numRead)
+            {
+                break;
+            }
+        }
+
+        error = decoder.Finish();
+        if (error != qoi::DecodeError::None)
+        {
+            outError = std::string(qoi::GetErrorMessage(error)) + "!";
+            isSuccess = false;
+        }
+        else
+        {
+            writer->WriteEnd();
+            if (!out)
+            {
+                outError = "Cannot write output file " + outputFilePath + "!";
+                isSuccess = false;
+            }
+        }
+    }
+
+    // Don't leave a partial image behind
+    if (!isSuccess && !isStdout)
+    {
+        outputFile.close();
+        std::remove(outputFilePath.c_str());
+    }
+    return isSuccess;
+}
@@ -0,0 +1,19 @@
+#ifndef IMAGE_EXPORT_HEADER
+#define IMAGE_EXPORT_HEADER
+
+#include <cstdint>
+#include <string>
+
+/**
+ * @brief Decodes a QOI image file to raw pixels, a PPM or PAM file, or a PNG file with uncompressed data.
+ *        Rows go from the decoder to the output as soon as they are decoded, so only one row is ever in memory.
+ * @param[in] inputFilePath Path to the QOI file, or "-" to read it from stdin
+ * @param[in] outputFilePath Path to the output file, or "-" to write to stdout
+ * @param[in] format "rgba", "rgb", "ppm", "pam" or "png", or empty to pick it from the extension of the output file
+ * @param[out] outError Description of what went wrong, if the conversion failed
+ * @param[in] maxPixels Largest number of pixels the image may have, checked before it is decoded
+ * @return Flag indicating whether the conversion was successful or not.
+ */
+bool ConvertFromQoi(const std::string &inputFilePath, const std::string &outputFilePath, const std::string &format, std::string &outError, uint64_t maxPixels = UINT64_MAX);
+
+#endif // IMAGE_EXPORT_HEADER
@@ -0,0 +1,150 @@
+#include "ImageInfo.hpp"
+
+#include "qoi_decoder.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <iostream>
+#include <thread>
+
+namespace
+{
+/**
+ * Properties of one QOI file, as read from its header
+ */
+struct HeaderInfo
+{
+    /**
+     * Why the header could not be read, or DecodeError::None
+     */
+    qoi::DecodeError error = qoi::DecodeError::None;
+
+    /**
+     * Image width
+     */
+    uint32_t width = 0;
+
+    /**
+     * Image height
+     */
+    uint32_t height = 0;
+
+    /**
+     * Number of channels in the image
+     */
+    uint8_t numChannels = 0;
+
+    /**
+     * Colorspace of the image
+     */
+    qoi::ColorSpace colorSpace = qoi::ColorSpace::SRGB;
+};
+
+/**
+ * @brief Prints the specified string as a JSON string literal.
+ * @param[in] text String to print
+ */
+void PrintJsonString(const std::string &text)
+{
+    putchar('"');
+    for (char c : text)
+    {
+        if ((c == '"') || (c == '\\'))
+        {
+            putchar('\\');
+            putchar(c);
+        }
+        else if (static_cast<unsigned char>(c) < 0x20)
+        {
+            printf("\\u%04x", static_cast<unsigned char>(c));
+        }
+        else
+        {
+            putchar(c);
+        }
+    }
+    putchar('"');
+}
+}
+
+/**
+ * @brief Reads the headers of the specified QOI files on a pool of threads, and prints their properties in the order of the files.
+ *        Files whose header cannot be read are reported on stderr instead.
+ * @param[in] filePaths Paths to the QOI files
+ * @param[in] numThreads Number of threads, or 0 to use one per hardware thread
+ * @param[in] isJson Flag indicating whether to print a JSON array rather than a table
+ * @return Number of files whose header could not be read
+ */
+size_t PrintImageInfo(const std::vector<std::string> &filePaths, size_t numThreads, bool isJson)
+{
+    // Reading a header is one small read, so the threads are there to keep many reads in flight rather than for the CPU
+    std::vector<HeaderInfo> infos(filePaths.size());
+    std::atomic<size_t> nextIndex(0);
+    auto worker = [&]()
+    {
+        for (size_t i = nextIndex++; i < filePaths.size(); i = nextIndex++)
+        {
+            HeaderInfo &info = infos[i];
+            info.error = qoi::ReadHeader(filePaths[i], info.width, info.height, info.numChannels, info.colorSpace);
+        }
+    };
+
+    if (numThreads == 0)
+    {
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    numThreads = std::min(numThreads, std::max<size_t>(1, filePaths.size()));
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < numThreads; ++i)
+    {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+
+    size_t numFailed = 0;
+    bool isFirst = true;
+    if (isJson)
+    {
+        printf("[\n");
+    }
+    else
+    {
+        printf("%10s %10s %8s %10s  %s\n", "width", "height", "channels", "colorspace", "path");
+    }
+    for (size_t i = 0; i < filePaths.size(); ++i)
+    {
+        const HeaderInfo &info = infos[i];
+        if (info.error != qoi::DecodeError::None)
+        {
+            ++numFailed;
+            std::cerr << filePaths[i] << ": " << qoi::GetErrorMessage(info.error) << std::endl;
+            continue;
+        }
+
+        const char *colorSpaceName = (info.colorSpace == qoi::ColorSpace::SRGB) ? "srgb" : "linear";
+        if (isJson)
+        {
+            printf("%s  {\"path\": ", isFirst ? "" : ",\n");
+            PrintJsonString(filePaths[i]);
+            printf(", \"width\": %u, \"height\": %u, \"channels\": %u, \"colorspace\": \"%s\"}",
+                info.width, info.height, static_cast<unsigned>(info.numChannels), colorSpaceName);
+        }
+        else
+        {
+            printf("%10u %10u %8u %10s  %s\n", info.width, info.height, static_cast<unsigned>(info.numChannels), colorSpaceName, filePaths[i].c_str());
+        }
+        isFirst = false;
+    }
+    if (isJson)
+    {
+        printf("%s]\n", isFirst ? "" : "\n");
+    }
+
+    return numFailed;
+}
@@ -0,0 +1,18 @@
+#ifndef IMAGE_INFO_HEADER
+#define IMAGE_INFO_HEADER
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Reads the headers of the specified QOI files on a pool of threads, and prints their properties in the order of the files.
+ *        Files whose header cannot be read are reported on stderr instead.
+ * @param[in] filePaths Paths to the QOI files
+ * @param[in] numThreads Number of threads, or 0 to use one per hardware thread
+ * @param[in] isJson Flag indicating whether to print a JSON array rather than a table
+ * @return Number of files whose header could not be read
+ */
+size_t PrintImageInfo(const std::vector<std::string> &filePaths, size_t numThreads, bool isJson);
+
+#endif // IMAGE_INFO_HEADER
@@ -51,14 +51,15 @@ ImageViewerApp::~ImageViewerApp()
  * @brief Runs the application
  * @param[in] qoiImagePath Path to the QOI format image
  * @param[in] isVerbose Flag indicating whether to run the viewer in verbose mode
+ * @param[in] maxPixels Largest number of pixels the image may have, checked before it is decoded
  */
-void ImageViewerApp::Run(const std::string &qoiImagePath, bool isVerbose)
+void ImageViewerApp::Run(const std::string &qoiImagePath, bool isVerbose, uint64_t maxPixels)
 {
     std::vector<uint8_t> data = {};
     uint32_t imageWidth, imageHeight;
     uint8_t imageChannels;
     qoi::ColorSpace imageColorSpace;
-    if (!qoi::Decode(qoiImagePath, data, imageWidth, imageHeight, imageChannels, imageColorSpace))
+    if (!qoi::Decode(qoiImagePath, data, imageWidth, imageHeight, imageChannels, imageColorSpace, qoi::DecodeLimits(maxPixels)))
     {
         std::cerr << "Failed to decode " << qoiImagePath << std::endl;
         return;
@@ -5,6 +5,7 @@
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 
+#include <cstdint>
 #include <string>
 
 /**
@@ -44,8 +45,9 @@ public:
      * @brief Runs the application
      * @param[in] qoiImagePath Path to the QOI format image
      * @param[in] isVerbose Flag indicating whether to run the viewer in verbose mode
+     * @param[in] maxPixels Largest number of pixels the image may have, checked before it is decoded
      */
-    void Run(const std::string &qoiImagePath, bool isVerbose = false);
+    void Run(const std::string &qoiImagePath, bool isVerbose = false, uint64_t maxPixels = UINT64_MAX);
 
 private:
     /**
@@ -0,0 +1,605 @@
+#include "IoEngine.hpp"
+
+#include <unistd.h>
+
+#ifdef QOI_TOOLS_WITH_IO_URING
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+const size_t IoEngine::MAX_REQUEST_SIZE;
+
+namespace
+{
+#ifdef QOI_TOOLS_WITH_IO_URING
+/**
+ * Engine that hands the requests to the kernel through io_uring, using its system calls directly.
+ *
+ * Requests are written to the submission ring and started by one io_uring_enter() call in Wait(), which also waits
+ * for completions. Wake() writes to an eventfd that always has a read of its own in flight on the ring, so that
+ * waking the engine is just another completion.
+ */
+class UringIoEngine : public IoEngine
+{
+public:
+    UringIoEngine()
+        : m_ringFd(-1)
+        , m_eventFd(-1)
+        , m_ringMemory(nullptr)
+        , m_ringMemorySize(0)
+        , m_completionRingMemory(nullptr)
+        , m_completionRingMemorySize(0)
+        , m_entries(nullptr)
+        , m_entriesSize(0)
+        , m_submitHead(nullptr)
+        , m_submitTail(nullptr)
+        , m_submitMask(0)
+        , m_numEntries(0)
+        , m_completionHead(nullptr)
+        , m_completionTail(nullptr)
+        , m_completionMask(0)
+        , m_completions(nullptr)
+        , m_numUnsubmitted(0)
+        , m_wakeValue(0)
+    {
+    }
+
+    ~UringIoEngine() override
+    {
+        if (m_entries != nullptr)
+        {
+            munmap(m_entries, m_entriesSize);
+        }
+        if (m_completionRingMemory != nullptr)
+        {
+            munmap(m_completionRingMemory, m_completionRingMemorySize);
+        }
+        if (m_ringMemory != nullptr)
+        {
+            munmap(m_ringMemory, m_ringMemorySize);
+        }
+        if (m_eventFd >= 0)
+        {
+            close(m_eventFd);
+        }
+        if (m_ringFd >= 0)
+        {
+            close(m_ringFd);
+        }
+    }
+
+    /**
+     * @brief Sets up the rings.
+     * @param[in] queueDepth Largest number of requests that the caller keeps in flight
+     * @return Flag indicating whether the kernel supports io_uring and every operation that the engine uses.
+     */
+    bool Open(unsigned queueDepth)
+    {
+        // One more entry for the read of the eventfd
+        struct io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        m_ringFd = static_cast<int>(syscall(__NR_io_uring_setup, queueDepth + 1, &params));
+        if ((m_ringFd < 0) || !IsSupported())
+        {
+            return false;
+        }
+
+        // Since Linux 5.4 both rings live in one mapping
+        m_ringMemorySize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+        m_completionRingMemorySize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        const bool isSingleMapping = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (isSingleMapping)
+        {
+            m_ringMemorySize = std::max(m_ringMemorySize, m_completionRingMemorySize);
+        }
+        m_ringMemory = MapRing(m_ringMemorySize, IORING_OFF_SQ_RING);
+        if (m_ringMemory == nullptr)
+        {
+            return false;
+        }
+        uint8_t *completionRing = m_ringMemory;
+        if (!isSingleMapping)
+        {
+            m_completionRingMemory = MapRing(m_completionRingMemorySize, IORING_OFF_CQ_RING);
+            if (m_completionRingMemory == nullptr)
+            {
+                return false;
+            }
+            completionRing = m_completionRingMemory;
+        }
+        m_entriesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+        m_entries = reinterpret_cast<struct io_uring_sqe *>(MapRing(m_entriesSize, IORING_OFF_SQES));
+        if (m_entries == nullptr)
+        {
+            return false;
+        }
+
+        m_submitHead = reinterpret_cast<uint32_t *>(m_ringMemory + params.sq_off.head);
+        m_submitTail = reinterpret_cast<uint32_t *>(m_ringMemory + params.sq_off.tail);
+        m_submitMask = *reinterpret_cast<uint32_t *>(m_ringMemory + params.sq_off.ring_mask);
+        m_numEntries = params.sq_entries;
+        m_completionHead = reinterpret_cast<uint32_t *>(completionRing + params.cq_off.head);
+        m_completionTail = reinterpret_cast<uint32_t *>(completionRing + params.cq_off.tail);
+        m_completionMask = *reinterpret_cast<uint32_t *>(completionRing + params.cq_off.ring_mask);
+        m_completions = reinterpret_cast<struct io_uring_cqe *>(completionRing + params.cq_off.cqes);
+
+        // Entry i of the submission ring always points at submission entry i
+        uint32_t *submitArray = reinterpret_cast<uint32_t *>(m_ringMemory + params.sq_off.array);
+        for (uint32_t i = 0; i < m_numEntries; ++i)
+        {
+            submitArray[i] = i;
+        }
+
+        m_eventFd = eventfd(0, EFD_CLOEXEC);
+        if (m_eventFd < 0)
+        {
+            return false;
+        }
+        SubmitWakeRead();
+        return true;
+    }
+
+    const char *GetName() const override
+    {
+        return "io_uring";
+    }
+
+    void SubmitRead(int fd, uint8_t *buffer, size_t size, uint64_t offset, uint64_t tag) override
+    {
+        struct io_uring_sqe *entry = GetEntry();
+        entry->opcode = IORING_OP_READ;
+        entry->fd = fd;
+        entry->addr = reinterpret_cast<uintptr_t>(buffer);
+        entry->len = static_cast<uint32_t>(size);
+        entry->off = offset;
+        entry->user_data = tag;
+        PublishEntry();
+    }
+
+    void SubmitWrite(int fd, const uint8_t *buffer, size_t size, uint64_t offset, uint64_t tag) override
+    {
+        struct io_uring_sqe *entry = GetEntry();
+        entry->opcode = IORING_OP_WRITE;
+        entry->fd = fd;
+        entry->addr = reinterpret_cast<uintptr_t>(buffer);
+        entry->len = static_cast<uint32_t>(size);
+        entry->off = offset;
+        entry->user_data = tag;
+        PublishEntry();
+    }
+
+    void SubmitSync(int fd, uint64_t tag) override
+    {
+        struct io_uring_sqe *entry = GetEntry();
+        entry->opcode = IORING_OP_FSYNC;
+        entry->fd = fd;
+        entry->user_data = tag;
+        PublishEntry();
+    }
+
+    void Wait(std::vector<IoCompletion> &outCompletions) override
+    {
+        const size_t numCompletions = outCompletions.size();
+        bool isWoken = false;
+        while (true)
+        {
+            // Completions that are already there are taken without waiting, but queued requests are started either way
+            Reap(outCompletions, isWoken);
+            const bool isDone = (outCompletions.size() > numCompletions) || isWoken;
+            if (isDone && (m_numUnsubmitted == 0))
+            {
+                return;
+            }
+
+            unsigned flags = isDone ? 0 : IORING_ENTER_GETEVENTS;
+            int numSubmitted = static_cast<int>(syscall(__NR_io_uring_enter, m_ringFd, m_numUnsubmitted, isDone ? 0 : 1, flags, nullptr, 0));
+            if (numSubmitted >= 0)
+            {
+                m_numUnsubmitted -= std::min<uint32_t>(m_numUnsubmitted, static_cast<uint32_t>(numSubmitted));
+            }
+            else if ((errno != EINTR) && (errno != EAGAIN) && (errno != EBUSY))
+            {
+                // The ring itself is broken, so no request will ever complete. Fail them rather than hang.
+                FailUnsubmitted(outCompletions, -errno);
+            }
+        }
+    }
+
+    void Wake() override
+    {
+        uint64_t value = 1;
+        ssize_t written = write(m_eventFd, &value, sizeof(value));
+        (void)written;
+    }
+
+private:
+    /**
+     * @brief Checks that the kernel supports every operation that the engine submits, which io_uring itself does not guarantee.
+     * @return Flag indicating whether all operations are supported.
+     */
+    bool IsSupported()
+    {
+        const unsigned NUM_PROBED_OPS = 64;
+        std::vector<uint8_t> probeMemory(sizeof(struct io_uring_probe) + NUM_PROBED_OPS * sizeof(struct io_uring_probe_op), 0);
+        struct io_uring_probe *probe = reinterpret_cast<struct io_uring_probe *>(probeMemory.data());
+        if (syscall(__NR_io_uring_register, m_ringFd, IORING_REGISTER_PROBE, probe, NUM_PROBED_OPS) < 0)
+        {
+            return false;
+        }
+
+        const uint8_t ops[] = { IORING_OP_READ, IORING_OP_WRITE, IORING_OP_FSYNC };
+        for (uint8_t op : ops)
+        {
+            if ((op > probe->last_op) || ((probe->ops[op].flags & IO_URING_OP_SUPPORTED) == 0))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @brief Maps one of the rings of the io_uring instance.
+     * @param[in] size Size of the ring in bytes
+     * @param[in] offset Offset that selects the ring
+     * @return Pointer to the ring, or nullptr if it could not be mapped
+     */
+    uint8_t *MapRing(size_t size, off_t offset)
+    {
+        void *ring = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, offset);
+        return (ring == MAP_FAILED) ? nullptr : static_cast<uint8_t *>(ring);
+    }
+
+    /**
+     * @brief Gets the next free submission entry, cleared. If the ring is full, the queued entries are started first.
+     * @return Pointer to the entry
+     */
+    struct io_uring_sqe *GetEntry()
+    {
+        const uint32_t tail = *m_submitTail;
+        while (tail - __atomic_load_n(m_submitHead, __ATOMIC_ACQUIRE) >= m_numEntries)
+        {
+            int numSubmitted = static_cast<int>(syscall(__NR_io_uring_enter, m_ringFd, m_numUnsubmitted, 0, 0, nullptr, 0));
+            if (numSubmitted > 0)
+            {
+                m_numUnsubmitted -= std::min<uint32_t>(m_numUnsubmitted, static_cast<uint32_t>(numSubmitted));
+            }
+        }
+
+        struct io_uring_sqe *entry = &m_entries[tail & m_submitMask];
+        std::memset(entry, 0, sizeof(*entry));
+        return entry;
+    }
+
+    /**
+     * @brief Makes the entry returned by GetEntry() visible to the kernel.
+     */
+    void PublishEntry()
+    {
+        __atomic_store_n(m_submitTail, *m_submitTail + 1, __ATOMIC_RELEASE);
+        ++m_numUnsubmitted;
+    }
+
+    /**
+     * @brief Queues the read of the eventfd that completes when Wake() is called.
+     */
+    void SubmitWakeRead()
+    {
+        struct io_uring_sqe *entry = GetEntry();
+        entry->opcode = IORING_OP_READ;
+        entry->fd = m_eventFd;
+        entry->addr = reinterpret_cast<uintptr_t>(&m_wakeValue);
+        entry->len = sizeof(m_wakeValue);
+        entry->user_data = WAKE_TAG;
+        PublishEntry();
+    }
+
+    /**
+     * @brief Takes every completion off the completion ring.
+     * @param[out] outCompletions Vector where the completions of the caller's requests will be appended
+     * @param[out] outIsWoken Set if Wake() was called
+     */
+    void Reap(std::vector<IoCompletion> &outCompletions, bool &outIsWoken)
+    {
+        uint32_t head = *m_completionHead;
+        const uint32_t tail = __atomic_load_n(m_completionTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head)
+        {
+            const struct io_uring_cqe &completion = m_completions[head & m_completionMask];
+            if (completion.user_data == WAKE_TAG)
+            {
+                outIsWoken = true;
+                SubmitWakeRead();
+                continue;
+            }
+            outCompletions.push_back({ completion.user_data, completion.res });
+        }
+        __atomic_store_n(m_completionHead, head, __ATOMIC_RELEASE);
+    }
+
+    /**
+     * @brief Completes the requests that the kernel did not take with the specified error.
+     * @param[out] outCompletions Vector where the failed requests will be appended
+     * @param[in] result Minus the error number
+     */
+    void FailUnsubmitted(std::vector<IoCompletion> &outCompletions, int64_t result)
+    {
+        uint32_t tail = *m_submitTail;
+        for (uint32_t i = m_numUnsubmitted; i > 0; --i)
+        {
+            const uint64_t tag = m_entries[(tail - i) & m_submitMask].user_data;
+            if (tag != WAKE_TAG)
+            {
+                outCompletions.push_back({ tag, result });
+            }
+        }
+        __atomic_store_n(m_submitTail, tail - m_numUnsubmitted, __ATOMIC_RELEASE);
+        m_numUnsubmitted = 0;
+    }
+
+private:
+    /**
+     * Tag of the read of the eventfd, which the caller never sees
+     */
+    static const uint64_t WAKE_TAG = ~static_cast<uint64_t>(0);
+
+    /**
+     * File descriptors of the io_uring instance and of the eventfd that Wake() writes to
+     */
+    int m_ringFd;
+    int m_eventFd;
+
+    /**
+     * Mappings of the rings and of the submission entries
+     */
+    uint8_t *m_ringMemory;
+    size_t m_ringMemorySize;
+    uint8_t *m_completionRingMemory;
+    size_t m_completionRingMemorySize;
+    struct io_uring_sqe *m_entries;
+    size_t m_entriesSize;
+
+    /**
+     * Submission ring, which the engine produces and the kernel consumes
+     */
+    uint32_t *m_submitHead;
+    uint32_t *m_submitTail;
+    uint32_t m_submitMask;
+    uint32_t m_numEntries;
+
+    /**
+     * Completion ring, which the kernel produces and the engine consumes
+     */
+    uint32_t *m_completionHead;
+    uint32_t *m_completionTail;
+    uint32_t m_completionMask;
+    struct io_uring_cqe *m_completions;
+
+    /**
+     * Number of entries that were published but not yet handed to the kernel
+     */
+    uint32_t m_numUnsubmitted;
+
+    /**
+     * Value read from the eventfd
+     */
+    uint64_t m_wakeValue;
+};
+#endif // QOI_TOOLS_WITH_IO_URING
+
+/**
+ * Engine that performs the requests with blocking pread(), pwrite() and fsync() on a pool of threads, one per request
+ * that may be in flight. Works everywhere, at the cost of a thread switch per request.
+ */
+class ThreadPoolIoEngine : public IoEngine
+{
+public:
+    /**
+     * @brief Constructor
+     * @param[in] numThreads Number of threads, which is how many requests run at once
+     */
+    explicit ThreadPoolIoEngine(unsigned numThreads)
+        : m_isStopping(false)
+        , m_isWoken(false)
+    {
+        for (unsigned i = 0; i < std::max(1u, numThreads); ++i)
+        {
+            m_threads.emplace_back(&ThreadPoolIoEngine::RunRequests, this);
+        }
+    }
+
+    ~ThreadPoolIoEngine() override
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_requestMutex);
+            m_isStopping = true;
+        }
+        m_requestQueued.notify_all();
+        for (std::thread &thread : m_threads)
+        {
+            thread.join();
+        }
+    }
+
+    const char *GetName() const override
+    {
+        return "threads";
+    }
+
+    void SubmitRead(int fd, uint8_t *buffer, size_t size, uint64_t offset, uint64_t tag) override
+    {
+        Queue({ Operation::Read, fd, buffer, size, offset, tag });
+    }
+
+    void SubmitWrite(int fd, const uint8_t *buffer, size_t size, uint64_t offset, uint64_t tag) override
+    {
+        Queue({ Operation::Write, fd, const_cast<uint8_t *>(buffer), size, offset, tag });
+    }
+
+    void SubmitSync(int fd, uint64_t tag) override
+    {
+        Queue({ Operation::Sync, fd, nullptr, 0, 0, tag });
+    }
+
+    void Wait(std::vector<IoCompletion> &outCompletions) override
+    {
+        std::unique_lock<std::mutex> lock(m_completionMutex);
+        m_requestCompleted.wait(lock, [this]() { return !m_completions.empty() || m_isWoken; });
+        outCompletions.insert(outCompletions.end(), m_completions.begin(), m_completions.end());
+        m_completions.clear();
+        m_isWoken = false;
+    }
+
+    void Wake() override
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_completionMutex);
+            m_isWoken = true;
+        }
+        m_requestCompleted.notify_one();
+    }
+
+private:
+    /**
+     * Operation that a request performs
+     */
+    enum class Operation
+    {
+        Read,
+        Write,
+        Sync
+    };
+
+    /**
+     * Request that waits for a thread
+     */
+    struct Request
+    {
+        Operation operation;
+        int fd;
+        uint8_t *buffer;
+        size_t size;
+        uint64_t offset;
+        uint64_t tag;
+    };
+
+    /**
+     * @brief Hands the specified request to the next free thread.
+     * @param[in] request Request
+     */
+    void Queue(const Request &request)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_requestMutex);
+            m_requests.push_back(request);
+        }
+        m_requestQueued.notify_one();
+    }
+
+    /**
+     * @brief Performs requests until the engine is destroyed. Runs on every thread of the pool.
+     */
+    void RunRequests()
+    {
+        while (true)
+        {
+            Request request;
+            {
+                std::unique_lock<std::mutex> lock(m_requestMutex);
+                m_requestQueued.wait(lock, [this]() { return !m_requests.empty() || m_isStopping; });
+                if (m_requests.empty())
+                {
+                    return;
+                }
+                request = m_requests.front();
+                m_requests.pop_front();
+            }
+
+            int64_t result = 0;
+            do
+            {
+                switch (request.operation)
+                {
+                case Operation::Read:
+                    result = pread(request.fd, request.buffer, request.size, static_cast<off_t>(request.offset));
+                    break;
+                case Operation::Write:
+                    result = pwrite(request.fd, request.buffer, request.size, static_cast<off_t>(request.offset));
+                    break;
+                case Operation::Sync:
+                    result = fsync(request.fd);
+                    break;
+                }
+            } while ((result < 0) && (errno == EINTR));
+            if (result < 0)
+            {
+                result = -errno;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(m_completionMutex);
+                m_completions.push_back({ request.tag, result });
+            }
+            m_requestCompleted.notify_one();
+        }
+    }
+
+private:
+    /**
+     * Threads of the pool
+     */
+    std::vector<std::thread> m_threads;
+
+    /**
+     * Requests that no thread took yet, guarded by m_requestMutex
+     */
+    std::deque<Request> m_requests;
+    std::mutex m_requestMutex;
+    std::condition_variable m_requestQueued;
+    bool m_isStopping;
+
+    /**
+     * Completions that Wait() did not take yet, guarded by m_completionMutex
+     */
+    std::vector<IoCompletion> m_completions;
+    std::mutex m_completionMutex;
+    std::condition_variable m_requestCompleted;
+    bool m_isWoken;
+};
+}
+
+/**
+ * @brief Creates an engine of the specified kind.
+ * @param[in] kind Kind of engine. IoEngineKind::Auto falls back to threads where io_uring is not available.
+ * @param[in] queueDepth Largest number of requests that the caller keeps in flight
+ * @return The engine, or nullptr if an engine of that kind cannot be created on this system
+ */
+std::unique_ptr<IoEngine> IoEngine::Create(IoEngineKind kind, unsigned queueDepth)
+{
+#ifdef QOI_TOOLS_WITH_IO_URING
+    // io_uring may also be turned off, by the kernel.io_uring_disabled sysctl or a seccomp filter
+    if (kind != IoEngineKind::Threads)
+    {
+        std::unique_ptr<UringIoEngine> engine(new UringIoEngine());
+        if (engine->Open(queueDepth))
+        {
+            return std::unique_ptr<IoEngine>(engine.release());
+        }
+    }
+#endif
+    if (kind == IoEngineKind::Uring)
+    {
+        return nullptr;
+    }
+    return std::unique_ptr<IoEngine>(new ThreadPoolIoEngine(queueDepth));
+}
@@ -0,0 +1,109 @@
+#ifndef IO_ENGINE_HEADER
+#define IO_ENGINE_HEADER
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/**
+ * Kind of engine that performs reads and writes asynchronously: io_uring through its system calls, a pool of
+ * threads doing blocking pread() and pwrite(), or io_uring where the kernel allows it and threads otherwise
+ */
+enum class IoEngineKind
+{
+    Auto,
+    Uring,
+    Threads
+};
+
+/**
+ * Result of one read, write or sync
+ */
+struct IoCompletion
+{
+    /**
+     * Value that was passed when the request was submitted
+     */
+    uint64_t tag;
+
+    /**
+     * Number of bytes read or written (0 for a sync), or minus the error number if the request failed
+     */
+    int64_t result;
+};
+
+/**
+ * Interface of an engine that keeps many reads and writes in flight at once, so that the storage device
+ * always has work queued while the caller's threads do something else.
+ *
+ * Requests are only submitted and waited for on one thread. Wake() is the only function that other threads may call.
+ * A request may complete with fewer bytes than asked for, in which case the caller submits the rest.
+ */
+class IoEngine
+{
+public:
+    /**
+     * @brief Destructor. Requests that are still in flight must have completed.
+     */
+    virtual ~IoEngine() {}
+
+    /**
+     * @brief Gets the name of the engine, for reports.
+     * @return Name of the engine
+     */
+    virtual const char *GetName() const = 0;
+
+    /**
+     * @brief Queues a read from the specified file.
+     * @param[in] fd File descriptor
+     * @param[in] buffer Pointer to where the bytes will be read. Must stay valid until the read completes.
+     * @param[in] size Number of bytes to read, at most MAX_REQUEST_SIZE
+     * @param[in] offset Offset in the file to read from
+     * @param[in] tag Value that the completion of the read carries
+     */
+    virtual void SubmitRead(int fd, uint8_t *buffer, size_t size, uint64_t offset, uint64_t tag) = 0;
+
+    /**
+     * @brief Queues a write to the specified file.
+     * @param[in] fd File descriptor
+     * @param[in] buffer Pointer to the bytes to write. Must stay valid until the write completes.
+     * @param[in] size Number of bytes to write, at most MAX_REQUEST_SIZE
+     * @param[in] offset Offset in the file to write to
+     * @param[in] tag Value that the completion of the write carries
+     */
+    virtual void SubmitWrite(int fd, const uint8_t *buffer, size_t size, uint64_t offset, uint64_t tag) = 0;
+
+    /**
+     * @brief Queues flushing the specified file to the storage device.
+     * @param[in] fd File descriptor
+     * @param[in] tag Value that the completion of the sync carries
+     */
+    virtual void SubmitSync(int fd, uint64_t tag) = 0;
+
+    /**
+     * @brief Starts the queued requests, then waits until at least one request completed or Wake() was called.
+     * @param[out] outCompletions Vector where the completed requests will be appended
+     */
+    virtual void Wait(std::vector<IoCompletion> &outCompletions) = 0;
+
+    /**
+     * @brief Makes a Wait() that is in progress, or the next one, return even if nothing completed. May be called from any thread.
+     */
+    virtual void Wake() = 0;
+
+    /**
+     * @brief Creates an engine of the specified kind.
+     * @param[in] kind Kind of engine. IoEngineKind::Auto falls back to threads where io_uring is not available.
+     * @param[in] queueDepth Largest number of requests that the caller keeps in flight
+     * @return The engine, or nullptr if an engine of that kind cannot be created on this system
+     */
+    static std::unique_ptr<IoEngine> Create(IoEngineKind kind, unsigned queueDepth);
+
+    /**
+     * Largest number of bytes that one request may read or write
+     */
+    static const size_t MAX_REQUEST_SIZE = 1 << 30;
+};
+
+#endif // IO_ENGINE_HEADER
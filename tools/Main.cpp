@@ -1,14 +1,18 @@
+#include "AsyncBatchEncoder.hpp"
+#include "BatchEncoder.hpp"
+#include "Converter.hpp"
+#include "ImageExport.hpp"
+#include "ImageInfo.hpp"
+#ifdef QOI_TOOLS_WITH_VIEWER
 #include "ImageViewerApp.hpp"
-#include "qoi_decoder.hpp"
-#include "qoi_encoder.hpp"
-
-#define STB_IMAGE_IMPLEMENTATION
-#include <stb_image.h>
+#endif
 
+#include <cstdlib>
 #include <cstring>
-#include <fstream>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <vector>
 
 int main(int argc, char *argv[])
 {
@@ -19,17 +23,45 @@ int main(int argc, char *argv[])
     }
 
     const char* ENCODE_OPTION = "-e";
+    const char* DECODE_OPTION = "-d";
+    const char* FORMAT_OPTION = "-f";
+    const char* BATCH_OPTION = "-b";
+    const char* INFO_OPTION = "-i";
     const char* OUTPUT_OPTION = "-o";
+    const char* THREADS_OPTION = "-j";
+    const char* MAX_MEMORY_OPTION = "--max-memory";
+    const char* STRIPE_ROWS_OPTION = "--stripe-rows";
+    const char* MAX_PIXELS_OPTION = "--max-pixels";
     const char* VIEWER_OPTION = "-v";
     const char* VERBOSE_FLAG = "--verbose";
+    const char* JSON_FLAG = "--json";
+    const char* ATOMIC_FLAG = "--atomic";
+    const char* FSYNC_FLAG = "--fsync";
+    const char* QUEUE_DEPTH_OPTION = "--queue-depth";
+    const char* IO_ENGINE_OPTION = "--io-engine";
+    const char* IO_BENCH_FLAG = "--io-bench";
 
     std::string inputFilePath = {};
     std::string outputFilePath = {};
+    std::string outputFormat = {};
+    std::vector<std::string> batchInputs = {};
+    size_t numThreads = 0;
+    size_t maxMemoryMegabytes = 1024;
+    uint32_t stripeRows = 0;
+    uint64_t maxPixels = UINT64_MAX;
+    unsigned queueDepth = 0;
+    std::string ioEngineName = "auto";
     bool isEncode = false;
+    bool isDecode = false;
+    bool isBatch = false;
+    bool isInfo = false;
     bool isViewer = false;
     bool isVerbose = false;
+    bool isJson = false;
+    bool isIoBench = false;
+    qoi::WriteOptions writeOptions;
 
-    for (size_t i = 1; i < argc; ++i)
+    for (int i = 1; i < argc; ++i)
     {
         if (strcmp(argv[i], ENCODE_OPTION) == 0)
         {
@@ -39,6 +71,32 @@ int main(int argc, char *argv[])
                 inputFilePath = argv[++i];
             }
         }
+        else if (strcmp(argv[i], DECODE_OPTION) == 0)
+        {
+            isDecode = true;
+            if (i + 1 < argc)
+            {
+                inputFilePath = argv[++i];
+            }
+        }
+        else if (strcmp(argv[i], FORMAT_OPTION) == 0)
+        {
+            if (i + 1 < argc)
+            {
+                outputFormat = argv[++i];
+            }
+        }
+        else if ((strcmp(argv[i], BATCH_OPTION) == 0) || (strcmp(argv[i], INFO_OPTION) == 0))
+        {
+            isBatch = (strcmp(argv[i], BATCH_OPTION) == 0);
+            isInfo = !isBatch;
+
+            // Take every argument up to the next option, so that a shell-expanded glob works too
+            while ((i + 1 < argc) && ((argv[i + 1][0] != '-') || (strcmp(argv[i + 1], "-") == 0)))
+            {
+                batchInputs.push_back(argv[++i]);
+            }
+        }
         else if (strcmp(argv[i], OUTPUT_OPTION) == 0)
         {
             if (i + 1 < argc)
@@ -46,6 +104,34 @@ int main(int argc, char *argv[])
                 outputFilePath = argv[++i];
             }
         }
+        else if (strcmp(argv[i], THREADS_OPTION) == 0)
+        {
+            if (i + 1 < argc)
+            {
+                numThreads = strtoul(argv[++i], nullptr, 10);
+            }
+        }
+        else if (strcmp(argv[i], MAX_MEMORY_OPTION) == 0)
+        {
+            if (i + 1 < argc)
+            {
+                maxMemoryMegabytes = strtoul(argv[++i], nullptr, 10);
+            }
+        }
+        else if (strcmp(argv[i], STRIPE_ROWS_OPTION) == 0)
+        {
+            if (i + 1 < argc)
+            {
+                stripeRows = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+            }
+        }
+        else if (strcmp(argv[i], MAX_PIXELS_OPTION) == 0)
+        {
+            if (i + 1 < argc)
+            {
+                maxPixels = strtoull(argv[++i], nullptr, 10);
+            }
+        }
         else if (strcmp(argv[i], VIEWER_OPTION) == 0)
         {
             isViewer = true;
@@ -58,14 +144,135 @@ int main(int argc, char *argv[])
         {
             isVerbose = true;
         }
+        else if (strcmp(argv[i], JSON_FLAG) == 0)
+        {
+            isJson = true;
+        }
+        else if (strcmp(argv[i], ATOMIC_FLAG) == 0)
+        {
+            writeOptions.isAtomic = true;
+        }
+        else if (strcmp(argv[i], FSYNC_FLAG) == 0)
+        {
+            writeOptions.isSynced = true;
+        }
+        else if (strcmp(argv[i], QUEUE_DEPTH_OPTION) == 0)
+        {
+            if (i + 1 < argc)
+            {
+                queueDepth = static_cast<unsigned>(strtoul(argv[++i], nullptr, 10));
+            }
+        }
+        else if (strcmp(argv[i], IO_ENGINE_OPTION) == 0)
+        {
+            if (i + 1 < argc)
+            {
+                ioEngineName = argv[++i];
+            }
+        }
+        else if (strcmp(argv[i], IO_BENCH_FLAG) == 0)
+        {
+            isIoBench = true;
+        }
     }
 
     if (isViewer)
     {
+#ifdef QOI_TOOLS_WITH_VIEWER
         ImageViewerApp viewerApp;
-        viewerApp.Run(inputFilePath, isVerbose);
+        viewerApp.Run(inputFilePath, isVerbose, maxPixels);
+#else
+        std::cerr << "This build of " << argv[0] << " does not include the image viewer!" << std::endl;
+        return 1;
+#endif
     }
-    else if (isEncode)
+    else if (isInfo)
+    {
+        std::vector<std::string> inputFilePaths;
+        for (const std::string &input : batchInputs)
+        {
+            BatchEncoder::CollectInputs(input, inputFilePaths, true);
+        }
+        if (inputFilePaths.empty())
+        {
+            std::cerr << "No input files found!" << std::endl;
+            return 1;
+        }
+
+        if (PrintImageInfo(inputFilePaths, numThreads, isJson) > 0)
+        {
+            return 1;
+        }
+    }
+    else if (isBatch)
+    {
+        std::vector<std::string> inputFilePaths;
+        for (const std::string &input : batchInputs)
+        {
+            BatchEncoder::CollectInputs(input, inputFilePaths);
+        }
+        if (inputFilePaths.empty())
+        {
+            std::cerr << "No input files found!" << std::endl;
+            return 1;
+        }
+        const size_t numInputs = inputFilePaths.size();
+
+        // Inputs that would overwrite each other's output are failures of their own, rather than a race between two
+        // workers, or two asynchronous writes, on the same file
+        const size_t numColliding = BatchEncoder::RemoveCollidingInputs(inputFilePaths, outputFilePath);
+
+        IoEngineKind ioEngineKind = IoEngineKind::Auto;
+        if (ioEngineName == "uring")
+        {
+            ioEngineKind = IoEngineKind::Uring;
+        }
+        else if (ioEngineName == "threads")
+        {
+            ioEngineKind = IoEngineKind::Threads;
+        }
+        else if (ioEngineName != "auto")
+        {
+            std::cerr << "Unknown I/O engine " << ioEngineName << "!" << std::endl;
+            return 1;
+        }
+
+        // In batch mode, -o names a directory
+        const size_t memoryBudget = maxMemoryMegabytes * 1024 * 1024;
+        if (isIoBench)
+        {
+            const unsigned maxQueueDepth = (queueDepth > 0) ? queueDepth : 64;
+            return ((RunIoBenchmark(inputFilePaths, outputFilePath, ioEngineKind, maxQueueDepth, numThreads, memoryBudget, stripeRows, maxPixels) > 0) ||
+                    (numColliding > 0))
+                       ? 1
+                       : 0;
+        }
+
+        size_t numFailed = numColliding;
+        if (queueDepth > 0)
+        {
+            // With a queue depth, the reads and writes overlap the conversions instead of taking turns with them
+            std::unique_ptr<IoEngine> ioEngine = IoEngine::Create(ioEngineKind, queueDepth);
+            if (!ioEngine)
+            {
+                std::cerr << "io_uring is not available on this system!" << std::endl;
+                return 1;
+            }
+            AsyncBatchEncoder batchEncoder(*ioEngine, queueDepth, numThreads, memoryBudget, stripeRows, maxPixels, writeOptions);
+            numFailed += batchEncoder.Run(inputFilePaths, outputFilePath, isVerbose);
+        }
+        else
+        {
+            BatchEncoder batchEncoder(numThreads, memoryBudget, stripeRows, maxPixels, writeOptions);
+            numFailed += batchEncoder.Run(inputFilePaths, outputFilePath, isVerbose);
+        }
+        if (numFailed > 0)
+        {
+            std::cerr << "Failed to encode " << numFailed << " of " << numInputs << " files!" << std::endl;
+            return 1;
+        }
+    }
+    else if (isDecode)
     {
         if (inputFilePath.empty())
         {
@@ -78,34 +285,31 @@ int main(int argc, char *argv[])
             return 1;
         }
 
-        char buffer[4] = {};
-        std::ifstream inputFile(inputFilePath, std::ios::binary);
-        inputFile.read(buffer, 4);
-
-        // Check if the input file happens to be in QOI format already by checking the first four bytes.
-        // If it is, then we don't do anything.
-        if ((buffer[0] == 'q') && (buffer[1] == 'o') && (buffer[2] == 'i') && (buffer[3] == 'f'))
+        std::string error;
+        if (!ConvertFromQoi(inputFilePath, outputFilePath, outputFormat, error, maxPixels))
         {
-            std::cout << "Input image file is already in QOI format!" << std::endl;
+            std::cerr << error << std::endl;
             return 1;
         }
-
-        int inputImageWidth = 0, inputImageHeight = 0, inputImageNumChannels = 0;
-        unsigned char *pixels = stbi_load(inputFilePath.c_str(), &inputImageWidth, &inputImageHeight, &inputImageNumChannels, 0);
-        if (pixels == nullptr)
+    }
+    else if (isEncode)
+    {
+        if (inputFilePath.empty())
         {
-            std::cerr << "Cannot read input image file!" << std::endl;
+            std::cerr << "No input file specified!" << std::endl;
+            return 1;
+        }
+        if (outputFilePath.empty())
+        {
+            std::cerr << "No output file specified!" << std::endl;
             return 1;
         }
 
-        std::vector<uint8_t> pixelsVector;
-        pixelsVector.resize(inputImageWidth * inputImageHeight * inputImageNumChannels);
-        memcpy(pixelsVector.data(), pixels, pixelsVector.size());
-        stbi_image_free(pixels);
-
-        if (!qoi::Encode(pixelsVector, inputImageWidth, inputImageHeight, inputImageNumChannels, 0, outputFilePath))
+        std::string error;
+        if (!ConvertToQoi(inputFilePath, outputFilePath, error, stripeRows, maxPixels, writeOptions))
         {
-            std::cerr << "Failed to encode " << inputFilePath << " to QOI format!" << std::endl;
+            std::cerr << error << std::endl;
+            return 1;
         }
     }
 